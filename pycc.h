@@ -0,0 +1,74 @@
+// pycc.h
+// Build API of libpycc: pycclinux.c compiled with -DPYCC_LIBRARY.
+//
+//   gcc -O2 -shared -fPIC -DPYCC_LIBRARY -o libpycc.so pycclinux.c $(python3-config --includes) $(python3-config --ldflags --embed) -lz
+//
+// The same object is also the `pyccbuild` Python extension module (see
+// README). Builds compile with the Python the library is linked into, so
+// the stub must be a pycc built against the same Python X.Y.
+
+#ifndef PYCC_H
+#define PYCC_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Build flags
+#define PYCC_BUILD_REQUIRE_GIL      0x01u // --require-gil
+#define PYCC_BUILD_COMPRESS         0x02u // --compress
+#define PYCC_BUILD_SEAL_PATH        0x04u // --seal-path
+#define PYCC_BUILD_IMMORTALIZE      0x08u // --immortalize
+#define PYCC_BUILD_NO_IMPORT_FINDER 0x10u // --no-import-finder
+#define PYCC_BUILD_QUIET            0x20u // no "[*] ..." progress lines on stdout
+
+enum pycc_build_stage {
+    PYCC_STAGE_COMPILE = 1, // one source compiled (or resource read); name is its entry name
+    PYCC_STAGE_COMPRESS,    // code entries compressed
+    PYCC_STAGE_WRITE,       // payload written; bytes is its size
+    PYCC_STAGE_STUB,        // stub copied into the output; bytes is its size
+    PYCC_STAGE_DONE,        // output complete
+};
+
+struct pycc_progress {
+    int stage;              // enum pycc_build_stage
+    const char *name;       // entry name for PYCC_STAGE_COMPILE, else NULL
+    unsigned done, total;   // sources compiled so far / to compile
+    unsigned long long bytes;
+    double elapsed_ms;      // since pycc_build() started
+};
+
+// Called on the building thread. Builds from an embedding Python hold the
+// GIL only for PYCC_STAGE_COMPILE.
+typedef void (*pycc_progress_fn)(void *ctx, const struct pycc_progress *progress);
+
+struct pycc_build_options {
+    const char *script;             // entry script (required)
+    const char *output;             // output binary (required)
+    const char *stub;               // pycc binary copied as the stub (required
+                                    // unless thin_runtime is set)
+    const char *const *modules;     // "NAME=PATH", NULL-terminated; may be NULL
+    const char *const *entries;     // "NAME=PATH" multi-call entries; may be NULL
+    const char *const *resources;   // "NAME=PATH" --resource files; may be NULL
+    const char *const *extra_args;  // further --build options, NULL-terminated
+                                    // (e.g. "--gc-threshold", "700,10,10")
+    const char *thin_runtime;       // --thin=RUNTIME when not NULL
+    unsigned flags;                 // PYCC_BUILD_*
+    pycc_progress_fn progress;      // may be NULL
+    void *progress_ctx;
+};
+
+// Build one binary. Safe to call from several threads at once. In a process
+// without a Python interpreter, the first call starts one (without signal
+// handlers) and keeps it until exit. Returns 0 on success or the exit code
+// `pycc --build` would return; errors are printed to stderr.
+int pycc_build(const struct pycc_build_options *options);
+
+// The pycc command line (`pycc --build ...`, `pycc bench ...`).
+int pycc_main(int argc, char **argv);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // PYCC_H
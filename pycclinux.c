@@ -3,6 +3,7 @@
 // Linux-compatible version with proper Python integration
 
 #include <Python.h>
+#include <marshal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -11,21 +12,124 @@
 #include <limits.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <pthread.h>
+#include <time.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <signal.h>
+#include <errno.h>
+#include <dlfcn.h>
+#include <link.h>
+#include <ctype.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/ptrace.h>
+#include <spawn.h>
+#include <sched.h>
+#include <math.h>
+#include <zlib.h>
+#include <stdarg.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+#if defined(__has_include)
+#if __has_include(<sqlite3.h>)
+// header only: the VFS binds to the SQLite that _sqlite3 loads at run time
+#include <sqlite3.h>
+#define PYCC_SQLITE_VFS 1
+#endif
+#endif
+
+#include "pycc.h"
 
 #define SEP "/"
 
 // Footer format:
 // [payload bytes ...][footer]
 // footer = "PYBND" (5 bytes) + uint64 payload_size (little-endian) = 13 bytes total
+// v2 footer = uint32 flags (LE) + "PYBN2" + uint64 payload_size = 17 bytes total;
+// the last 13 bytes keep the v1 layout so either can be probed from the end.
 static const char FOOTER_MAGIC[] = "PYBND";
+static const char FOOTER_MAGIC_V2[] = "PYBN2";
 static const size_t FOOTER_MAGIC_LEN = 5;
 static const size_t FOOTER_LEN = 5 + 8; // magic + 8-byte payload size
+static const size_t FOOTER_V2_LEN = 4 + 5 + 8; // flags + magic + payload size
 
-// Helper: write little-endian uint64
-static void write_u64_le(FILE* f, uint64_t v) {
-    unsigned char buf[8];
-    for (int i = 0; i < 8; ++i) buf[i] = (unsigned char)((v >> (8 * i)) & 0xFF);
-    fwrite(buf, 1, 8, f);
+// Footer flags
+#define FOOTER_FLAG_FREE_THREADED 0x1u // payload may run with the GIL disabled
+#define FOOTER_FLAG_INDEXED       0x2u // payload starts with an entry index
+
+// Indexed payload format:
+// [index header][entry records][entry data ...]
+// index header = "PYCCIDX1" + uint32 entry_count + uint32 reserved + uint64 index_size
+// entry record = uint8 kind + uint8 codec + uint16 name_len + uint32 flags
+//                + uint64 offset + uint64 stored_size + uint64 raw_size
+//                + name bytes, padded to 8
+// Offsets are relative to the payload start; entry data is aligned to at
+// least ENTRY_ALIGN bytes of the file so it can be used straight from a mapping.
+// Resources of a page or more start on a page boundary.
+static const char INDEX_MAGIC[] = "PYCCIDX1";
+#define INDEX_HEADER_LEN 24
+#define ENTRY_RECORD_LEN 32
+#define ENTRY_ALIGN 64
+#define RESOURCE_PAGE_ALIGN 4096
+
+enum {
+    ENTRY_MAIN = 1,   // marshalled code of an entry script (pyc layout)
+    ENTRY_META = 2,   // build settings, "key=value" lines
+    ENTRY_MODULE = 3, // importable module, pyc layout; name is the dotted name
+    ENTRY_RESOURCE = 4, // --resource file, stored as is; read via pycc.resource()
+    ENTRY_DICT = 5,   // zlib preset dictionary shared by CODEC_ZLIB_DICT entries
+};
+
+#define ENTRY_FLAG_PACKAGE 0x1
+
+enum {
+    CODEC_RAW = 0,
+    CODEC_ZLIB = 1,   // zlib stream; raw_size is the inflated size
+    CODEC_ZLIB_FRAMES = 2, // seekable: independent zlib frames, see below
+    CODEC_ZLIB_DICT = 3, // zlib stream against the payload's ENTRY_DICT
+};
+
+// CODEC_ZLIB_FRAMES data: u32 frame_size + u32 nframes + (nframes + 1) u64
+// frame offsets relative to the entry data, then the frames. Frame i holds
+// raw bytes [i * frame_size, (i + 1) * frame_size); bit 63 of its offset
+// marks a frame stored raw because it would not shrink.
+#define FRAME_TABLE_HEADER 8
+#define FRAME_RAW_BIT (1ull << 63)
+#define RESOURCE_FRAME_DEFAULT (256u << 10)
+
+// Helper: read little-endian uint32
+static uint32_t read_u32_le(FILE* f) {
+    unsigned char buf[4];
+    if (fread(buf, 1, 4, f) != 4) return 0;
+    uint32_t v = 0;
+    for (int i = 0; i < 4; ++i) v |= ((uint32_t)buf[i]) << (8 * i);
+    return v;
+}
+
+// Helpers: little-endian integers in memory
+static uint32_t get_u32_le(const unsigned char *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint64_t get_u64_le(const unsigned char *p) {
+    return (uint64_t)get_u32_le(p) | ((uint64_t)get_u32_le(p + 4) << 32);
+}
+
+static void put_u32_le(unsigned char *p, uint32_t v) {
+    for (int i = 0; i < 4; ++i) p[i] = (unsigned char)(v >> (8 * i));
+}
+
+static void put_u64_le(unsigned char *p, uint64_t v) {
+    put_u32_le(p, (uint32_t)v);
+    put_u32_le(p + 4, (uint32_t)(v >> 32));
 }
 
 // Helper: read little-endian uint64
@@ -45,275 +149,7034 @@ static int get_self_path(char *out, size_t out_size) {
     return 1;
 }
 
-// Build .pyc using Python's py_compile.compile() into out_pyc path.
-// Returns 0 on success, nonzero on failure.
-static int build_pyc_with_python(const char *script_path, const char *out_pyc_path) {
-    int ret = 1;
-    Py_Initialize();
+// Locate the appended payload in an open binary.
+// Returns 0 and fills payload_start/payload_size/flags on success, otherwise
+// the bootloader error code (3..9) describing what was wrong.
+static int locate_payload(FILE *f, long *payload_start, uint64_t *payload_size, uint32_t *flags) {
+    if (fseek(f, 0, SEEK_END) != 0) return 3;
+    long endpos = ftell(f);
+    if (endpos < (long)FOOTER_LEN) return 4;
 
-    // Build a small Python snippet to call py_compile.compile(script, cfile=out_pyc, doraise=True)
-    PyObject *py_module_name = PyUnicode_FromString("py_compile");
-    if (!py_module_name) goto cleanup;
-    PyObject *py_module = PyImport_Import(py_module_name);
-    Py_DECREF(py_module_name);
-    if (!py_module) {
-        PyErr_Print();
-        goto cleanup;
+    // Seek to footer start position
+    if (fseek(f, endpos - FOOTER_LEN, SEEK_SET) != 0) return 5;
+
+    char magic[6] = {0};
+    if (fread(magic, 1, FOOTER_MAGIC_LEN, f) != FOOTER_MAGIC_LEN) return 6;
+    size_t footer_len = FOOTER_LEN;
+    if (memcmp(magic, FOOTER_MAGIC_V2, FOOTER_MAGIC_LEN) == 0) footer_len = FOOTER_V2_LEN;
+    else if (memcmp(magic, FOOTER_MAGIC, FOOTER_MAGIC_LEN) != 0) return 7;
+
+    uint64_t size = read_u64_le(f);
+    if (size == 0) return 8;
+
+    uint32_t fl = 0;
+    if (footer_len == FOOTER_V2_LEN) {
+        if (endpos < (long)FOOTER_V2_LEN) return 4;
+        if (fseek(f, endpos - FOOTER_V2_LEN, SEEK_SET) != 0) return 5;
+        fl = read_u32_le(f);
     }
 
-    PyObject *py_func = PyObject_GetAttrString(py_module, "compile");
-    if (!py_func || !PyCallable_Check(py_func)) {
-        PyErr_Print();
-        Py_XDECREF(py_func);
-        Py_DECREF(py_module);
-        goto cleanup;
+    long start = endpos - (long)footer_len - (long)size;
+    if (start < 0) return 9;
+
+    *payload_start = start;
+    *payload_size = size;
+    *flags = fl;
+    return 0;
+}
+
+// Returns 1 if the running executable carries a payload (i.e. it is a built
+// program rather than the pycc tool itself).
+// Thin binaries are "#!<runtime> --pycc-thin" scripts: the payload lives in
+// the thin file, the code in a shared runtime (a copy of this stub) that the
+// kernel runs as `runtime --pycc-thin <thin file> args...`.
+#ifndef PYCC_RUNTIME_DIR
+#define PYCC_RUNTIME_DIR "/usr/lib/pycc"
+#endif
+#define THIN_FLAG "--pycc-thin"
+static const char *thin_file;
+
+// File holding the payload: the thin file if there is one, else this binary.
+static int get_payload_path(char *out, size_t out_size) {
+    if (!thin_file) return get_self_path(out, out_size);
+    char resolved[PATH_MAX];
+    if (!realpath(thin_file, resolved) || strlen(resolved) >= out_size) return 0;
+    strcpy(out, resolved);
+    return 1;
+}
+
+static int self_has_payload(void) {
+    char selfpath[4096];
+    if (!get_self_path(selfpath, sizeof(selfpath))) return 0;
+    FILE *f = fopen(selfpath, "rb");
+    if (!f) return 0;
+    long start;
+    uint64_t size;
+    uint32_t flags;
+    int r = locate_payload(f, &start, &size, &flags);
+    fclose(f);
+    return r == 0;
+}
+
+// The running binary mapped read-only. Payload bytes are used in place, so
+// every interpreter in the process (and every process running the same
+// binary) shares the same page-cache pages.
+struct payload_entry {
+    uint8_t kind;
+    uint8_t codec;
+    uint32_t flags;
+    char name[256];
+    uint64_t offset;
+    uint64_t stored_size;
+    uint64_t raw_size;
+};
+
+static struct {
+    void *map;
+    size_t map_len;
+    const char *data;
+    uint64_t size;
+    uint32_t flags;
+    unsigned nentries;
+    struct payload_entry *entries;
+    const char *main_name;      // ENTRY_MAIN to run; see select_entry()
+} payload;
+
+// Parse the entry index at the start of an indexed payload. `index` holds at
+// least the first `avail` bytes of the payload. Returns 0 on success.
+static int parse_payload_index(const unsigned char *index, uint64_t avail, uint64_t payload_size) {
+    if (avail < INDEX_HEADER_LEN || memcmp(index, INDEX_MAGIC, 8) != 0) return 1;
+    uint32_t count = get_u32_le(index + 8);
+    uint64_t index_size = get_u64_le(index + 16);
+    if (index_size > avail || index_size > payload_size) return 2;
+
+    struct payload_entry *entries = calloc(count ? count : 1, sizeof(*entries));
+    if (!entries) return 3;
+    uint64_t pos = INDEX_HEADER_LEN;
+    for (uint32_t i = 0; i < count; ++i) {
+        if (pos + ENTRY_RECORD_LEN > index_size) { free(entries); return 4; }
+        const unsigned char *r = index + pos;
+        struct payload_entry *e = &entries[i];
+        e->kind = r[0];
+        e->codec = r[1];
+        uint16_t name_len = (uint16_t)(r[2] | (r[3] << 8));
+        e->flags = get_u32_le(r + 4);
+        e->offset = get_u64_le(r + 8);
+        e->stored_size = get_u64_le(r + 16);
+        e->raw_size = get_u64_le(r + 24);
+        pos += ENTRY_RECORD_LEN;
+        if (pos + name_len > index_size || name_len >= sizeof(e->name)) { free(entries); return 4; }
+        memcpy(e->name, index + pos, name_len);
+        e->name[name_len] = '\0';
+        pos += (name_len + 7u) & ~7u;
+        if (e->offset > payload_size || e->stored_size > payload_size - e->offset) { free(entries); return 5; }
+    }
+    free(payload.entries);
+    payload.entries = entries;
+    payload.nentries = count;
+    return 0;
+}
+
+// First entry of the given kind (and name, if not NULL).
+static const struct payload_entry *find_entry(uint8_t kind, const char *name) {
+    for (unsigned i = 0; i < payload.nentries; ++i) {
+        const struct payload_entry *e = &payload.entries[i];
+        if (e->kind == kind && (!name || strcmp(e->name, name) == 0)) return e;
+    }
+    return NULL;
+}
+
+// Build settings from the ENTRY_META entry. Environment variables of the same
+// name (PYCC_ + upper-cased key, dots as underscores) override them.
+#define MAX_SETTINGS 32
+static struct {
+    unsigned count;
+    char key[MAX_SETTINGS][48];
+    char value[MAX_SETTINGS][4096 - 48];
+} settings;
+
+static void load_settings(const char *text, size_t len) {
+    size_t pos = 0;
+    while (pos < len && settings.count < MAX_SETTINGS) {
+        size_t end = pos;
+        while (end < len && text[end] != '\n') ++end;
+        const char *eq = memchr(text + pos, '=', end - pos);
+        if (eq) {
+            size_t klen = (size_t)(eq - (text + pos));
+            size_t vlen = end - (size_t)(eq - text) - 1;
+            if (klen < sizeof(settings.key[0]) && vlen < sizeof(settings.value[0])) {
+                memcpy(settings.key[settings.count], text + pos, klen);
+                settings.key[settings.count][klen] = '\0';
+                memcpy(settings.value[settings.count], eq + 1, vlen);
+                settings.value[settings.count][vlen] = '\0';
+                settings.count++;
+            }
+        }
+        pos = end + 1;
     }
+}
 
-    PyObject *py_script = PyUnicode_FromString(script_path);
-    PyObject *py_out = PyUnicode_FromString(out_pyc_path);
-    if (!py_script || !py_out) {
-        Py_XDECREF(py_script); Py_XDECREF(py_out);
-        Py_DECREF(py_func); Py_DECREF(py_module);
-        goto cleanup;
+static const char *setting(const char *key) {
+    char env[64] = "PYCC_";
+    size_t n = 5;
+    for (const char *k = key; *k && n < sizeof(env) - 1; ++k, ++n) {
+        env[n] = (*k == '.') ? '_' : (char)toupper((unsigned char)*k);
+    }
+    env[n] = '\0';
+    const char *v = getenv(env);
+    if (v) return v;
+    for (unsigned i = 0; i < settings.count; ++i) {
+        if (strcmp(settings.key[i], key) == 0) return settings.value[i];
     }
+    return NULL;
+}
 
-    PyObject *kwargs = PyDict_New();
-    PyDict_SetItemString(kwargs, "cfile", py_out);
-    PyDict_SetItemString(kwargs, "doraise", Py_True);
+static int map_payload(FILE *f, long payload_start, uint64_t payload_size) {
+    size_t len = (size_t)payload_start + (size_t)payload_size;
+    void *m = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fileno(f), 0);
+    if (m == MAP_FAILED) return 1;
+    payload.map = m;
+    payload.map_len = len;
+    payload.data = (const char *)m + payload_start;
+    payload.size = payload_size;
+    if (payload.flags & FOOTER_FLAG_INDEXED) {
+        if (parse_payload_index((const unsigned char *)payload.data, payload_size, payload_size) != 0) {
+            munmap(m, len);
+            payload.map = NULL;
+            return 2;
+        }
+        const struct payload_entry *meta = find_entry(ENTRY_META, NULL);
+        if (meta) load_settings(payload.data + meta->offset, (size_t)meta->stored_size);
+    }
+    return 0;
+}
 
-    PyObject *args = PyTuple_Pack(1, py_script);
-    PyObject *res = PyObject_Call(py_func, args, kwargs);
+static void unmap_payload(void) {
+    if (payload.map) munmap(payload.map, payload.map_len);
+    payload.map = NULL;
+    payload.data = NULL;
+}
 
-    Py_DECREF(args);
-    Py_DECREF(kwargs);
-    Py_DECREF(py_script);
-    Py_DECREF(py_out);
-    Py_DECREF(py_func);
-    Py_DECREF(py_module);
+// Unmarshal the payload's code object. The pyc header is 16 bytes since
+// Python 3.7; older layouts used 12 or 8.
+static PyObject *unmarshal_payload_code(const char *data, size_t size) {
+    static const size_t header_sizes[] = { 16, 12, 8 };
+    for (size_t i = 0; i < sizeof(header_sizes) / sizeof(header_sizes[0]); ++i) {
+        size_t h = header_sizes[i];
+        if (size <= h) continue;
+        PyObject *code = PyMarshal_ReadObjectFromString(data + h, (Py_ssize_t)(size - h));
+        if (code && PyCode_Check(code)) return code;
+        Py_XDECREF(code);
+        PyErr_Clear();
+    }
+    PyErr_SetString(PyExc_ValueError, "embedded payload is not a marshalled code object");
+    return NULL;
+}
 
-    if (!res) {
-        // compile failed (raises SyntaxError etc.)
-        PyErr_Print();
-        ret = 2;
+// code.immortal: pin payload code objects (3.12+ immortal refcount) so that
+// making functions and frames from them never writes to their pages. Code
+// objects are not GC-tracked, so this only trades a leak at exit for sharing.
+static void immortalize_code(PyObject *co) {
+#if defined(_Py_IMMORTAL_REFCNT) && !defined(Py_GIL_DISABLED)
+    if (!PyCode_Check(co) || _Py_IsImmortal(co)) return;
+    Py_SET_REFCNT(co, _Py_IMMORTAL_REFCNT);
+    PyObject *consts = PyObject_GetAttrString(co, "co_consts");
+    if (!consts) { PyErr_Clear(); return; }
+    for (Py_ssize_t i = 0; i < PyTuple_GET_SIZE(consts); ++i) immortalize_code(PyTuple_GET_ITEM(consts, i));
+    Py_DECREF(consts);
+#else
+    (void)co;
+#endif
+}
+
+static PyObject *load_code(const char *data, size_t size) {
+    PyObject *code = unmarshal_payload_code(data, size);
+    const char *imm = setting("code.immortal");
+    if (code && imm && strcmp(imm, "1") == 0) immortalize_code(code);
+    return code;
+}
+
+// Inflate a zlib stream of exactly raw_size bytes, supplying dict when the
+// stream was deflated against a preset dictionary. Returns 0 on success.
+static int inflate_with_dict(const unsigned char *in, uint64_t in_size, unsigned char *out, uint64_t raw_size,
+                             const unsigned char *dict, uint64_t dict_size) {
+    z_stream z;
+    memset(&z, 0, sizeof(z));
+    if (inflateInit(&z) != Z_OK) return 1;
+    z.next_in = (Bytef *)in;
+    z.avail_in = (uInt)in_size;
+    z.next_out = out;
+    z.avail_out = (uInt)raw_size;
+    int r = inflate(&z, Z_FINISH);
+    if (r == Z_NEED_DICT && dict && inflateSetDictionary(&z, dict, (uInt)dict_size) == Z_OK) r = inflate(&z, Z_FINISH);
+    int ok = r == Z_STREAM_END && z.total_out == raw_size;
+    inflateEnd(&z);
+    return !ok;
+}
+
+// Code of an indexed payload entry. Raw entries are unmarshalled in place;
+// compressed ones are inflated into a scratch buffer first.
+static PyObject *load_entry_code(const struct payload_entry *e) {
+    const char *data = payload.data + e->offset;
+    if (e->codec == CODEC_RAW) return load_code(data, (size_t)e->stored_size);
+    if (e->codec != CODEC_ZLIB && e->codec != CODEC_ZLIB_DICT) {
+        return PyErr_Format(PyExc_ValueError, "payload entry '%s' uses unknown codec %u", e->name, e->codec);
+    }
+    const struct payload_entry *dict = e->codec == CODEC_ZLIB_DICT ? find_entry(ENTRY_DICT, NULL) : NULL;
+    unsigned char *raw = malloc(e->raw_size ? (size_t)e->raw_size : 1);
+    if (!raw) return PyErr_NoMemory();
+    PyObject *code = NULL;
+    if (inflate_with_dict((const unsigned char *)data, e->stored_size, raw, e->raw_size,
+                          dict ? (const unsigned char *)payload.data + dict->offset : NULL,
+                          dict ? dict->stored_size : 0) == 0) {
+        code = load_code((const char *)raw, (size_t)e->raw_size);
     } else {
-        Py_DECREF(res);
-        ret = 0; // success
+        PyErr_Format(PyExc_ValueError, "payload entry '%s' is corrupt", e->name);
     }
+    free(raw);
+    return code;
+}
 
-cleanup:
-    if (Py_IsInitialized()) Py_FinalizeEx();
-    return ret;
+// Raw size of frame i of a CODEC_ZLIB_FRAMES entry, and where its stored
+// bytes are. Returns 0 on success, 1 if the frame table is corrupt.
+static int frame_locate(const struct payload_entry *e, uint32_t i, const unsigned char **data, uint64_t *stored,
+                        uint64_t *raw, int *is_raw) {
+    const unsigned char *base = (const unsigned char *)payload.data + e->offset;
+    if (e->stored_size < FRAME_TABLE_HEADER) return 1;
+    uint32_t frame_size = get_u32_le(base), nframes = get_u32_le(base + 4);
+    if (i >= nframes || frame_size == 0 || e->stored_size < FRAME_TABLE_HEADER + 8 * ((uint64_t)nframes + 1)) return 1;
+    uint64_t start = get_u64_le(base + FRAME_TABLE_HEADER + 8 * (uint64_t)i);
+    uint64_t end = get_u64_le(base + FRAME_TABLE_HEADER + 8 * ((uint64_t)i + 1)) & ~FRAME_RAW_BIT;
+    *is_raw = (start & FRAME_RAW_BIT) != 0;
+    start &= ~FRAME_RAW_BIT;
+    if (start > end || end > e->stored_size || (uint64_t)i * frame_size >= e->raw_size) return 1;
+    *data = base + start;
+    *stored = end - start;
+    *raw = e->raw_size - (uint64_t)i * frame_size < frame_size ? e->raw_size - (uint64_t)i * frame_size : frame_size;
+    return *is_raw && *stored != *raw;
 }
 
-// Append the payload file (pyc) to a copy of stub_exe and create out_exe
-// The stub_exe is a path to the bootloader binary we want to copy from (often the running exe).
-// Returns 0 on success.
-static int append_payload_to_stub(const char *stub_exe, const char *payload_pyc, const char *out_exe) {
-    FILE *f_stub = NULL, *f_payload = NULL, *f_out = NULL;
-    int rc = 1;
+// Decode frame i into out (room for its raw size). No Python calls, so it
+// runs without the GIL and on the prefetch thread.
+static int frame_decode(const struct payload_entry *e, uint32_t i, unsigned char *out) {
+    const unsigned char *data;
+    uint64_t stored, raw;
+    int is_raw;
+    if (frame_locate(e, i, &data, &stored, &raw, &is_raw) != 0) return 1;
+    if (is_raw) { memcpy(out, data, (size_t)raw); return 0; }
+    uLongf n = (uLongf)raw;
+    return uncompress(out, &n, data, (uLong)stored) != Z_OK || n != raw;
+}
 
-    f_stub = fopen(stub_exe, "rb");
-    if (!f_stub) { fprintf(stderr, "Failed to open stub: %s\n", stub_exe); goto end; }
+// Main code of the payload: the ENTRY_MAIN entry of an indexed payload, or
+// the whole payload for older (single .pyc) binaries.
+static PyObject *load_main_code(void) {
+    if (!(payload.flags & FOOTER_FLAG_INDEXED)) return load_code(payload.data, (size_t)payload.size);
+    const struct payload_entry *e = find_entry(ENTRY_MAIN, payload.main_name);
+    if (!e) {
+        PyErr_SetString(PyExc_ValueError, "embedded payload has no main entry");
+        return NULL;
+    }
+    return load_entry_code(e);
+}
 
-    f_payload = fopen(payload_pyc, "rb");
-    if (!f_payload) { fprintf(stderr, "Failed to open payload: %s\n", payload_pyc); goto end; }
+// Environment helpers for runtime options (PYCC_*).
+static int env_flag(const char *name) {
+    const char *v = getenv(name);
+    return v && *v && strcmp(v, "0") != 0;
+}
 
-    f_out = fopen(out_exe, "wb");
-    if (!f_out) { fprintf(stderr, "Failed to create output exe: %s\n", out_exe); goto end; }
+static long env_long(const char *name, long def) {
+    const char *v = getenv(name);
+    if (!v || !*v) return def;
+    char *end;
+    long n = strtol(v, &end, 10);
+    return (*end == '\0') ? n : def;
+}
 
-    // copy stub
-    char buf[8192];
-    size_t n;
-    while ((n = fread(buf, 1, sizeof(buf), f_stub)) > 0) {
-        if (fwrite(buf, 1, n, f_out) != n) { fprintf(stderr, "Write error\n"); goto end; }
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static long current_tid(void) {
+    return (long)syscall(SYS_gettid);
+}
+
+// Runtime phases. The current phase is published in the shared metrics page
+// and the per-phase durations are printed at exit under PYCC_TRACE=1.
+enum {
+    PHASE_BOOT,
+    PHASE_LOAD,
+    PHASE_INIT,
+    PHASE_UNMARSHAL,
+    PHASE_EXEC,
+    PHASE_FINALIZE,
+    PHASE_COUNT
+};
+static const char *const PHASE_NAMES[PHASE_COUNT] = {
+    "boot", "load", "init", "unmarshal", "exec", "finalize"
+};
+
+// Process-wide runtime counters. Writers only use relaxed atomic adds/stores so
+// nothing on the Python side ever takes a lock to update them.
+#define PYCC_MAX_THREADS 64
+#define GIL_HIST_BUCKETS 24
+
+struct thread_slot {
+    long tid;
+    unsigned long ident;        // pthread_self(), same as threading.get_ident()
+    uint64_t gil_wait_ns;
+    uint64_t gil_waits;         // acquisitions that had to wait
+    uint64_t gil_hold_ns;
+    uint64_t gil_acquires;
+    uint64_t waiting_since;     // nonzero while blocked in take_gil()
+};
+
+static struct {
+    uint64_t start_ns;
+    uint64_t phase_enter_ns;
+    uint64_t phase_ns[PHASE_COUNT];
+    int phase;
+    uint64_t gc_collections[3];
+    uint64_t gc_collected;
+    uint64_t gc_uncollectable;
+    int gil_accounting;
+    unsigned nslots;
+    struct thread_slot slots[PYCC_MAX_THREADS];
+    uint64_t gil_wait_hist[GIL_HIST_BUCKETS];
+    uint64_t gil_hold_hist[GIL_HIST_BUCKETS];
+} metrics;
+
+static void set_phase(int phase) {
+    uint64_t t = now_ns();
+    int prev = __atomic_exchange_n(&metrics.phase, phase, __ATOMIC_RELAXED);
+    uint64_t entered = __atomic_exchange_n(&metrics.phase_enter_ns, t, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&metrics.phase_ns[prev], t - entered, __ATOMIC_RELAXED);
+}
+
+// Per-thread GIL state, only ever touched by the owning thread.
+struct gil_tls {
+    int claimed;
+    int internal;               // runtime helper threads are not accounted
+    int holding;
+    uint64_t hold_start;
+    uint64_t wait_start;
+    struct thread_slot *slot;
+};
+static __thread struct gil_tls gil_tls;
+
+// Claim (once per thread) a slot in the per-thread table. Returns NULL once
+// the table is full; those threads are simply not accounted.
+static struct thread_slot *this_thread_slot(void) {
+    if (!gil_tls.claimed) {
+        gil_tls.claimed = 1;
+        if (gil_tls.internal) return NULL;
+        unsigned i = __atomic_fetch_add(&metrics.nslots, 1, __ATOMIC_RELAXED);
+        if (i < PYCC_MAX_THREADS) {
+            struct thread_slot *slot = &metrics.slots[i];
+            slot->ident = (unsigned long)pthread_self();
+            __atomic_store_n(&slot->tid, current_tid(), __ATOMIC_RELEASE);
+            gil_tls.slot = slot;
+        }
     }
+    return gil_tls.slot;
+}
 
-    // copy payload
-    uint64_t payload_size = 0;
-    while ((n = fread(buf, 1, sizeof(buf), f_payload)) > 0) {
-        payload_size += n;
-        if (fwrite(buf, 1, n, f_out) != n) { fprintf(stderr, "Write error\n"); goto end; }
+// GIL accounting.
+// CPython's GIL is a mutex + condition variable pair: take_gil() blocks in
+// pthread_cond_timedwait(gil->cond) and, once it owns the GIL, signals
+// gil->switch_cond; drop_gil() signals gil->cond. Defining those pthread
+// symbols here interposes them for libpython. calibrate_gil() learns the two
+// condvar addresses from one release/reacquire of the main thread, after
+// which every wait, acquire and release of the GIL is timed per thread.
+static uintptr_t libpython_text_lo, libpython_text_hi;
+static pthread_cond_t *gil_cond, *gil_switch_cond;
+static int gil_calibrating;
+
+static int find_libpython_text(struct dl_phdr_info *info, size_t size, void *data) {
+    (void)size;
+    uintptr_t probe = (uintptr_t)data;
+    for (int i = 0; i < info->dlpi_phnum; ++i) {
+        const ElfW(Phdr) *ph = &info->dlpi_phdr[i];
+        if (ph->p_type != PT_LOAD || !(ph->p_flags & PF_X)) continue;
+        uintptr_t lo = info->dlpi_addr + ph->p_vaddr;
+        uintptr_t hi = lo + ph->p_memsz;
+        if (probe >= lo && probe < hi) {
+            libpython_text_lo = lo;
+            libpython_text_hi = hi;
+            return 1;
+        }
     }
+    return 0;
+}
+
+// The GIL hooks interpose libpthread in the pycc executable only; libpycc
+// must not take over the condvars of the process that loads it.
+#ifndef PYCC_LIBRARY
+// log2 buckets starting at 1us: bucket 0 is < 2us, bucket n is [2^n, 2^(n+1)) us.
+static unsigned gil_hist_bucket(uint64_t ns) {
+    uint64_t us = ns / 1000;
+    unsigned b = 0;
+    while (us > 1 && b < GIL_HIST_BUCKETS - 1) { us >>= 1; ++b; }
+    return b;
+}
 
-    // write footer: magic + payload_size (u64 LE)
-    if (fwrite(FOOTER_MAGIC, 1, FOOTER_MAGIC_LEN, f_out) != FOOTER_MAGIC_LEN) { fprintf(stderr,"Footer write failed\n"); goto end; }
-    write_u64_le(f_out, payload_size);
+static int called_from_libpython(uintptr_t caller) {
+    return caller >= libpython_text_lo && caller < libpython_text_hi;
+}
 
-    rc = 0; // success
+typedef int (*cond_timedwait_fn)(pthread_cond_t *, pthread_mutex_t *, const struct timespec *);
+typedef int (*cond_signal_fn)(pthread_cond_t *);
 
-end:
-    if (f_stub) fclose(f_stub);
-    if (f_payload) fclose(f_payload);
-    if (f_out) fclose(f_out);
-    
-    // Set executable permissions on output file
-    if (rc == 0) {
-        chmod(out_exe, 0755);
+int pthread_cond_timedwait(pthread_cond_t *__restrict cond, pthread_mutex_t *__restrict mutex,
+                           const struct timespec *__restrict abstime) {
+    static cond_timedwait_fn real;
+    cond_timedwait_fn fn = __atomic_load_n(&real, __ATOMIC_RELAXED);
+    if (!fn) {
+        fn = (cond_timedwait_fn)dlsym(RTLD_NEXT, "pthread_cond_timedwait");
+        __atomic_store_n(&real, fn, __ATOMIC_RELAXED);
     }
-    
-    return rc;
+
+    if (!__atomic_load_n(&metrics.gil_accounting, __ATOMIC_ACQUIRE) || cond != gil_cond ||
+        !called_from_libpython((uintptr_t)__builtin_return_address(0))) {
+        return fn(cond, mutex, abstime);
+    }
+
+    // take_gil() loops on 5ms timed waits; the wait lasts until the acquire
+    // signal, so only the first call of a loop starts the clock.
+    struct thread_slot *slot = this_thread_slot();
+    if (!gil_tls.wait_start) {
+        gil_tls.wait_start = now_ns();
+        if (slot) __atomic_store_n(&slot->waiting_since, gil_tls.wait_start, __ATOMIC_RELAXED);
+    }
+    return fn(cond, mutex, abstime);
 }
 
-// Extract appended payload from self and run it with embedded Python
-static int run_appended_payload() {
-    char selfpath[4096];
-    unsigned char buf[4096];
+int pthread_cond_signal(pthread_cond_t *cond) {
+    static cond_signal_fn real;
+    cond_signal_fn fn = __atomic_load_n(&real, __ATOMIC_RELAXED);
+    if (!fn) {
+        fn = (cond_signal_fn)dlsym(RTLD_NEXT, "pthread_cond_signal");
+        __atomic_store_n(&real, fn, __ATOMIC_RELAXED);
+    }
 
-    if (!get_self_path(selfpath, sizeof(selfpath))) {
-        fprintf(stderr, "Failed to get self path\n");
-        return 1;
+    int calibrating = __atomic_load_n(&gil_calibrating, __ATOMIC_RELAXED);
+    if ((!calibrating && !__atomic_load_n(&metrics.gil_accounting, __ATOMIC_ACQUIRE)) ||
+        !called_from_libpython((uintptr_t)__builtin_return_address(0))) {
+        return fn(cond);
     }
 
-    FILE *f = fopen(selfpath, "rb");
-    if (!f) {
-        fprintf(stderr, "Failed to open self binary\n");
+    if (calibrating) {
+        // first libpython signal is drop_gil(), the next one take_gil()
+        if (!gil_cond) gil_cond = cond;
+        else if (!gil_switch_cond && cond != gil_cond) gil_switch_cond = cond;
+        return fn(cond);
+    }
+
+    uint64_t t = now_ns();
+    struct thread_slot *slot = this_thread_slot();
+    if (cond == gil_cond) {
+        // drop_gil(): this thread is releasing the GIL
+        if (gil_tls.holding) {
+            uint64_t held = t - gil_tls.hold_start;
+            gil_tls.holding = 0;
+            __atomic_fetch_add(&metrics.gil_hold_hist[gil_hist_bucket(held)], 1, __ATOMIC_RELAXED);
+            if (slot) __atomic_fetch_add(&slot->gil_hold_ns, held, __ATOMIC_RELAXED);
+        }
+    } else if (cond == gil_switch_cond) {
+        // take_gil(): this thread now owns the GIL
+        if (gil_tls.wait_start) {
+            uint64_t waited = t - gil_tls.wait_start;
+            gil_tls.wait_start = 0;
+            __atomic_fetch_add(&metrics.gil_wait_hist[gil_hist_bucket(waited)], 1, __ATOMIC_RELAXED);
+            if (slot) {
+                __atomic_store_n(&slot->waiting_since, 0, __ATOMIC_RELAXED);
+                __atomic_fetch_add(&slot->gil_wait_ns, waited, __ATOMIC_RELAXED);
+                __atomic_fetch_add(&slot->gil_waits, 1, __ATOMIC_RELAXED);
+            }
+        }
+        gil_tls.holding = 1;
+        gil_tls.hold_start = t;
+        if (slot) __atomic_fetch_add(&slot->gil_acquires, 1, __ATOMIC_RELAXED);
+    }
+    return fn(cond);
+}
+#endif // PYCC_LIBRARY
+
+// Learn the GIL condvars and switch accounting on. Must be called from the
+// main thread, holding the GIL, before the payload starts other threads.
+// Returns 0 on success; free-threaded builds (no GIL) report failure.
+static int enable_gil_accounting(void) {
+    if (metrics.gil_accounting) return 0;
+    if (!libpython_text_hi) dl_iterate_phdr(find_libpython_text, (void *)&Py_Initialize);
+    if (!libpython_text_hi) return 1;
+
+    __atomic_store_n(&gil_calibrating, 1, __ATOMIC_RELAXED);
+    Py_BEGIN_ALLOW_THREADS
+    Py_END_ALLOW_THREADS
+    __atomic_store_n(&gil_calibrating, 0, __ATOMIC_RELAXED);
+    if (!gil_cond || !gil_switch_cond) {
+        gil_cond = gil_switch_cond = NULL;
         return 2;
     }
 
-    // find footer at end
-    if (fseek(f, 0, SEEK_END) != 0) { fclose(f); return 3; }
-    long endpos = ftell(f);
-    if (endpos < (long)FOOTER_LEN) { fclose(f); return 4; }
+    gil_tls.holding = 1;
+    gil_tls.hold_start = now_ns();
+    this_thread_slot();
+    __atomic_store_n(&metrics.gil_accounting, 1, __ATOMIC_RELEASE);
+    return 0;
+}
 
-    // Seek to footer start position
-    if (fseek(f, endpos - FOOTER_LEN, SEEK_SET) != 0) { fclose(f); return 5; }
+// Resident set size in bytes, from /proc/self/statm.
+static uint64_t read_rss_bytes(void) {
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (!f) return 0;
+    unsigned long size = 0, resident = 0;
+    if (fscanf(f, "%lu %lu", &size, &resident) != 2) resident = 0;
+    fclose(f);
+    return (uint64_t)resident * (uint64_t)sysconf(_SC_PAGESIZE);
+}
 
-    char magic[6] = {0};
-    if (fread(magic, 1, FOOTER_MAGIC_LEN, f) != FOOTER_MAGIC_LEN) { fclose(f); return 6; }
+// Thread count, field 20 of /proc/self/stat.
+static unsigned read_thread_count(void) {
+    char buf[1024];
+    FILE *f = fopen("/proc/self/stat", "r");
+    if (!f) return 0;
+    size_t n = fread(buf, 1, sizeof(buf) - 1, f);
+    fclose(f);
+    buf[n] = '\0';
+    // comm may contain spaces; fields restart after the last ')'
+    char *p = strrchr(buf, ')');
+    if (!p) return 0;
+    unsigned threads = 0;
+    if (sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %*u %*u %*d %*d %*d %*d %u",
+               &threads) != 1) return 0;
+    return threads;
+}
 
-    if (memcmp(magic, FOOTER_MAGIC, FOOTER_MAGIC_LEN) != 0) {
-        // no payload
-        fclose(f);
-        fprintf(stderr, "No embedded payload found in binary\n");
-        return 7;
+// Strong-reference dict lookup by C string. Borrowed references from a dict
+// are not safe without the GIL (free-threaded builds), so use the *Ref API
+// where it exists. Returns NULL without an exception if the key is missing.
+static PyObject *dict_get_ref(PyObject *d, const char *key) {
+#if PY_VERSION_HEX >= 0x030D0000
+    PyObject *v = NULL;
+    if (PyDict_GetItemStringRef(d, key, &v) < 0) PyErr_Clear();
+    return v;
+#else
+    PyObject *v = PyDict_GetItemString(d, key);
+    Py_XINCREF(v);
+    return v;
+#endif
+}
+
+// Byte-message channels shared by every interpreter in the process.
+// Messages are copied in and out, so no Python object ever crosses an
+// interpreter boundary. Blocking receives release the GIL.
+struct channel_msg {
+    struct channel_msg *next;
+    size_t len;
+    char data[];
+};
+
+struct channel {
+    pthread_mutex_t mu;
+    pthread_cond_t cv;
+    struct channel_msg *head, *tail;
+    int closed;
+    size_t depth;
+    size_t capacity;      // 0: unbounded; otherwise put() waits for room
+};
+
+static struct channel work_channel = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, NULL, NULL, 0, 0, 0 };
+static struct channel result_channel = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, NULL, NULL, 0, 0, 0 };
+
+// Queue a malloc'd message; the channel takes ownership. Returns 1 (and frees
+// the message) if the channel is closed.
+static int channel_push(struct channel *ch, struct channel_msg *msg) {
+    msg->next = NULL;
+    pthread_mutex_lock(&ch->mu);
+    while (ch->capacity && ch->depth >= ch->capacity && !ch->closed) pthread_cond_wait(&ch->cv, &ch->mu);
+    if (ch->closed) {
+        pthread_mutex_unlock(&ch->mu);
+        free(msg);
+        return 1;
     }
+    if (ch->tail) ch->tail->next = msg;
+    else ch->head = msg;
+    ch->tail = msg;
+    ch->depth++;
+    // bounded channels have waiters on both sides of the one condvar
+    if (ch->capacity) pthread_cond_broadcast(&ch->cv);
+    else pthread_cond_signal(&ch->cv);
+    pthread_mutex_unlock(&ch->mu);
+    return 0;
+}
 
-    uint64_t payload_size = read_u64_le(f);
-    if (payload_size == 0) {
-        fclose(f);
-        fprintf(stderr, "Embedded payload size is zero\n");
-        return 8;
+static int channel_put(struct channel *ch, const void *data, size_t len) {
+    struct channel_msg *msg = malloc(sizeof(*msg) + len);
+    if (!msg) return -1;
+    msg->len = len;
+    memcpy(msg->data, data, len);
+    return channel_push(ch, msg);
+}
+
+static int channel_empty(struct channel *ch) {
+    pthread_mutex_lock(&ch->mu);
+    int empty = ch->head == NULL;
+    pthread_mutex_unlock(&ch->mu);
+    return empty;
+}
+
+// Returns the next message (caller frees), NULL with *closed set once the
+// channel is closed and drained, or NULL on timeout (timeout_ms >= 0).
+static struct channel_msg *channel_get(struct channel *ch, long timeout_ms, int *closed) {
+    struct timespec deadline;
+    if (timeout_ms >= 0) {
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += timeout_ms / 1000;
+        deadline.tv_nsec += (timeout_ms % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) { deadline.tv_sec++; deadline.tv_nsec -= 1000000000L; }
     }
+    *closed = 0;
+    pthread_mutex_lock(&ch->mu);
+    while (!ch->head && !ch->closed) {
+        if (timeout_ms < 0) pthread_cond_wait(&ch->cv, &ch->mu);
+        else if (pthread_cond_timedwait(&ch->cv, &ch->mu, &deadline) == ETIMEDOUT) break;
+    }
+    struct channel_msg *msg = ch->head;
+    if (msg) {
+        ch->head = msg->next;
+        if (!ch->head) ch->tail = NULL;
+        ch->depth--;
+        if (ch->capacity) pthread_cond_broadcast(&ch->cv);
+    } else {
+        *closed = ch->closed;
+    }
+    pthread_mutex_unlock(&ch->mu);
+    return msg;
+}
 
-    // Compute payload start
-    long payload_start = endpos - (long)FOOTER_LEN - (long)payload_size;
-    if (payload_start < 0) { fclose(f); fprintf(stderr, "Invalid payload start\n"); return 9; }
+static void channel_close(struct channel *ch) {
+    pthread_mutex_lock(&ch->mu);
+    ch->closed = 1;
+    pthread_cond_broadcast(&ch->cv);
+    pthread_mutex_unlock(&ch->mu);
+}
 
-    // Read payload into memory or write temp file
-    if (fseek(f, payload_start, SEEK_SET) != 0) { fclose(f); return 10; }
+// Subinterpreter workers (PYCC_SUBINTERPRETERS=n). Counters are process-wide;
+// the worker index lives in a thread-local since each worker has its thread.
+static struct {
+    int count;
+    int live;
+    pthread_t *threads;
+    const char *entry;
+} workers;
+static __thread int worker_index = -1;
 
-    // create temp filename
-    char tmpname[PATH_MAX];
-    const char *td = getenv("TMPDIR");
-    if (!td) td = "/tmp";
-    snprintf(tmpname, sizeof(tmpname), "%s/embedded_payload_%ld.pyc", td, (long)getpid());
+static PyObject *pycc_channel_put(struct channel *ch, PyObject *args) {
+    Py_buffer buf;
+    if (!PyArg_ParseTuple(args, "y*", &buf)) return NULL;
+    int r = channel_put(ch, buf.buf, (size_t)buf.len);
+    PyBuffer_Release(&buf);
+    if (r < 0) return PyErr_NoMemory();
+    if (r > 0) { PyErr_SetString(PyExc_ValueError, "channel is closed"); return NULL; }
+    Py_RETURN_NONE;
+}
 
-    FILE *fp = fopen(tmpname, "wb");
-    if (!fp) { fclose(f); fprintf(stderr, "Failed to create temp pyc\n"); return 11; }
+static PyObject *pycc_channel_get(struct channel *ch, PyObject *args, PyObject *kwargs) {
+    static char *kwlist[] = { "timeout", NULL };
+    PyObject *timeout_obj = Py_None;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|O", kwlist, &timeout_obj)) return NULL;
+    long timeout_ms = -1;
+    if (timeout_obj != Py_None) {
+        double t = PyFloat_AsDouble(timeout_obj);
+        if (t == -1.0 && PyErr_Occurred()) return NULL;
+        timeout_ms = t < 0 ? 0 : (long)(t * 1000);
+    }
+    struct channel_msg *msg;
+    int closed;
+    Py_BEGIN_ALLOW_THREADS
+    msg = channel_get(ch, timeout_ms, &closed);
+    Py_END_ALLOW_THREADS
+    if (!msg) {
+        if (closed) Py_RETURN_NONE;
+        PyErr_SetString(PyExc_TimeoutError, "no message before timeout");
+        return NULL;
+    }
+    PyObject *res = PyBytes_FromStringAndSize(msg->data, (Py_ssize_t)msg->len);
+    free(msg);
+    return res;
+}
 
-    uint64_t remaining = payload_size;
-    while (remaining > 0) {
-        size_t toread = (remaining > sizeof(buf)) ? sizeof(buf) : (size_t)remaining;
-        size_t got = fread(buf, 1, toread, f);
-        if (got == 0) break;
-        fwrite(buf, 1, got, fp);
-        remaining -= got;
+static PyObject *pycc_put_work(PyObject *self, PyObject *args) { (void)self; return pycc_channel_put(&work_channel, args); }
+static PyObject *pycc_get_work(PyObject *self, PyObject *args, PyObject *kwargs) { (void)self; return pycc_channel_get(&work_channel, args, kwargs); }
+static PyObject *pycc_put_result(PyObject *self, PyObject *args) { (void)self; return pycc_channel_put(&result_channel, args); }
+static PyObject *pycc_get_result(PyObject *self, PyObject *args, PyObject *kwargs) { (void)self; return pycc_channel_get(&result_channel, args, kwargs); }
+
+static PyObject *pycc_close_work(PyObject *self, PyObject *args) {
+    (void)self; (void)args;
+    channel_close(&work_channel);
+    Py_RETURN_NONE;
+}
+
+static PyObject *pycc_worker_id(PyObject *self, PyObject *args) {
+    (void)self; (void)args;
+    return PyLong_FromLong(worker_index);
+}
+
+static PyObject *pycc_worker_count(PyObject *self, PyObject *args) {
+    (void)self; (void)args;
+    return PyLong_FromLong(workers.count);
+}
+
+// Built-in "pycc" module: runtime hooks the payload environment calls into.
+static PyObject *pycc_gc_callback(PyObject *self, PyObject *args) {
+    (void)self;
+    const char *phase;
+    PyObject *info;
+    if (!PyArg_ParseTuple(args, "sO", &phase, &info)) return NULL;
+    if (strcmp(phase, "stop") == 0 && PyDict_Check(info)) {
+        PyObject *gen = dict_get_ref(info, "generation");
+        PyObject *collected = dict_get_ref(info, "collected");
+        PyObject *uncollectable = dict_get_ref(info, "uncollectable");
+        long g = gen ? PyLong_AsLong(gen) : -1;
+        if (g >= 0 && g < 3) __atomic_fetch_add(&metrics.gc_collections[g], 1, __ATOMIC_RELAXED);
+        if (collected) __atomic_fetch_add(&metrics.gc_collected, (uint64_t)PyLong_AsLong(collected), __ATOMIC_RELAXED);
+        if (uncollectable) __atomic_fetch_add(&metrics.gc_uncollectable, (uint64_t)PyLong_AsLong(uncollectable), __ATOMIC_RELAXED);
+        Py_XDECREF(gen);
+        Py_XDECREF(collected);
+        Py_XDECREF(uncollectable);
+        if (PyErr_Occurred()) return NULL;
     }
-    fclose(fp);
-    fclose(f);
+    Py_RETURN_NONE;
+}
 
-    // Now run the pyc using embedded Python
-    Py_Initialize();
+static PyObject *pycc_set_phase(PyObject *self, PyObject *args) {
+    (void)self;
+    int phase;
+    if (!PyArg_ParseTuple(args, "i", &phase)) return NULL;
+    if (phase >= 0 && phase < PHASE_COUNT) set_phase(phase);
+    Py_RETURN_NONE;
+}
 
-    // Create Python code to load and execute the pyc file
-    char py_code_str[2048];
-    snprintf(py_code_str, sizeof(py_code_str),
-        "import marshal\n"
-        "with open('%s', 'rb') as f:\n"
-        "    data = f.read()\n"
-        "# Python 3.7+ has 16-byte header for hash-based pyc\n"
-        "# Try to extract code object from pyc\n"
-        "try:\n"
-        "    # Skip header (typically 16 bytes in Python 3.7+)\n"
-        "    code_obj = marshal.loads(data[16:])\n"
-        "    exec(code_obj)\n"
-        "except Exception as e:\n"
-        "    # If that fails, try other header sizes\n"
-        "    try:\n"
-        "        code_obj = marshal.loads(data[12:])\n"
-        "        exec(code_obj)\n"
-        "    except:\n"
-        "        code_obj = marshal.loads(data[8:])\n"
-        "        exec(code_obj)\n",
-        tmpname);
+// Import finder support (see install_import_finder). Counters are
+// process-wide since every interpreter installs its own finder.
+static struct {
+    uint64_t lookups;
+    uint64_t misses;
+    uint64_t dirs;
+    uint64_t syscalls;
+} finder_stats;
 
-    int result = PyRun_SimpleString(py_code_str);
-    
-    if (result != 0) {
-        fprintf(stderr, "Failed to execute embedded Python code\n");
-        Py_FinalizeEx();
-        remove(tmpname);
-        return 13;
+// _listdir(path): {name: is_dir} for a directory, False for something that
+// exists but is not one (a zip file), None if it is missing. Reads the
+// directory with getdents64 so the finder's syscalls can be counted exactly.
+static PyObject *pycc_listdir(PyObject *self, PyObject *args) {
+    (void)self;
+    const char *path;
+    if (!PyArg_ParseTuple(args, "s", &path)) return NULL;
+    uint64_t calls = 1;
+    int fd;
+    Py_BEGIN_ALLOW_THREADS
+    fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    Py_END_ALLOW_THREADS
+    if (fd < 0) {
+        int err = errno;
+        __atomic_fetch_add(&finder_stats.syscalls, calls, __ATOMIC_RELAXED);
+        if (err == ENOTDIR) Py_RETURN_FALSE;
+        Py_RETURN_NONE;
+    }
+    PyObject *names = PyDict_New();
+    char buf[32768];
+    for (;;) {
+        long n = syscall(SYS_getdents64, fd, buf, sizeof(buf));
+        ++calls;
+        if (n <= 0 || !names) break;
+        for (long off = 0; off < n;) {
+            struct dirent64 *d = (struct dirent64 *)(buf + off);
+            off += d->d_reclen;
+            if (strcmp(d->d_name, ".") == 0 || strcmp(d->d_name, "..") == 0) continue;
+            int is_dir = d->d_type == DT_DIR;
+            if (d->d_type == DT_UNKNOWN || d->d_type == DT_LNK) {
+                struct stat st;
+                ++calls;
+                is_dir = fstatat(fd, d->d_name, &st, 0) == 0 && S_ISDIR(st.st_mode);
+            }
+            if (PyDict_SetItemString(names, d->d_name, is_dir ? Py_True : Py_False) != 0) { Py_CLEAR(names); break; }
+        }
     }
+    close(fd);
+    ++calls;
+    __atomic_fetch_add(&finder_stats.syscalls, calls, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&finder_stats.dirs, 1, __ATOMIC_RELAXED);
+    return names;
+}
 
-    // finalize
-    Py_FinalizeEx();
+static PyObject *pycc_finder_note(PyObject *self, PyObject *args) {
+    (void)self;
+    int found;
+    if (!PyArg_ParseTuple(args, "p", &found)) return NULL;
+    __atomic_fetch_add(&finder_stats.lookups, 1, __ATOMIC_RELAXED);
+    if (!found) __atomic_fetch_add(&finder_stats.misses, 1, __ATOMIC_RELAXED);
+    Py_RETURN_NONE;
+}
 
-    // Remove temp pyc
-    remove(tmpname);
+static const struct payload_entry *payload_module(const char *name) {
+    return payload.data ? find_entry(ENTRY_MODULE, name) : NULL;
+}
 
-    return 0;
+// _payload_kind(name): "module", "package" or None.
+static PyObject *pycc_payload_kind(PyObject *self, PyObject *args) {
+    (void)self;
+    const char *name;
+    if (!PyArg_ParseTuple(args, "s", &name)) return NULL;
+    const struct payload_entry *e = payload_module(name);
+    if (!e) Py_RETURN_NONE;
+    return PyUnicode_FromString((e->flags & ENTRY_FLAG_PACKAGE) ? "package" : "module");
 }
 
-// Builder mode: create pyc and append to stub to produce output exe
-static int builder_mode(const char *script_path, const char *out_exe_path) {
-    char selfpath[4096];
-    if (!get_self_path(selfpath, sizeof(selfpath))) {
-        fprintf(stderr, "Cannot get self path for stub copy\n");
-        return 1;
+static PyObject *pycc_payload_code(PyObject *self, PyObject *args) {
+    (void)self;
+    const char *name;
+    if (!PyArg_ParseTuple(args, "s", &name)) return NULL;
+    const struct payload_entry *e = payload_module(name);
+    if (!e) return PyErr_Format(PyExc_ImportError, "no payload module '%s'", name);
+    return load_entry_code(e);
+}
+
+// Decoded frames of compressed resources, shared by every interpreter and
+// the prefetch thread; the least recently used frame is evicted first.
+// PYCC_RESOURCE_CACHE sets the number of frames kept (default 8).
+#define FRAME_CACHE_MAX 64
+struct frame_slot {
+    const struct payload_entry *e;
+    uint32_t index;
+    int state;                  // FRAME_EMPTY, FRAME_LOADING or FRAME_READY
+    unsigned char *data;
+    size_t len;
+    uint64_t used;
+};
+
+enum { FRAME_EMPTY, FRAME_LOADING, FRAME_READY };
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;        // a frame finished loading, or work queued
+    unsigned nslots;
+    struct frame_slot slot[FRAME_CACHE_MAX];
+    uint64_t clock;
+    struct { const struct payload_entry *e; uint32_t index; } queue[16];
+    unsigned qhead, qlen;
+    int prefetcher;             // the prefetch thread is running
+    int busy;                   // ... and decoding
+    int stopping;
+} frame_cache = { .lock = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER };
+
+// Slot holding (e, i), or NULL. Called with the lock held.
+static struct frame_slot *frame_cache_find(const struct payload_entry *e, uint32_t i) {
+    for (unsigned s = 0; s < frame_cache.nslots; ++s) {
+        struct frame_slot *f = &frame_cache.slot[s];
+        if (f->state != FRAME_EMPTY && f->e == e && f->index == i) return f;
     }
+    return NULL;
+}
 
-    // temp pyc path
-    char temp_pyc[4096];
-    const char *td = getenv("TMPDIR");
-    if (!td) td = "/tmp";
-    snprintf(temp_pyc, sizeof(temp_pyc), "%s/temp_build_payload_%ld.pyc", td, (long)getpid());
+// Claim a slot for (e, i): an empty one or the least recently used ready
+// one. NULL when every slot is loading. Called with the lock held.
+static struct frame_slot *frame_cache_claim(const struct payload_entry *e, uint32_t i) {
+    if (!frame_cache.nslots) {
+        long n = env_long("PYCC_RESOURCE_CACHE", 8);
+        frame_cache.nslots = n < 1 ? 1 : n > FRAME_CACHE_MAX ? FRAME_CACHE_MAX : (unsigned)n;
+    }
+    struct frame_slot *victim = NULL;
+    for (unsigned s = 0; s < frame_cache.nslots; ++s) {
+        struct frame_slot *f = &frame_cache.slot[s];
+        if (f->state == FRAME_LOADING) continue;
+        if (!victim || f->state == FRAME_EMPTY || (victim->state == FRAME_READY && f->used < victim->used)) victim = f;
+        if (f->state == FRAME_EMPTY) break;
+    }
+    if (!victim) return NULL;
+    free(victim->data);
+    victim->data = NULL;
+    victim->e = e;
+    victim->index = i;
+    victim->state = FRAME_LOADING;
+    return victim;
+}
 
-    printf("[*] Compiling %s -> %s\n", script_path, temp_pyc);
-    int r = build_pyc_with_python(script_path, temp_pyc);
-    if (r != 0) {
-        fprintf(stderr, "[!] py_compile failed (code %d)\n", r);
-        return r;
+// Decode into a claimed slot, dropping the lock meanwhile.
+static int frame_cache_fill(struct frame_slot *f, size_t len) {
+    const struct payload_entry *e = f->e;
+    uint32_t i = f->index;
+    pthread_mutex_unlock(&frame_cache.lock);
+    unsigned char *data = malloc(len ? len : 1);
+    int r = !data || frame_decode(e, i, data) != 0;
+    pthread_mutex_lock(&frame_cache.lock);
+    if (r) { free(data); f->state = FRAME_EMPTY; }
+    else { f->data = data; f->len = len; f->state = FRAME_READY; f->used = ++frame_cache.clock; }
+    pthread_cond_broadcast(&frame_cache.cond);
+    return r;
+}
+
+// Copy frame i of e (raw size len) into out, from the cache or by decoding
+// it into the cache. Called without the GIL.
+static int frame_cache_read(const struct payload_entry *e, uint32_t i, unsigned char *out, size_t len) {
+    pthread_mutex_lock(&frame_cache.lock);
+    int r = 0;
+    for (;;) {
+        struct frame_slot *f = frame_cache_find(e, i);
+        if (f && f->state == FRAME_LOADING) { pthread_cond_wait(&frame_cache.cond, &frame_cache.lock); continue; }
+        if (!f && (f = frame_cache_claim(e, i)) != NULL && frame_cache_fill(f, len) != 0) { r = 1; break; }
+        if (!f) {
+            // every slot is being prefetched: decode without caching
+            pthread_mutex_unlock(&frame_cache.lock);
+            return frame_decode(e, i, out);
+        }
+        if (f->state != FRAME_READY) continue;
+        f->used = ++frame_cache.clock;
+        memcpy(out, f->data, len);
+        break;
     }
+    pthread_mutex_unlock(&frame_cache.lock);
+    return r;
+}
 
-    printf("[*] Appending payload to stub and creating %s\n", out_exe_path);
-    r = append_payload_to_stub(selfpath, temp_pyc, out_exe_path);
-    if (r != 0) {
-        fprintf(stderr, "[!] Failed to append payload\n");
-        remove(temp_pyc);
-        return r;
+static void *frame_prefetch_main(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&frame_cache.lock);
+    while (!frame_cache.stopping) {
+        if (frame_cache.qlen == 0) { pthread_cond_wait(&frame_cache.cond, &frame_cache.lock); continue; }
+        const struct payload_entry *e = frame_cache.queue[frame_cache.qhead].e;
+        uint32_t i = frame_cache.queue[frame_cache.qhead].index;
+        frame_cache.qhead = (frame_cache.qhead + 1) % 16;
+        frame_cache.qlen--;
+        const unsigned char *data;
+        uint64_t stored, raw;
+        int is_raw;
+        struct frame_slot *f;
+        if (frame_cache_find(e, i) || frame_locate(e, i, &data, &stored, &raw, &is_raw) != 0 ||
+            !(f = frame_cache_claim(e, i))) {
+            continue;
+        }
+        frame_cache.busy = 1;
+        frame_cache_fill(f, (size_t)raw);
+        frame_cache.busy = 0;
+        pthread_cond_broadcast(&frame_cache.cond);
     }
+    frame_cache.prefetcher = 0;
+    pthread_cond_broadcast(&frame_cache.cond);
+    pthread_mutex_unlock(&frame_cache.lock);
+    return NULL;
+}
 
-    remove(temp_pyc);
-    printf("[+] Built %s successfully\n", out_exe_path);
-    return 0;
+// A fork child has no prefetch thread and must not inherit a held lock.
+static void frame_cache_prepare(void) { pthread_mutex_lock(&frame_cache.lock); }
+static void frame_cache_parent(void) { pthread_mutex_unlock(&frame_cache.lock); }
+static void frame_cache_child(void) {
+    pthread_mutex_init(&frame_cache.lock, NULL);
+    pthread_cond_init(&frame_cache.cond, NULL);
+    for (unsigned s = 0; s < frame_cache.nslots; ++s) {
+        if (frame_cache.slot[s].state == FRAME_LOADING) frame_cache.slot[s].state = FRAME_EMPTY;
+    }
+    frame_cache.qlen = 0;
+    frame_cache.prefetcher = frame_cache.busy = 0;
 }
 
-int main(int argc, char **argv) {
-    if (argc >= 2 && strcmp(argv[1], "--build") == 0) {
-        if (argc < 4) {
-            fprintf(stderr, "Usage: %s --build <script.py> <out_binary>\n", argv[0]);
-            return 1;
+// Queue frames first..first+count-1 of e for the prefetch thread.
+static void frame_prefetch(const struct payload_entry *e, uint32_t first, unsigned count) {
+    pthread_mutex_lock(&frame_cache.lock);
+    if (!frame_cache.prefetcher && !frame_cache.stopping) {
+        static int atfork;
+        pthread_t t;
+        if (!atfork) atfork = pthread_atfork(frame_cache_prepare, frame_cache_parent, frame_cache_child) == 0;
+        if (pthread_create(&t, NULL, frame_prefetch_main, NULL) == 0) {
+            pthread_detach(t);
+            frame_cache.prefetcher = 1;
         }
-        const char *script = argv[2];
-        const char *outexe = argv[3];
-        return builder_mode(script, outexe);
+    }
+    for (unsigned k = 0; k < count && frame_cache.prefetcher && frame_cache.qlen < 16; ++k) {
+        if (frame_cache_find(e, first + k)) continue;
+        unsigned tail = (frame_cache.qhead + frame_cache.qlen) % 16;
+        frame_cache.queue[tail].e = e;
+        frame_cache.queue[tail].index = first + k;
+        frame_cache.qlen++;
+    }
+    pthread_cond_broadcast(&frame_cache.cond);
+    pthread_mutex_unlock(&frame_cache.lock);
+}
+
+// Stop the prefetch thread before the payload is unmapped under it.
+static void frame_cache_stop(void) {
+    pthread_mutex_lock(&frame_cache.lock);
+    frame_cache.stopping = 1;
+    frame_cache.qlen = 0;
+    pthread_cond_broadcast(&frame_cache.cond);
+    while (frame_cache.prefetcher) pthread_cond_wait(&frame_cache.cond, &frame_cache.lock);
+    pthread_mutex_unlock(&frame_cache.lock);
+}
+
+static const struct payload_entry *resource_entry(const char *name) {
+    if (!payload.data) {
+        PyErr_SetString(PyExc_RuntimeError, "resources need the mapped load path (PYCC_LOAD=tempfile is set)");
+        return NULL;
+    }
+    const struct payload_entry *e = find_entry(ENTRY_RESOURCE, name);
+    if (!e) PyErr_Format(PyExc_KeyError, "no resource '%s'", name);
+    else if (e->codec != CODEC_RAW && e->codec != CODEC_ZLIB_FRAMES) {
+        PyErr_Format(PyExc_ValueError, "resource '%s' uses unknown codec %u", name, e->codec);
+        e = NULL;
+    }
+    return e;
+}
+
+// resource(name): read-only memoryview straight over the mapped binary, so
+// the bytes are shared page cache across every process running it. The map
+// stays until the interpreter is finalized. A compressed resource is
+// inflated into a private copy instead; open_resource() reads it in frames.
+static PyObject *pycc_resource(PyObject *self, PyObject *args) {
+    (void)self;
+    const char *name;
+    if (!PyArg_ParseTuple(args, "s", &name)) return NULL;
+    const struct payload_entry *e = resource_entry(name);
+    if (!e) return NULL;
+    if (e->codec == CODEC_RAW) {
+        return PyMemoryView_FromMemory((char *)payload.data + e->offset, (Py_ssize_t)e->stored_size, PyBUF_READ);
+    }
+    PyObject *raw = PyBytes_FromStringAndSize(NULL, (Py_ssize_t)e->raw_size);
+    if (!raw) return NULL;
+    int r = 0;
+    uint32_t frame_size = get_u32_le((const unsigned char *)payload.data + e->offset);
+    Py_BEGIN_ALLOW_THREADS
+    for (uint64_t pos = 0, i = 0; r == 0 && pos < e->raw_size; pos += frame_size, ++i) {
+        r = frame_decode(e, (uint32_t)i, (unsigned char *)PyBytes_AS_STRING(raw) + pos);
+    }
+    Py_END_ALLOW_THREADS
+    if (r != 0) {
+        Py_DECREF(raw);
+        return PyErr_Format(PyExc_ValueError, "resource '%s' is corrupt", name);
+    }
+    PyObject *view = PyMemoryView_FromObject(raw);
+    Py_DECREF(raw);
+    return view;
+}
+
+// _resource_info(name): (size, frame_size), frame_size 0 for a raw resource.
+static PyObject *pycc_resource_info(PyObject *self, PyObject *args) {
+    (void)self;
+    const char *name;
+    if (!PyArg_ParseTuple(args, "s", &name)) return NULL;
+    const struct payload_entry *e = resource_entry(name);
+    if (!e) return NULL;
+    unsigned long frame_size = e->codec == CODEC_RAW ? 0 : get_u32_le((const unsigned char *)payload.data + e->offset);
+    return Py_BuildValue("Kk", (unsigned long long)e->raw_size, frame_size);
+}
+
+// _resource_frame(name, i, ahead): frame i of a compressed resource as
+// bytes, then queue the next `ahead` frames for the prefetch thread.
+static PyObject *pycc_resource_frame(PyObject *self, PyObject *args) {
+    (void)self;
+    const char *name;
+    unsigned int i, ahead;
+    if (!PyArg_ParseTuple(args, "sII", &name, &i, &ahead)) return NULL;
+    const struct payload_entry *e = resource_entry(name);
+    if (!e) return NULL;
+    const unsigned char *data;
+    uint64_t stored, raw;
+    int is_raw;
+    if (e->codec != CODEC_ZLIB_FRAMES || frame_locate(e, i, &data, &stored, &raw, &is_raw) != 0) {
+        return PyErr_Format(PyExc_ValueError, "resource '%s' has no frame %u", name, i);
+    }
+    PyObject *out = PyBytes_FromStringAndSize(NULL, (Py_ssize_t)raw);
+    if (!out) return NULL;
+    int r;
+    Py_BEGIN_ALLOW_THREADS
+    r = frame_cache_read(e, i, (unsigned char *)PyBytes_AS_STRING(out), (size_t)raw);
+    if (r == 0 && ahead) frame_prefetch(e, i + 1, ahead);
+    Py_END_ALLOW_THREADS
+    if (r != 0) {
+        Py_DECREF(out);
+        return PyErr_Format(PyExc_ValueError, "resource '%s' is corrupt", name);
+    }
+    return out;
+}
+
+// open_resource() returns this io.RawIOBase, so read(), readline(),
+// iteration and io.BufferedReader all work on top of readinto(). Raw
+// resources are copied out of the mapping; compressed ones decode only the
+// frames a read touches, and sequential reads with prefetch=True have the
+// next frames decoded in the background.
+static const char RESOURCE_READER_SRC[] =
+    "import io, pycc\n"
+    "class ResourceReader(io.RawIOBase):\n"
+    "    __module__ = 'pycc'\n"
+    "    def __init__(self, name, prefetch=False):\n"
+    "        self.name = name\n"
+    "        self.size, self._frame_size = pycc._resource_info(name)\n"
+    "        self._view = pycc.resource(name) if not self._frame_size else None\n"
+    "        self._ahead = 2 if prefetch else 0\n"
+    "        self._pos = 0\n"
+    "        self._index = -1\n"
+    "        self._frame = memoryview(b'')\n"
+    "    def readable(self):\n"
+    "        return True\n"
+    "    def seekable(self):\n"
+    "        return True\n"
+    "    def tell(self):\n"
+    "        return self._pos\n"
+    "    def seek(self, offset, whence=io.SEEK_SET):\n"
+    "        if self.closed:\n"
+    "            raise ValueError('I/O operation on closed resource')\n"
+    "        if whence == io.SEEK_CUR:\n"
+    "            offset += self._pos\n"
+    "        elif whence == io.SEEK_END:\n"
+    "            offset += self.size\n"
+    "        elif whence != io.SEEK_SET:\n"
+    "            raise ValueError(f'invalid whence ({whence})')\n"
+    "        if offset < 0:\n"
+    "            raise ValueError(f'negative seek position {offset}')\n"
+    "        self._pos = offset\n"
+    "        return offset\n"
+    "    def readinto(self, b):\n"
+    "        if self.closed:\n"
+    "            raise ValueError('I/O operation on closed resource')\n"
+    "        with memoryview(b) as m, m.cast('B') as out:\n"
+    "            n = 0\n"
+    "            while n < len(out) and self._pos < self.size:\n"
+    "                if self._view is not None:\n"
+    "                    k = min(len(out) - n, self.size - self._pos)\n"
+    "                    out[n:n + k] = self._view[self._pos:self._pos + k]\n"
+    "                else:\n"
+    "                    i, off = divmod(self._pos, self._frame_size)\n"
+    "                    if i != self._index:\n"
+    "                        ahead = self._ahead if i == self._index + 1 else 0\n"
+    "                        self._frame = memoryview(pycc._resource_frame(self.name, i, ahead))\n"
+    "                        self._index = i\n"
+    "                    k = min(len(out) - n, len(self._frame) - off)\n"
+    "                    out[n:n + k] = self._frame[off:off + k]\n"
+    "                n += k\n"
+    "                self._pos += k\n"
+    "            return n\n"
+    "    def close(self):\n"
+    "        self._view = None\n"
+    "        self._frame = memoryview(b'')\n"
+    "        super().close()\n";
+
+// open_resource(name, prefetch=False): seekable file-like reader. The class
+// is created on first use in each interpreter and kept in its pycc module.
+static PyObject *pycc_open_resource(PyObject *self, PyObject *args, PyObject *kwargs) {
+    static char *kwlist[] = { "name", "prefetch", NULL };
+    PyObject *name;
+    int prefetch = 0;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "U|p", kwlist, &name, &prefetch)) return NULL;
+    PyObject *cls = PyObject_GetAttrString(self, "ResourceReader");
+    if (!cls) {
+        PyErr_Clear();
+        PyObject *g = PyDict_New();
+        PyObject *r = g && PyDict_SetItemString(g, "__builtins__", PyEval_GetBuiltins()) == 0
+                    ? PyRun_String(RESOURCE_READER_SRC, Py_file_input, g, g) : NULL;
+        Py_XDECREF(r);
+        cls = r ? PyDict_GetItemString(g, "ResourceReader") : NULL;
+        Py_XINCREF(cls);
+        Py_XDECREF(g);
+        if (!cls || PyObject_SetAttrString(self, "ResourceReader", cls) != 0) { Py_XDECREF(cls); return NULL; }
+    }
+    PyObject *reader = PyObject_CallFunction(cls, "OO", name, prefetch ? Py_True : Py_False);
+    Py_DECREF(cls);
+    return reader;
+}
+
+#ifdef PYCC_SQLITE_VFS
+// Read-only SQLite VFS "pycc" over raw resources, so the stdlib sqlite3
+// module can query an embedded database in place:
+//   sqlite3.connect("file:pycc:refdata.db?vfs=pycc&immutable=1", uri=True)
+// xRead copies pages out of the mapped binary; with PRAGMA mmap_size set,
+// SQLite reads them in place through xFetch. Temp files (sorts, temp
+// tables) go to the default VFS. The stub does not link SQLite: the VFS is
+// registered with the library _sqlite3 loaded, when the first connection
+// is opened (see sqlite_audit_hook).
+struct pycc_sqlite_file {
+    sqlite3_file base;
+    const char *data;
+    sqlite3_int64 size;
+};
+
+static sqlite3_vfs *sqlite_default_vfs;
+
+static int pyccvfs_close(sqlite3_file *f) { (void)f; return SQLITE_OK; }
+
+static int pyccvfs_read(sqlite3_file *f, void *buf, int amt, sqlite3_int64 off) {
+    const struct pycc_sqlite_file *p = (const struct pycc_sqlite_file *)f;
+    sqlite3_int64 n = off >= p->size ? 0 : p->size - off < amt ? p->size - off : amt;
+    if (n > 0) memcpy(buf, p->data + off, (size_t)n);
+    if (n == amt) return SQLITE_OK;
+    memset((char *)buf + n, 0, (size_t)(amt - n));
+    return SQLITE_IOERR_SHORT_READ;
+}
+
+static int pyccvfs_write(sqlite3_file *f, const void *buf, int amt, sqlite3_int64 off) {
+    (void)f; (void)buf; (void)amt; (void)off;
+    return SQLITE_READONLY;
+}
+
+static int pyccvfs_truncate(sqlite3_file *f, sqlite3_int64 size) { (void)f; (void)size; return SQLITE_READONLY; }
+static int pyccvfs_sync(sqlite3_file *f, int flags) { (void)f; (void)flags; return SQLITE_OK; }
+
+static int pyccvfs_file_size(sqlite3_file *f, sqlite3_int64 *size) {
+    *size = ((const struct pycc_sqlite_file *)f)->size;
+    return SQLITE_OK;
+}
+
+static int pyccvfs_lock(sqlite3_file *f, int level) { (void)f; (void)level; return SQLITE_OK; }
+
+static int pyccvfs_check_reserved(sqlite3_file *f, int *out) {
+    (void)f;
+    *out = 0;
+    return SQLITE_OK;
+}
+
+static int pyccvfs_file_control(sqlite3_file *f, int op, void *arg) { (void)f; (void)op; (void)arg; return SQLITE_NOTFOUND; }
+static int pyccvfs_sector_size(sqlite3_file *f) { (void)f; return 4096; }
+static int pyccvfs_device(sqlite3_file *f) { (void)f; return SQLITE_IOCAP_IMMUTABLE; }
+
+static int pyccvfs_fetch(sqlite3_file *f, sqlite3_int64 off, int amt, void **pp) {
+    const struct pycc_sqlite_file *p = (const struct pycc_sqlite_file *)f;
+    *pp = off >= 0 && off + amt <= p->size ? (void *)(p->data + off) : NULL;
+    return SQLITE_OK;
+}
+
+static int pyccvfs_unfetch(sqlite3_file *f, sqlite3_int64 off, void *p) { (void)f; (void)off; (void)p; return SQLITE_OK; }
+
+static const sqlite3_io_methods pyccvfs_io = {
+    .iVersion = 3,
+    .xClose = pyccvfs_close,
+    .xRead = pyccvfs_read,
+    .xWrite = pyccvfs_write,
+    .xTruncate = pyccvfs_truncate,
+    .xSync = pyccvfs_sync,
+    .xFileSize = pyccvfs_file_size,
+    .xLock = pyccvfs_lock,
+    .xUnlock = pyccvfs_lock,
+    .xCheckReservedLock = pyccvfs_check_reserved,
+    .xFileControl = pyccvfs_file_control,
+    .xSectorSize = pyccvfs_sector_size,
+    .xDeviceCharacteristics = pyccvfs_device,
+    .xFetch = pyccvfs_fetch,
+    .xUnfetch = pyccvfs_unfetch,
+};
+
+static int pyccvfs_open(sqlite3_vfs *vfs, const char *name, sqlite3_file *f, int flags, int *out_flags) {
+    (void)vfs;
+    int temp = SQLITE_OPEN_TEMP_DB | SQLITE_OPEN_TEMP_JOURNAL | SQLITE_OPEN_TRANSIENT_DB | SQLITE_OPEN_SUBJOURNAL;
+    if (!name || (flags & temp)) return sqlite_default_vfs->xOpen(sqlite_default_vfs, name, f, flags, out_flags);
+    f->pMethods = NULL;
+    if (!(flags & SQLITE_OPEN_MAIN_DB) || !payload.data) return SQLITE_CANTOPEN;
+    if (strncmp(name, "pycc:", 5) == 0) name += 5;
+    const struct payload_entry *e = find_entry(ENTRY_RESOURCE, name);
+    if (!e || e->codec != CODEC_RAW) return SQLITE_CANTOPEN;
+    struct pycc_sqlite_file *p = (struct pycc_sqlite_file *)f;
+    p->data = payload.data + e->offset;
+    p->size = (sqlite3_int64)e->stored_size;
+    p->base.pMethods = &pyccvfs_io;
+    if (out_flags) *out_flags = (flags & ~(SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE)) | SQLITE_OPEN_READONLY;
+    return SQLITE_OK;
+}
+
+static int pyccvfs_delete(sqlite3_vfs *vfs, const char *name, int sync) {
+    (void)vfs; (void)name; (void)sync;
+    return SQLITE_IOERR_DELETE;
+}
+
+// No journal or WAL file ever exists next to a resource.
+static int pyccvfs_access(sqlite3_vfs *vfs, const char *name, int flags, int *out) {
+    (void)vfs; (void)name; (void)flags;
+    *out = 0;
+    return SQLITE_OK;
+}
+
+static int pyccvfs_full_pathname(sqlite3_vfs *vfs, const char *name, int n, char *out) {
+    (void)vfs;
+    return snprintf(out, (size_t)n, "%s", name) < n ? SQLITE_OK : SQLITE_CANTOPEN;
+}
+
+static void *pyccvfs_dlopen(sqlite3_vfs *vfs, const char *path) {
+    (void)vfs;
+    return sqlite_default_vfs->xDlOpen(sqlite_default_vfs, path);
+}
+
+static void pyccvfs_dlerror(sqlite3_vfs *vfs, int n, char *msg) {
+    (void)vfs;
+    sqlite_default_vfs->xDlError(sqlite_default_vfs, n, msg);
+}
+
+static void (*pyccvfs_dlsym(sqlite3_vfs *vfs, void *h, const char *sym))(void) {
+    (void)vfs;
+    return sqlite_default_vfs->xDlSym(sqlite_default_vfs, h, sym);
+}
+
+static void pyccvfs_dlclose(sqlite3_vfs *vfs, void *h) {
+    (void)vfs;
+    sqlite_default_vfs->xDlClose(sqlite_default_vfs, h);
+}
+
+static int pyccvfs_randomness(sqlite3_vfs *vfs, int n, char *out) {
+    (void)vfs;
+    return sqlite_default_vfs->xRandomness(sqlite_default_vfs, n, out);
+}
+
+static int pyccvfs_sleep(sqlite3_vfs *vfs, int us) {
+    (void)vfs;
+    return sqlite_default_vfs->xSleep(sqlite_default_vfs, us);
+}
+
+static int pyccvfs_current_time(sqlite3_vfs *vfs, double *t) {
+    (void)vfs;
+    return sqlite_default_vfs->xCurrentTime(sqlite_default_vfs, t);
+}
+
+static int pyccvfs_last_error(sqlite3_vfs *vfs, int n, char *msg) {
+    (void)vfs;
+    return sqlite_default_vfs->xGetLastError ? sqlite_default_vfs->xGetLastError(sqlite_default_vfs, n, msg) : 0;
+}
+
+static int pyccvfs_current_time64(sqlite3_vfs *vfs, sqlite3_int64 *t) {
+    (void)vfs;
+    if (sqlite_default_vfs->iVersion >= 2 && sqlite_default_vfs->xCurrentTimeInt64) {
+        return sqlite_default_vfs->xCurrentTimeInt64(sqlite_default_vfs, t);
+    }
+    double d;
+    int r = sqlite_default_vfs->xCurrentTime(sqlite_default_vfs, &d);
+    *t = (sqlite3_int64)(d * 86400000.0);
+    return r;
+}
+
+static sqlite3_vfs pyccvfs = {
+    .iVersion = 2,
+    .szOsFile = sizeof(struct pycc_sqlite_file),
+    .mxPathname = 512,
+    .zName = "pycc",
+    .xOpen = pyccvfs_open,
+    .xDelete = pyccvfs_delete,
+    .xAccess = pyccvfs_access,
+    .xFullPathname = pyccvfs_full_pathname,
+    .xDlOpen = pyccvfs_dlopen,
+    .xDlError = pyccvfs_dlerror,
+    .xDlSym = pyccvfs_dlsym,
+    .xDlClose = pyccvfs_dlclose,
+    .xRandomness = pyccvfs_randomness,
+    .xSleep = pyccvfs_sleep,
+    .xCurrentTime = pyccvfs_current_time,
+    .xGetLastError = pyccvfs_last_error,
+    .xCurrentTimeInt64 = pyccvfs_current_time64,
+};
+
+// Register the VFS with the SQLite library _sqlite3 is linked against:
+// its symbols are looked up through the extension's own handle, which also
+// covers a libsqlite3 loaded RTLD_LOCAL as its dependency.
+static int sqlite_vfs_register(void) {
+    PyObject *name = PyUnicode_FromString("_sqlite3");
+    PyObject *mod = name ? PyImport_GetModule(name) : NULL;
+    PyObject *file = mod ? PyObject_GetAttrString(mod, "__file__") : NULL;
+    const char *path = file && PyUnicode_Check(file) ? PyUnicode_AsUTF8(file) : NULL;
+    void *h = path ? dlopen(path, RTLD_LAZY | RTLD_NOLOAD) : NULL;
+    Py_XDECREF(file);
+    Py_XDECREF(mod);
+    Py_XDECREF(name);
+    PyErr_Clear();
+    if (!h) h = dlopen("libsqlite3.so.0", RTLD_LAZY | RTLD_NOLOAD);
+    int (*vfs_register)(sqlite3_vfs *, int) = h ? (int (*)(sqlite3_vfs *, int))dlsym(h, "sqlite3_vfs_register") : NULL;
+    sqlite3_vfs *(*vfs_find)(const char *) = h ? (sqlite3_vfs *(*)(const char *))dlsym(h, "sqlite3_vfs_find") : NULL;
+    int r = 1;
+    if (vfs_register && vfs_find && (sqlite_default_vfs = vfs_find(NULL)) != NULL) {
+        // temp files opened through the default VFS use the same file struct
+        if (sqlite_default_vfs->szOsFile > pyccvfs.szOsFile) pyccvfs.szOsFile = sqlite_default_vfs->szOsFile;
+        if (sqlite_default_vfs->mxPathname > pyccvfs.mxPathname) pyccvfs.mxPathname = sqlite_default_vfs->mxPathname;
+        r = vfs_register(&pyccvfs, 0) != SQLITE_OK;
+    }
+    if (h) dlclose(h);
+    if (r != 0) fprintf(stderr, "[pycc] cannot register the pycc SQLite VFS\n");
+    return r;
+}
+
+// Audit hook for "sqlite3.connect", raised by _sqlite3 before it opens a
+// database: registers the VFS once, so binaries that never use SQLite pay
+// nothing. Installed only when the payload has resources.
+static int sqlite_vfs_state;   // 0 not yet, 2 registering, 1 registered, -1 unavailable
+
+static int sqlite_audit_hook(const char *event, PyObject *args, void *data) {
+    (void)args; (void)data;
+    if (__atomic_load_n(&sqlite_vfs_state, __ATOMIC_ACQUIRE) != 0 || strcmp(event, "sqlite3.connect") != 0) return 0;
+    int expected = 0;
+    if (!__atomic_compare_exchange_n(&sqlite_vfs_state, &expected, 2, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) return 0;
+    __atomic_store_n(&sqlite_vfs_state, sqlite_vfs_register() == 0 ? 1 : -1, __ATOMIC_RELEASE);
+    return 0;
+}
+#endif // PYCC_SQLITE_VFS
+
+static PyObject *pycc_resources(PyObject *self, PyObject *args) {
+    (void)self; (void)args;
+    PyObject *names = PyList_New(0);
+    for (unsigned i = 0; names && payload.data && i < payload.nentries; ++i) {
+        if (payload.entries[i].kind != ENTRY_RESOURCE) continue;
+        PyObject *name = PyUnicode_DecodeFSDefault(payload.entries[i].name);
+        if (!name || PyList_Append(names, name) != 0) Py_CLEAR(names);
+        Py_XDECREF(name);
+    }
+    return names;
+}
+
+// Full collection, then move every surviving object into the permanent
+// generation so later collections never write to those pages again. Forked
+// children then share the parent's heap copy-on-write.
+static int gc_frozen;
+
+static PyObject *pycc_gc_freeze(PyObject *self, PyObject *args) {
+    (void)self; (void)args;
+    PyObject *gc = PyImport_ImportModule("gc");
+    if (!gc) return NULL;
+    PyObject *r = PyObject_CallMethod(gc, "collect", NULL);
+    if (r) { Py_DECREF(r); r = PyObject_CallMethod(gc, "freeze", NULL); }
+    Py_DECREF(gc);
+    if (!r) return NULL;
+    Py_DECREF(r);
+    gc_frozen = 1;
+    Py_RETURN_NONE;
+}
+
+// os.register_at_fork(before=...) hook for gc.freeze=fork: freeze once, just
+// before the first fork, when startup imports are known to be done.
+static PyObject *pycc_freeze_before_fork(PyObject *self, PyObject *args) {
+    if (gc_frozen) Py_RETURN_NONE;
+    return pycc_gc_freeze(self, args);
+}
+
+static PyMethodDef pycc_methods[] = {
+    {"_gc_callback", pycc_gc_callback, METH_VARARGS, "gc.callbacks hook feeding the runtime metrics."},
+    {"_set_phase", pycc_set_phase, METH_VARARGS, "Mark the start of a runtime phase."},
+    {"put_work", pycc_put_work, METH_VARARGS, "put_work(data): queue a bytes-like work item for the workers."},
+    {"get_work", (PyCFunction)(void (*)(void))pycc_get_work, METH_VARARGS | METH_KEYWORDS, "get_work(timeout=None): next work item, or None once closed and drained."},
+    {"close_work", pycc_close_work, METH_NOARGS, "close_work(): no more work; idle workers' get_work() returns None."},
+    {"put_result", pycc_put_result, METH_VARARGS, "put_result(data): send a bytes-like result to the main interpreter."},
+    {"get_result", (PyCFunction)(void (*)(void))pycc_get_result, METH_VARARGS | METH_KEYWORDS, "get_result(timeout=None): next result, or None once every worker has exited."},
+    {"worker_id", pycc_worker_id, METH_NOARGS, "Index of the current subinterpreter worker, -1 in the main interpreter."},
+    {"worker_count", pycc_worker_count, METH_NOARGS, "Number of subinterpreter workers started."},
+    {"_listdir", pycc_listdir, METH_VARARGS, "Cached directory listing for the import finder."},
+    {"_finder_note", pycc_finder_note, METH_VARARGS, "Count an import finder lookup."},
+    {"_payload_kind", pycc_payload_kind, METH_VARARGS, "Kind of a module embedded in the payload, or None."},
+    {"_payload_code", pycc_payload_code, METH_VARARGS, "Code object of a module embedded in the payload."},
+    {"resource", pycc_resource, METH_VARARGS, "resource(name): read-only memoryview of a --resource embedded in the binary."},
+    {"resources", pycc_resources, METH_NOARGS, "resources(): names of the embedded resources."},
+    {"open_resource", (PyCFunction)(void (*)(void))pycc_open_resource, METH_VARARGS | METH_KEYWORDS, "open_resource(name, prefetch=False): seekable file-like reader over a resource."},
+    {"_resource_info", pycc_resource_info, METH_VARARGS, "(size, frame_size) of a resource."},
+    {"_resource_frame", pycc_resource_frame, METH_VARARGS, "Decoded frame of a compressed resource."},
+    {"gc_freeze", pycc_gc_freeze, METH_NOARGS, "gc_freeze(): collect, then gc.freeze() everything alive; call once startup imports are done."},
+    {"_freeze_before_fork", pycc_freeze_before_fork, METH_NOARGS, "os.register_at_fork hook for the gc.freeze=fork setting."},
+    {NULL, NULL, 0, NULL}
+};
+
+// Multi-phase init so the module can be imported by subinterpreters that have
+// their own GIL. Module state is empty: everything it touches is process-wide.
+static PyModuleDef_Slot pycc_slots[] = {
+#if PY_VERSION_HEX >= 0x030C0000
+    {Py_mod_multiple_interpreters, Py_MOD_PER_INTERPRETER_GIL_SUPPORTED},
+#endif
+#if PY_VERSION_HEX >= 0x030D0000
+    // importing pycc must not re-enable the GIL on free-threaded builds
+    {Py_mod_gil, Py_MOD_GIL_NOT_USED},
+#endif
+    {0, NULL}
+};
+
+static struct PyModuleDef pycc_module = {
+    PyModuleDef_HEAD_INIT, "pycc", "pycc runtime support.", 0, pycc_methods,
+    pycc_slots, NULL, NULL, NULL
+};
+
+static PyObject *PyInit_pycc(void) {
+    return PyModuleDef_Init(&pycc_module);
+}
+
+// Register pycc._gc_callback in gc.callbacks. Called with the GIL held.
+static void install_gc_callback(void) {
+    PyObject *gc = PyImport_ImportModule("gc");
+    PyObject *pycc = PyImport_ImportModule("pycc");
+    PyObject *callbacks = gc ? PyObject_GetAttrString(gc, "callbacks") : NULL;
+    PyObject *hook = pycc ? PyObject_GetAttrString(pycc, "_gc_callback") : NULL;
+    if (!callbacks || !hook || PyList_Append(callbacks, hook) != 0) PyErr_Clear();
+    Py_XDECREF(hook);
+    Py_XDECREF(callbacks);
+    Py_XDECREF(pycc);
+    Py_XDECREF(gc);
+}
+
+// GIL contention profile (PYCC_GIL_STATS=1).
+// A sampler thread wakes every PYCC_GIL_SAMPLE_MS (default 10) and, only when
+// some thread is blocked in take_gil(), briefly takes the GIL to read
+// sys._current_frames(). The frame a blocked thread is parked on is stable, so
+// each sample charges one interval of waiting to that code location. The
+// report is printed at exit and on SIGUSR2.
+#define GIL_MAX_SITES 256
+
+struct gil_site {
+    uint64_t hash;
+    uint64_t samples;
+    char where[200];
+};
+
+static struct {
+    pthread_t thread;
+    int running;
+    int stop;
+    volatile sig_atomic_t dump_requested;
+    long interval_ms;
+    uint64_t samples;
+    uint64_t dropped;
+    struct gil_site sites[GIL_MAX_SITES];
+} gil_prof;
+
+static uint64_t fnv1a(const char *s) {
+    uint64_t h = 1469598103934665603ull;
+    for (; *s; ++s) { h ^= (unsigned char)*s; h *= 1099511628211ull; }
+    return h;
+}
+
+static void gil_record_site(const char *where) {
+    uint64_t h = fnv1a(where);
+    for (unsigned i = 0; i < GIL_MAX_SITES; ++i) {
+        struct gil_site *site = &gil_prof.sites[(h + i) % GIL_MAX_SITES];
+        if (site->samples == 0) {
+            site->hash = h;
+            snprintf(site->where, sizeof(site->where), "%s", where);
+        } else if (site->hash != h || strcmp(site->where, where) != 0) {
+            continue;
+        }
+        site->samples++;
+        return;
+    }
+    gil_prof.dropped++;
+}
+
+// Called with the GIL held by the sampler thread.
+static void gil_sample(void) {
+    PyObject *fn = PySys_GetObject("_current_frames");
+    PyObject *frames = fn ? PyObject_CallNoArgs(fn) : NULL;
+    if (!frames || !PyDict_Check(frames)) { Py_XDECREF(frames); PyErr_Clear(); return; }
+
+    unsigned n = __atomic_load_n(&metrics.nslots, __ATOMIC_RELAXED);
+    if (n > PYCC_MAX_THREADS) n = PYCC_MAX_THREADS;
+    for (unsigned i = 0; i < n; ++i) {
+        struct thread_slot *slot = &metrics.slots[i];
+        if (!__atomic_load_n(&slot->waiting_since, __ATOMIC_RELAXED)) continue;
+        PyObject *key = PyLong_FromUnsignedLong(slot->ident);
+        PyObject *frame = key ? PyDict_GetItemWithError(frames, key) : NULL;
+        Py_XDECREF(key);
+        if (!frame) { PyErr_Clear(); continue; }
+
+        PyCodeObject *code = PyFrame_GetCode((PyFrameObject *)frame);
+        int line = PyFrame_GetLineNumber((PyFrameObject *)frame);
+        PyObject *filename = PyObject_GetAttrString((PyObject *)code, "co_filename");
+        PyObject *name = PyObject_GetAttrString((PyObject *)code, "co_name");
+        const char *f = filename ? PyUnicode_AsUTF8(filename) : NULL;
+        const char *nm = name ? PyUnicode_AsUTF8(name) : NULL;
+        char where[200];
+        snprintf(where, sizeof(where), "%s:%d (%s)", f ? f : "?", line, nm ? nm : "?");
+        gil_record_site(where);
+        gil_prof.samples++;
+        Py_XDECREF(name);
+        Py_XDECREF(filename);
+        Py_DECREF(code);
+    }
+    Py_DECREF(frames);
+    PyErr_Clear();
+}
+
+static int any_thread_waiting(void) {
+    unsigned n = __atomic_load_n(&metrics.nslots, __ATOMIC_RELAXED);
+    if (n > PYCC_MAX_THREADS) n = PYCC_MAX_THREADS;
+    for (unsigned i = 0; i < n; ++i) {
+        if (__atomic_load_n(&metrics.slots[i].waiting_since, __ATOMIC_RELAXED)) return 1;
+    }
+    return 0;
+}
+
+static void print_gil_hist(const char *title, const uint64_t *hist) {
+    uint64_t max = 0, total = 0;
+    for (int b = 0; b < GIL_HIST_BUCKETS; ++b) {
+        if (hist[b] > max) max = hist[b];
+        total += hist[b];
+    }
+    fprintf(stderr, "[pycc] %s (%llu)\n", title, (unsigned long long)total);
+    if (!max) return;
+    for (int b = 0; b < GIL_HIST_BUCKETS; ++b) {
+        if (!hist[b]) continue;
+        uint64_t us = 1ull << b;
+        char label[32];
+        if (b == 0) snprintf(label, sizeof(label), "< 2us");
+        else if (us < 1000) snprintf(label, sizeof(label), ">= %lluus", (unsigned long long)us);
+        else if (us < 1000000) snprintf(label, sizeof(label), ">= %.1fms", (double)us / 1e3);
+        else snprintf(label, sizeof(label), ">= %.1fs", (double)us / 1e6);
+        char bar[41];
+        int width = (int)((hist[b] * 40 + max - 1) / max);
+        memset(bar, '#', (size_t)width);
+        bar[width] = '\0';
+        fprintf(stderr, "[pycc]   %10s %10llu %s\n", label, (unsigned long long)hist[b], bar);
+    }
+}
+
+static int gil_site_cmp(const void *a, const void *b) {
+    const struct gil_site *x = *(const struct gil_site *const *)a;
+    const struct gil_site *y = *(const struct gil_site *const *)b;
+    return (x->samples < y->samples) - (x->samples > y->samples);
+}
+
+static void print_gil_report(void) {
+    uint64_t now = now_ns();
+    fprintf(stderr, "[pycc] gil contention, %.3f s wall\n", (double)(now - metrics.start_ns) / 1e9);
+    fprintf(stderr, "[pycc]   %-8s %10s %10s %12s %12s %7s\n", "tid", "acquires", "waits", "wait ms", "hold ms", "wait%");
+    unsigned n = __atomic_load_n(&metrics.nslots, __ATOMIC_RELAXED);
+    if (n > PYCC_MAX_THREADS) n = PYCC_MAX_THREADS;
+    for (unsigned i = 0; i < n; ++i) {
+        const struct thread_slot *slot = &metrics.slots[i];
+        uint64_t wait = __atomic_load_n(&slot->gil_wait_ns, __ATOMIC_RELAXED);
+        uint64_t hold = __atomic_load_n(&slot->gil_hold_ns, __ATOMIC_RELAXED);
+        double pct = (wait + hold) ? 100.0 * (double)wait / (double)(wait + hold) : 0.0;
+        fprintf(stderr, "[pycc]   %-8ld %10llu %10llu %12.3f %12.3f %6.1f%%\n", slot->tid,
+                (unsigned long long)__atomic_load_n(&slot->gil_acquires, __ATOMIC_RELAXED),
+                (unsigned long long)__atomic_load_n(&slot->gil_waits, __ATOMIC_RELAXED),
+                (double)wait / 1e6, (double)hold / 1e6, pct);
+    }
+    print_gil_hist("gil wait per contended acquire", metrics.gil_wait_hist);
+    print_gil_hist("gil hold per acquire", metrics.gil_hold_hist);
+
+    // sites are only written by the sampler; a dump racing a sample may be
+    // off by one, which is fine for a report
+    const struct gil_site *top[GIL_MAX_SITES];
+    unsigned nsites = 0;
+    for (unsigned i = 0; i < GIL_MAX_SITES; ++i) {
+        if (gil_prof.sites[i].samples) top[nsites++] = &gil_prof.sites[i];
+    }
+    qsort(top, nsites, sizeof(top[0]), gil_site_cmp);
+    fprintf(stderr, "[pycc] top gil wait sites (%llu samples every %ld ms%s)\n",
+            (unsigned long long)gil_prof.samples, gil_prof.interval_ms, gil_prof.dropped ? ", table full" : "");
+    for (unsigned i = 0; i < nsites && i < 10; ++i) {
+        fprintf(stderr, "[pycc]   ~%8.1f ms %6llu  %s\n",
+                (double)(top[i]->samples * (uint64_t)gil_prof.interval_ms),
+                (unsigned long long)top[i]->samples, top[i]->where);
+    }
+}
+
+static void gil_dump_signal(int sig) {
+    (void)sig;
+    gil_prof.dump_requested = 1;
+}
+
+static void *gil_sampler_main(void *arg) {
+    (void)arg;
+    gil_tls.internal = 1;
+    PyGILState_STATE gstate = PyGILState_Ensure();
+    PyThreadState *ts = PyEval_SaveThread();
+
+    struct timespec step = { 0, 1000000L };
+    while (!__atomic_load_n(&gil_prof.stop, __ATOMIC_RELAXED)) {
+        for (long slept = 0; slept < gil_prof.interval_ms && !__atomic_load_n(&gil_prof.stop, __ATOMIC_RELAXED); ++slept) {
+            nanosleep(&step, NULL);
+        }
+        if (gil_prof.dump_requested) {
+            gil_prof.dump_requested = 0;
+            print_gil_report();
+        }
+        if (__atomic_load_n(&gil_prof.stop, __ATOMIC_RELAXED) || !any_thread_waiting()) continue;
+        PyEval_RestoreThread(ts);
+        gil_sample();
+        ts = PyEval_SaveThread();
+    }
+
+    PyEval_RestoreThread(ts);
+    PyGILState_Release(gstate);
+    return NULL;
+}
+
+// Called from the main thread with the GIL held.
+static void gil_sampler_start(void) {
+    gil_prof.interval_ms = env_long("PYCC_GIL_SAMPLE_MS", 10);
+    if (gil_prof.interval_ms <= 0) gil_prof.interval_ms = 10;
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = gil_dump_signal;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGUSR2, &sa, NULL);
+
+    if (pthread_create(&gil_prof.thread, NULL, gil_sampler_main, NULL) == 0) gil_prof.running = 1;
+}
+
+// Called from the main thread with the GIL held, before finalization.
+static void gil_sampler_stop(void) {
+    if (!gil_prof.running) return;
+    __atomic_store_n(&gil_prof.stop, 1, __ATOMIC_RELAXED);
+    Py_BEGIN_ALLOW_THREADS
+    pthread_join(gil_prof.thread, NULL);
+    Py_END_ALLOW_THREADS
+    gil_prof.running = 0;
+}
+
+// Exit metrics, printed to stderr when PYCC_TRACE is set.
+static void print_exit_metrics(void) {
+    set_phase(__atomic_load_n(&metrics.phase, __ATOMIC_RELAXED));
+    fprintf(stderr, "[pycc] total %.3f ms\n", (double)(now_ns() - metrics.start_ns) / 1e6);
+    for (int i = 0; i < PHASE_COUNT; ++i) {
+        fprintf(stderr, "[pycc]   phase %-10s %10.3f ms\n", PHASE_NAMES[i], (double)metrics.phase_ns[i] / 1e6);
+    }
+    fprintf(stderr, "[pycc] gc collections %llu/%llu/%llu collected %llu uncollectable %llu\n",
+            (unsigned long long)metrics.gc_collections[0], (unsigned long long)metrics.gc_collections[1],
+            (unsigned long long)metrics.gc_collections[2], (unsigned long long)metrics.gc_collected,
+            (unsigned long long)metrics.gc_uncollectable);
+    fprintf(stderr, "[pycc] rss %llu KiB threads %u\n",
+            (unsigned long long)(read_rss_bytes() / 1024), read_thread_count());
+#ifdef Py_GIL_DISABLED
+    fprintf(stderr, "[pycc] free-threaded runtime, payload %s\n",
+            (payload.flags & FOOTER_FLAG_FREE_THREADED) ? "runs without the GIL" : "requires the GIL");
+#endif
+    fprintf(stderr, "[pycc] import finder %llu lookups %llu misses, %llu dirs listed in %llu syscalls\n",
+            (unsigned long long)finder_stats.lookups, (unsigned long long)finder_stats.misses,
+            (unsigned long long)finder_stats.dirs, (unsigned long long)finder_stats.syscalls);
+    unsigned n = metrics.nslots < PYCC_MAX_THREADS ? metrics.nslots : PYCC_MAX_THREADS;
+    for (unsigned i = 0; i < n; ++i) {
+        fprintf(stderr, "[pycc]   tid %-8ld gil wait %10.3f ms (%llu waits) hold %10.3f ms\n", metrics.slots[i].tid,
+                (double)metrics.slots[i].gil_wait_ns / 1e6, (unsigned long long)metrics.slots[i].gil_waits,
+                (double)metrics.slots[i].gil_hold_ns / 1e6);
+    }
+}
+
+// Live shared-memory metrics page (PYCC_SHM=1).
+// A background thread rewrites /dev/shm/pycc-<pid> every PYCC_SHM_INTERVAL_MS
+// (default 250) under a seqlock: seq is odd while the page is being written,
+// readers retry until they see the same even value before and after copying.
+#define SHM_MAGIC "PYCCSHM1"
+#define SHM_VERSION 2
+
+struct shm_thread {
+    int64_t tid;
+    uint64_t gil_wait_ns;
+    uint64_t gil_waits;
+    uint64_t gil_hold_ns;
+};
+
+struct shm_page {
+    char magic[8];
+    uint32_t version;
+    uint32_t size;
+    uint64_t seq;
+    int64_t pid;
+    char exe[256];
+    uint64_t start_ns;
+    uint64_t update_ns;
+    uint32_t phase;
+    uint32_t threads;
+    uint64_t rss_bytes;
+    uint64_t gc_collections[3];
+    uint64_t gc_collected;
+    uint64_t gc_uncollectable;
+    uint32_t nslots;
+    uint32_t reserved;
+    struct shm_thread slots[PYCC_MAX_THREADS];
+};
+
+static struct {
+    struct shm_page *page;
+    char name[64];
+    pthread_t thread;
+    int stop;
+    long interval_ms;
+} shm;
+
+static void shm_publish(void) {
+    struct shm_page *p = shm.page;
+    uint64_t rss = read_rss_bytes();
+    unsigned threads = read_thread_count();
+
+    __atomic_store_n(&p->seq, p->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    p->update_ns = now_ns();
+    p->phase = (uint32_t)__atomic_load_n(&metrics.phase, __ATOMIC_RELAXED);
+    p->threads = threads;
+    p->rss_bytes = rss;
+    for (int g = 0; g < 3; ++g) p->gc_collections[g] = __atomic_load_n(&metrics.gc_collections[g], __ATOMIC_RELAXED);
+    p->gc_collected = __atomic_load_n(&metrics.gc_collected, __ATOMIC_RELAXED);
+    p->gc_uncollectable = __atomic_load_n(&metrics.gc_uncollectable, __ATOMIC_RELAXED);
+    unsigned n = __atomic_load_n(&metrics.nslots, __ATOMIC_RELAXED);
+    if (n > PYCC_MAX_THREADS) n = PYCC_MAX_THREADS;
+    p->nslots = n;
+    for (unsigned i = 0; i < n; ++i) {
+        p->slots[i].tid = __atomic_load_n(&metrics.slots[i].tid, __ATOMIC_ACQUIRE);
+        p->slots[i].gil_wait_ns = __atomic_load_n(&metrics.slots[i].gil_wait_ns, __ATOMIC_RELAXED);
+        p->slots[i].gil_waits = __atomic_load_n(&metrics.slots[i].gil_waits, __ATOMIC_RELAXED);
+        p->slots[i].gil_hold_ns = __atomic_load_n(&metrics.slots[i].gil_hold_ns, __ATOMIC_RELAXED);
+    }
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&p->seq, p->seq + 1, __ATOMIC_RELAXED);
+}
+
+static void *shm_thread_main(void *arg) {
+    (void)arg;
+    // sleep in short steps so shm_stop() never waits a full interval
+    struct timespec step = { 0, 10 * 1000000L };
+    while (!__atomic_load_n(&shm.stop, __ATOMIC_RELAXED)) {
+        shm_publish();
+        for (long slept = 0; slept < shm.interval_ms && !__atomic_load_n(&shm.stop, __ATOMIC_RELAXED); slept += 10) {
+            nanosleep(&step, NULL);
+        }
+    }
+    return NULL;
+}
+
+static int shm_start(void) {
+    snprintf(shm.name, sizeof(shm.name), "/pycc-%ld", (long)getpid());
+    int fd = shm_open(shm.name, O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if (fd < 0) { fprintf(stderr, "[pycc] shm_open %s failed\n", shm.name); return 1; }
+    if (ftruncate(fd, sizeof(struct shm_page)) != 0) { close(fd); shm_unlink(shm.name); return 2; }
+    void *m = mmap(NULL, sizeof(struct shm_page), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (m == MAP_FAILED) { shm_unlink(shm.name); return 3; }
+
+    shm.page = (struct shm_page *)m;
+    shm.interval_ms = env_long("PYCC_SHM_INTERVAL_MS", 250);
+    if (shm.interval_ms <= 0) shm.interval_ms = 250;
+    memcpy(shm.page->magic, SHM_MAGIC, 8);
+    shm.page->version = SHM_VERSION;
+    shm.page->size = sizeof(struct shm_page);
+    shm.page->pid = getpid();
+    shm.page->start_ns = metrics.start_ns;
+    if (!get_payload_path(shm.page->exe, sizeof(shm.page->exe))) shm.page->exe[0] = '\0';
+
+    if (pthread_create(&shm.thread, NULL, shm_thread_main, NULL) != 0) {
+        munmap(shm.page, sizeof(struct shm_page));
+        shm.page = NULL;
+        shm_unlink(shm.name);
+        return 4;
+    }
+    return 0;
+}
+
+static void shm_stop(void) {
+    if (!shm.page) return;
+    __atomic_store_n(&shm.stop, 1, __ATOMIC_RELAXED);
+    pthread_join(shm.thread, NULL);
+    munmap(shm.page, sizeof(struct shm_page));
+    shm.page = NULL;
+    shm_unlink(shm.name);
+}
+
+// Consistent snapshot of a page written by another process.
+static int shm_read_snapshot(const struct shm_page *src, struct shm_page *out) {
+    for (int attempt = 0; attempt < 100; ++attempt) {
+        uint64_t s1 = __atomic_load_n(&src->seq, __ATOMIC_ACQUIRE);
+        if (s1 & 1) { sched_yield(); continue; }
+        memcpy(out, src, sizeof(*out));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        uint64_t s2 = __atomic_load_n(&src->seq, __ATOMIC_RELAXED);
+        if (s1 == s2) return 1;
+    }
+    return 0;
+}
+
+// `pycc top`: show every live metrics page on the host.
+static void top_print_page(const struct shm_page *p, uint64_t now) {
+    uint64_t wait_ns = 0;
+    for (unsigned i = 0; i < p->nslots && i < PYCC_MAX_THREADS; ++i) wait_ns += p->slots[i].gil_wait_ns;
+    const char *exe = strrchr(p->exe, '/');
+    exe = exe ? exe + 1 : p->exe;
+    printf("%8lld %-10s %10llu %4u %8llu %6llu %6llu %10.1f %8.1f  %s\n",
+           (long long)p->pid,
+           p->phase < PHASE_COUNT ? PHASE_NAMES[p->phase] : "?",
+           (unsigned long long)(p->rss_bytes / 1024), p->threads,
+           (unsigned long long)p->gc_collections[0], (unsigned long long)p->gc_collections[1],
+           (unsigned long long)p->gc_collections[2],
+           (double)wait_ns / 1e6,
+           (double)(now - p->start_ns) / 1e9,
+           exe);
+    for (unsigned i = 0; i < p->nslots && i < PYCC_MAX_THREADS; ++i) {
+        if (p->slots[i].gil_waits == 0) continue;
+        printf("%8s   tid %-8lld gil wait %10.1f ms over %llu waits, hold %10.1f ms\n", "",
+               (long long)p->slots[i].tid, (double)p->slots[i].gil_wait_ns / 1e6,
+               (unsigned long long)p->slots[i].gil_waits, (double)p->slots[i].gil_hold_ns / 1e6);
+    }
+}
+
+static int top_mode(int argc, char **argv) {
+    long delay_ms = 1000;
+    long iterations = -1;
+    for (int i = 2; i < argc; ++i) {
+        if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) delay_ms = (long)(atof(argv[++i]) * 1000);
+        else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) iterations = atol(argv[++i]);
+        else {
+            fprintf(stderr, "Usage: %s top [-d seconds] [-n iterations]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (delay_ms <= 0) delay_ms = 1000;
+    int tty = isatty(STDOUT_FILENO);
+
+    for (long it = 0; iterations < 0 || it < iterations; ++it) {
+        if (it > 0) {
+            struct timespec ts = { delay_ms / 1000, (delay_ms % 1000) * 1000000L };
+            nanosleep(&ts, NULL);
+        }
+        if (tty) printf("\033[H\033[2J");
+        printf("%8s %-10s %10s %4s %8s %6s %6s %10s %8s  %s\n",
+               "PID", "PHASE", "RSS(KiB)", "THR", "GC0", "GC1", "GC2", "GILWAIT", "UP(s)", "BINARY");
+
+        DIR *d = opendir("/dev/shm");
+        if (!d) { fprintf(stderr, "Cannot open /dev/shm\n"); return 2; }
+        uint64_t now = now_ns();
+        struct dirent *de;
+        while ((de = readdir(d)) != NULL) {
+            if (strncmp(de->d_name, "pycc-", 5) != 0) continue;
+            long pid = atol(de->d_name + 5);
+            char name[300];
+            snprintf(name, sizeof(name), "/%s", de->d_name);
+            if (pid <= 0 || (kill((pid_t)pid, 0) != 0 && errno == ESRCH)) {
+                // owner died without cleaning up
+                shm_unlink(name);
+                continue;
+            }
+            int fd = shm_open(name, O_RDONLY, 0);
+            if (fd < 0) continue;
+            struct stat st;
+            if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(struct shm_page)) { close(fd); continue; }
+            void *m = mmap(NULL, sizeof(struct shm_page), PROT_READ, MAP_SHARED, fd, 0);
+            close(fd);
+            if (m == MAP_FAILED) continue;
+            struct shm_page snap;
+            const struct shm_page *src = (const struct shm_page *)m;
+            if (memcmp(src->magic, SHM_MAGIC, 8) == 0 && src->version == SHM_VERSION &&
+                shm_read_snapshot(src, &snap)) {
+                top_print_page(&snap, now);
+            }
+            munmap(m, sizeof(struct shm_page));
+        }
+        closedir(d);
+        fflush(stdout);
+    }
+    return 0;
+}
+
+// Read a whole file into a malloc'd buffer. Returns NULL on failure.
+static unsigned char *read_file(const char *path, uint64_t *size) {
+    FILE *f = fopen(path, "rb");
+    if (!f) return NULL;
+    unsigned char *buf = NULL;
+    if (fseek(f, 0, SEEK_END) == 0) {
+        long n = ftell(f);
+        if (n >= 0 && fseek(f, 0, SEEK_SET) == 0) {
+            buf = malloc((size_t)n + 1);
+            if (buf && fread(buf, 1, (size_t)n, f) != (size_t)n) { free(buf); buf = NULL; }
+            if (buf) *size = (uint64_t)n;
+        }
+    }
+    fclose(f);
+    return buf;
+}
+
+// Benchmarks (pycc bench-startup, bench-build, bench-memory, bench-launch).
+// There is no build system to hang targets on, so the suites are subcommands
+// of the stub itself: they generate a corpus, build it with this binary and
+// measure the results as child processes.
+struct samples {
+    double *v;
+    size_t n, cap;
+};
+
+static int samples_add(struct samples *s, double x) {
+    if (s->n == s->cap) {
+        size_t cap = s->cap ? s->cap * 2 : 64;
+        double *v = realloc(s->v, cap * sizeof(*v));
+        if (!v) return 1;
+        s->v = v;
+        s->cap = cap;
+    }
+    s->v[s->n++] = x;
+    return 0;
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+// Nearest-rank percentile; sorts the samples.
+static double samples_pct(struct samples *s, double p) {
+    if (s->n == 0) return 0;
+    qsort(s->v, s->n, sizeof(double), cmp_double);
+    size_t rank = (size_t)(p / 100.0 * (double)s->n + 0.999999);
+    if (rank < 1) rank = 1;
+    if (rank > s->n) rank = s->n;
+    return s->v[rank - 1];
+}
+
+static void samples_free(struct samples *s) {
+    free(s->v);
+    memset(s, 0, sizeof(*s));
+}
+
+// Resources used by one child process.
+struct bench_usage {
+    int64_t wall_ns;
+    double cpu_ms;        // user + system
+    long maxrss_kb;
+    long minflt, majflt;  // page faults
+    long csw;             // voluntary + involuntary context switches
+    uint64_t rchar, wchar; // bytes passed through read/write-family syscalls
+    uint64_t syscr, syscw; // read/write-family syscalls made
+};
+
+// Spawn argv (PATH lookup) with stdout on /dev/null and stderr on /dev/null,
+// or on a pipe whose read end is returned in *errfd. Returns the pid or -1.
+static pid_t bench_spawn(char *const argv[], int *errfd) {
+    posix_spawn_file_actions_t fa;
+    posix_spawn_file_actions_init(&fa);
+    posix_spawn_file_actions_addopen(&fa, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+    int pipefd[2] = { -1, -1 };
+    if (errfd && pipe2(pipefd, O_CLOEXEC) == 0) {
+        posix_spawn_file_actions_adddup2(&fa, pipefd[1], STDERR_FILENO);
+    } else {
+        posix_spawn_file_actions_addopen(&fa, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+    }
+    extern char **environ;
+    pid_t pid;
+    int sr = posix_spawnp(&pid, argv[0], &fa, NULL, argv, environ);
+    posix_spawn_file_actions_destroy(&fa);
+    if (pipefd[1] >= 0) close(pipefd[1]);
+    if (errfd) *errfd = sr == 0 ? pipefd[0] : -1;
+    if (sr != 0) {
+        if (pipefd[0] >= 0) close(pipefd[0]);
+        return -1;
+    }
+    return pid;
+}
+
+// Reap pid (spawned at t0) and fill u. The I/O counters are read from
+// /proc/<pid>/io while the child is still a zombie. Returns 0 if it exited 0.
+static int bench_wait(pid_t pid, uint64_t t0, struct bench_usage *u) {
+    siginfo_t si;
+    while (waitid(P_PID, pid, &si, WEXITED | WNOWAIT) < 0 && errno == EINTR) {}
+    uint64_t t1 = now_ns();
+    if (u) {
+        memset(u, 0, sizeof(*u));
+        u->wall_ns = (int64_t)(t1 - t0);
+        char path[64], line[128];
+        snprintf(path, sizeof(path), "/proc/%d/io", (int)pid);
+        FILE *f = fopen(path, "r");
+        while (f && fgets(line, sizeof(line), f)) {
+            unsigned long long v;
+            if (sscanf(line, "rchar: %llu", &v) == 1) u->rchar = v;
+            else if (sscanf(line, "wchar: %llu", &v) == 1) u->wchar = v;
+            else if (sscanf(line, "syscr: %llu", &v) == 1) u->syscr = v;
+            else if (sscanf(line, "syscw: %llu", &v) == 1) u->syscw = v;
+        }
+        if (f) fclose(f);
+    }
+    int status = 0;
+    struct rusage ru;
+    memset(&ru, 0, sizeof(ru));
+    int wr;
+    while ((wr = wait4(pid, &status, 0, &ru)) < 0 && errno == EINTR) {}
+    if (wr < 0) return -1;
+    if (u) {
+        u->cpu_ms = (double)(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1e3 +
+                    (double)(ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e3;
+        u->maxrss_kb = ru.ru_maxrss;
+        u->minflt = ru.ru_minflt;
+        u->majflt = ru.ru_majflt;
+        u->csw = ru.ru_nvcsw + ru.ru_nivcsw;
+    }
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 0 : -1;
+}
+
+// Run argv with stdout on /dev/null and stderr either on /dev/null or
+// captured into err (NUL-terminated, truncated). Returns the wall time in ns
+// from spawn to exit, or -1 if it could not run or failed.
+static int64_t bench_run_usage(char *const argv[], char *err, size_t err_len, struct bench_usage *u) {
+    int errfd = -1;
+    uint64_t t0 = now_ns();
+    pid_t pid = bench_spawn(argv, err ? &errfd : NULL);
+    if (pid < 0) return -1;
+    if (errfd >= 0) {
+        size_t len = 0;
+        ssize_t n;
+        char sink[4096];
+        while ((n = read(errfd, len + 1 < err_len ? err + len : sink,
+                         len + 1 < err_len ? err_len - 1 - len : sizeof(sink))) > 0) {
+            if (len + 1 < err_len) len += (size_t)n;
+        }
+        err[len] = '\0';
+        close(errfd);
+    }
+    struct bench_usage local;
+    if (!u) u = &local;
+    if (bench_wait(pid, t0, u) != 0) return -1;
+    return u->wall_ns;
+}
+
+static int64_t bench_run(char *const argv[], char *err, size_t err_len) {
+    return bench_run_usage(argv, err, err_len, NULL);
+}
+
+// Run argv `count` times with up to `jobs` running at once. prepare(i, ctx),
+// when given, may edit argv before launch i. usage[i] receives launch i and
+// ok[i] whether it exited 0. Returns the wall time of the whole run in ms.
+static double bench_run_parallel(char **argv, long count, long jobs, void (*prepare)(long, void *), void *ctx,
+                                 struct bench_usage *usage, char *ok) {
+    pid_t *pids = calloc((size_t)count, sizeof(pid_t));
+    uint64_t *starts = calloc((size_t)count, sizeof(uint64_t));
+    uint64_t t0 = now_ns();
+    long next = 0, done = 0, running = 0;
+    memset(ok, 0, (size_t)count);
+    while (pids && starts && done < count) {
+        while (running < jobs && next < count) {
+            if (prepare) prepare(next, ctx);
+            starts[next] = now_ns();
+            pids[next] = bench_spawn(argv, NULL);
+            if (pids[next] < 0) ++done;
+            else ++running;
+            ++next;
+        }
+        if (running == 0) continue;
+        // reap whichever finishes first
+        siginfo_t si;
+        memset(&si, 0, sizeof(si));
+        if (waitid(P_ALL, 0, &si, WEXITED | WNOWAIT) < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        for (long i = 0; i < next; ++i) {
+            if (pids[i] != si.si_pid) continue;
+            ok[i] = bench_wait(pids[i], starts[i], &usage[i]) == 0;
+            pids[i] = -1;
+            --running;
+            ++done;
+            break;
+        }
+    }
+    double total = (double)(now_ns() - t0) / 1e6;
+    free(pids);
+    free(starts);
+    return total;
+}
+
+// Evict what a cold launch should read from the page cache: everything when
+// /proc/sys/vm/drop_caches is writable (root), otherwise just `files`.
+// Returns the method used.
+static const char *bench_drop_caches(const char *const *files, int nfiles) {
+    sync();
+    int fd = open("/proc/sys/vm/drop_caches", O_WRONLY | O_CLOEXEC);
+    if (fd >= 0) {
+        int ok = write(fd, "3", 1) == 1;
+        close(fd);
+        if (ok) return "drop_caches";
+    }
+    for (int i = 0; i < nfiles; ++i) {
+        if (!files[i] || !files[i][0]) continue;
+        int f = open(files[i], O_RDONLY | O_CLOEXEC);
+        if (f < 0) continue;
+        posix_fadvise(f, 0, 0, POSIX_FADV_DONTNEED);
+        close(f);
+    }
+    return "fadvise";
+}
+
+// Remove a generated corpus directory (and its __pycache__).
+static void bench_remove_dir(const char *dir) {
+    DIR *d = opendir(dir);
+    if (!d) return;
+    struct dirent *de;
+    while ((de = readdir(d)) != NULL) {
+        if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0) continue;
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+        if (de->d_type == DT_DIR) bench_remove_dir(path);
+        else unlink(path);
+    }
+    closedir(d);
+    rmdir(dir);
+}
+
+// Format a path in the corpus dir (which --keep makes user-chosen) into
+// out. Returns 0, or 1 after reporting it if the path does not fit.
+__attribute__((format(printf, 3, 4)))
+static int bench_path(char *out, size_t size, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(out, size, fmt, ap);
+    va_end(ap);
+    if (n >= 0 && (size_t)n < size) return 0;
+    fprintf(stderr, "Path too long: %s...\n", out);
+    return 1;
+}
+
+// Find this binary (the pycc every bench mode builds with) and set up the
+// corpus dir: --keep's directory, created if missing, or a fresh one under
+// $TMPDIR. Returns 0, or 1 after reporting the failure.
+static int bench_corpus_dir(char *self, size_t self_size, char *dir, size_t dir_size, const char *keep) {
+    if (!get_self_path(self, self_size)) { fprintf(stderr, "Cannot get self path\n"); return 1; }
+    if (keep) {
+        if (bench_path(dir, dir_size, "%s", keep) != 0) return 1;
+        if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+            fprintf(stderr, "Cannot create %s: %s\n", dir, strerror(errno));
+            return 1;
+        }
+        return 0;
+    }
+    const char *td = getenv("TMPDIR");
+    if (bench_path(dir, dir_size, "%s/pycc-bench-XXXXXX", td ? td : "/tmp") != 0) return 1;
+    if (!mkdtemp(dir)) { fprintf(stderr, "Cannot create corpus dir: %s\n", strerror(errno)); return 1; }
+    return 0;
+}
+
+// Open the --json output (if one was asked for) and start its array of
+// records; *json stays NULL without one. bench_json_close ends the array.
+static int bench_json_open(const char *json_path, FILE **json) {
+    *json = NULL;
+    if (!json_path) return 0;
+    *json = fopen(json_path, "w");
+    if (!*json) { fprintf(stderr, "Cannot write %s: %s\n", json_path, strerror(errno)); return 1; }
+    fputs("[\n", *json);
+    return 0;
+}
+
+static int bench_json_close(FILE *json) {
+    if (!json) return 0;
+    fputs("\n]\n", json);
+    return fclose(json) != 0;
+}
+
+static int bench_write_file(const char *dir, const char *name, const char *text) {
+    char path[PATH_MAX];
+    if (bench_path(path, sizeof(path), "%s/%s", dir, name) != 0) return 1;
+    FILE *f = fopen(path, "w");
+    if (!f) return 1;
+    int ok = fputs(text, f) >= 0;
+    return (fclose(f) == 0 && ok) ? 0 : 1;
+}
+
+// libpython this stub runs on, and the python executable of the same install
+// (PREFIX/lib/libpythonX.Y.so -> PREFIX/bin/pythonX.Y), for fair comparisons.
+static void bench_find_python(char *libpython, size_t lib_len, char *python, size_t py_len) {
+    Dl_info info;
+    libpython[0] = '\0';
+    snprintf(python, py_len, "python3");
+    if (!dladdr((void *)Py_Initialize, &info) || !info.dli_fname) return;
+    char resolved[PATH_MAX];
+    if (!realpath(info.dli_fname, resolved)) return;
+    snprintf(libpython, lib_len, "%s", resolved);
+    char *slash = strrchr(resolved, '/');
+    if (!slash) return;
+    *slash = '\0';
+    slash = strrchr(resolved, '/');
+    if (!slash || strcmp(slash, "/lib") != 0) return;
+    *slash = '\0';
+    char candidate[PATH_MAX];
+    int n = snprintf(candidate, sizeof(candidate), "%s/bin/python%d.%d", resolved, PY_MAJOR_VERSION, PY_MINOR_VERSION);
+    if (n < (int)sizeof(candidate) && (size_t)n < py_len && access(candidate, X_OK) == 0) memcpy(python, candidate, (size_t)n + 1);
+}
+
+#define BENCH_BUNDLE_MODULES 200
+
+// Scripts of the startup corpus. Modules a script imports sit next to it, so
+// python3 and older pycc builds find them through PYTHONPATH; the current
+// build also embeds them with --module.
+static const char *const BENCH_STARTUP_SCRIPTS[] = { "hello", "imports", "bigmodule", "bundle" };
+
+static int bench_write_corpus(const char *dir) {
+    int r = bench_write_file(dir, "hello.py", "print('hello')\n");
+    r |= bench_write_file(dir, "imports.py",
+        "import argparse, asyncio, base64, collections, dataclasses, datetime, decimal, email.parser\n"
+        "import http.client, json, logging, pathlib, re, subprocess, tempfile, typing, unittest\n"
+        "import urllib.request, uuid, xml.etree.ElementTree, zipfile\n"
+        "print('imports')\n");
+    r |= bench_write_file(dir, "bigmodule.py", "import big\nprint(big.f0(1) + big.TABLE[0])\n");
+    r |= bench_write_file(dir, "bundle.py",
+        "import importlib\n"
+        "for i in range(" Py_STRINGIFY(BENCH_BUNDLE_MODULES) "):\n"
+        "    importlib.import_module('m%d' % i)\n"
+        "print('bundle')\n");
+
+    char path[PATH_MAX];
+    if (bench_path(path, sizeof(path), "%s/big.py", dir) != 0) return 1;
+    FILE *f = fopen(path, "w");
+    if (!f) return 1;
+    for (int i = 0; i < 4000; ++i) fprintf(f, "def f%d(x):\n    return x * %d + len('%08d')\n\n", i, i, i);
+    fprintf(f, "TABLE = [");
+    for (int i = 0; i < 20000; ++i) fprintf(f, "%d, ", i * 7);
+    fprintf(f, "]\n");
+    r |= fclose(f) != 0;
+
+    for (int i = 0; i < BENCH_BUNDLE_MODULES; ++i) {
+        char name[32], text[256];
+        snprintf(name, sizeof(name), "m%d.py", i);
+        snprintf(text, sizeof(text), "VALUE = %d\n\ndef get():\n    return VALUE\n\nclass C%d:\n    x = %d\n", i, i, i);
+        r |= bench_write_file(dir, name, text);
+    }
+    return r;
+}
+
+// argv for building `script` with `pycc`; embed adds the corpus modules.
+static int bench_build(const char *pycc, const char *dir, const char *script, const char *out, int embed) {
+    char src[PATH_MAX], mod[BENCH_BUNDLE_MODULES + 1][PATH_MAX + 16];
+    char *argv[8 + 2 * (BENCH_BUNDLE_MODULES + 1)];
+    int n = 0;
+    if (bench_path(src, sizeof(src), "%s/%s.py", dir, script) != 0) return 1;
+    argv[n++] = (char *)pycc;
+    argv[n++] = "--build";
+    argv[n++] = src;
+    argv[n++] = (char *)out;
+    if (embed && strcmp(script, "bigmodule") == 0) {
+        if (bench_path(mod[0], sizeof(mod[0]), "big=%s/big.py", dir) != 0) return 1;
+        argv[n++] = "--module";
+        argv[n++] = mod[0];
+    } else if (embed && strcmp(script, "bundle") == 0) {
+        for (int i = 0; i < BENCH_BUNDLE_MODULES; ++i) {
+            if (bench_path(mod[i], sizeof(mod[i]), "m%d=%s/m%d.py", i, dir, i) != 0) return 1;
+            argv[n++] = "--module";
+            argv[n++] = mod[i];
+        }
+    }
+    argv[n] = NULL;
+    return bench_run(argv, NULL, 0) < 0;
+}
+
+struct bench_variant {
+    const char *label;
+    char *argv[4];
+    const char *cold_files[4];
+    int traced;           // a pycc build that understands PYCC_TRACE
+};
+
+static void bench_report(const char *script, const char *label, const char *mode, struct samples *s) {
+    if (s->n == 0) {
+        printf("%-10s %-9s %-5s %10s\n", script, label, mode, "failed");
+        return;
+    }
+    double p50 = samples_pct(s, 50), p95 = samples_pct(s, 95), p99 = samples_pct(s, 99);
+    printf("%-10s %-9s %-5s %10.2f %10.2f %10.2f %6zu\n", script, label, mode, p50, p95, p99, s->n);
+}
+
+// Phase times (ms) from the PYCC_TRACE report in a run's stderr; phases not
+// reported are 0. Returns how many were found.
+static int bench_parse_phases(const char *err, double ms[PHASE_COUNT]) {
+    int found = 0;
+    for (int i = 0; i < PHASE_COUNT; ++i) {
+        char key[32];
+        snprintf(key, sizeof(key), "phase %s ", PHASE_NAMES[i]);
+        const char *p = strstr(err, key);
+        ms[i] = p ? atof(p + strlen(key)) : 0;
+        found += p != NULL;
+    }
+    return found;
+}
+
+// Average per-phase times from PYCC_TRACE runs of a pycc binary.
+static void bench_phases(char *const argv[], int runs) {
+    double sum[PHASE_COUNT] = {0};
+    int ok = 0;
+    char *err = malloc(65536);
+    if (!err) return;
+    setenv("PYCC_TRACE", "1", 1);
+    for (int r = 0; r < runs; ++r) {
+        double ms[PHASE_COUNT];
+        if (bench_run(argv, err, 65536) < 0) continue;
+        ++ok;
+        bench_parse_phases(err, ms);
+        for (int i = 0; i < PHASE_COUNT; ++i) sum[i] += ms[i];
+    }
+    unsetenv("PYCC_TRACE");
+    free(err);
+    if (!ok) return;
+    printf("%-10s %-9s phases:", "", "");
+    for (int i = 0; i < PHASE_COUNT; ++i) printf(" %s %.2f", PHASE_NAMES[i], sum[i] / ok);
+    printf(" ms\n");
+}
+
+static int bench_startup_mode(int argc, char **argv) {
+    long warm = 30, cold = 5;
+    const char *baseline = NULL, *python_override = NULL, *keep = NULL;
+    for (int i = 2; i < argc; ++i) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) warm = atol(argv[++i]);
+        else if (strcmp(argv[i], "--cold") == 0 && i + 1 < argc) cold = atol(argv[++i]);
+        else if (strcmp(argv[i], "--baseline") == 0 && i + 1 < argc) baseline = argv[++i];
+        else if (strcmp(argv[i], "--python") == 0 && i + 1 < argc) python_override = argv[++i];
+        else if (strcmp(argv[i], "--keep") == 0 && i + 1 < argc) keep = argv[++i];
+        else {
+            fprintf(stderr, "Usage: %s bench-startup [-n warm_runs] [--cold runs] [--baseline old_pycc]\n"
+                            "       [--python python3] [--keep dir]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    char self[4096], libpython[PATH_MAX], python[PATH_MAX], dir[PATH_MAX];
+    if (bench_corpus_dir(self, sizeof(self), dir, sizeof(dir), keep) != 0) return 1;
+    bench_find_python(libpython, sizeof(libpython), python, sizeof(python));
+    if (python_override) snprintf(python, sizeof(python), "%s", python_override);
+    if (bench_write_corpus(dir) != 0) { fprintf(stderr, "Cannot write corpus in %s\n", dir); return 1; }
+    setenv("PYTHONPATH", dir, 1);
+    // python3 gets its bytecode cache, as it would in normal use
+    unsetenv("PYTHONDONTWRITEBYTECODE");
+
+    printf("corpus %s, python %s, %ld warm / %ld cold runs\n", dir, python, warm, cold);
+    printf("%-10s %-9s %-5s %10s %10s %10s %6s\n", "script", "variant", "cache", "p50(ms)", "p95(ms)", "p99(ms)", "n");
+    const char *cold_method = NULL;
+    int rc = 0;
+    for (size_t s = 0; s < sizeof(BENCH_STARTUP_SCRIPTS) / sizeof(BENCH_STARTUP_SCRIPTS[0]); ++s) {
+        const char *script = BENCH_STARTUP_SCRIPTS[s];
+        char bin[PATH_MAX], old_bin[PATH_MAX], src[PATH_MAX];
+        if (bench_path(bin, sizeof(bin), "%s/%s.pycc", dir, script) != 0 ||
+            bench_path(old_bin, sizeof(old_bin), "%s/%s.baseline", dir, script) != 0 ||
+            bench_path(src, sizeof(src), "%s/%s.py", dir, script) != 0) {
+            rc = 1;
+            break;
+        }
+
+        struct bench_variant variants[3];
+        int nv = 0;
+        if (bench_build(self, dir, script, bin, 1) == 0) {
+            variants[nv++] = (struct bench_variant){ "pycc", { bin, NULL }, { bin, libpython, NULL }, 1 };
+        } else {
+            fprintf(stderr, "[!] build of %s failed\n", script);
+            rc = 1;
+        }
+        if (baseline && bench_build(baseline, dir, script, old_bin, 0) == 0) {
+            variants[nv++] = (struct bench_variant){ "baseline", { old_bin, NULL }, { old_bin, libpython, NULL }, 0 };
+        }
+        variants[nv++] = (struct bench_variant){ "python3", { python, src, NULL }, { python, src, libpython, NULL }, 0 };
+
+        for (int v = 0; v < nv; ++v) {
+            struct samples ws = {0}, cs = {0};
+            bench_run(variants[v].argv, NULL, 0);   // warm-up
+            for (long i = 0; i < warm; ++i) {
+                int64_t t = bench_run(variants[v].argv, NULL, 0);
+                if (t >= 0) samples_add(&ws, (double)t / 1e6);
+            }
+            for (long i = 0; i < cold; ++i) {
+                cold_method = bench_drop_caches(variants[v].cold_files, 4);
+                int64_t t = bench_run(variants[v].argv, NULL, 0);
+                if (t >= 0) samples_add(&cs, (double)t / 1e6);
+            }
+            bench_report(script, variants[v].label, "warm", &ws);
+            if (cold > 0) bench_report(script, variants[v].label, "cold", &cs);
+            if (variants[v].traced) bench_phases(variants[v].argv, warm < 10 ? (int)warm : 10);
+            samples_free(&ws);
+            samples_free(&cs);
+        }
+    }
+    if (cold_method) printf("cold runs evicted caches with %s%s\n", cold_method,
+                            strcmp(cold_method, "fadvise") == 0 ? " (binary, script and libpython only; run as root for drop_caches)" : "");
+    if (!keep) bench_remove_dir(dir);
+    return rc;
+}
+
+// Build-throughput corpus (pycc bench-build): main.py, `modules` small
+// modules m0..m<modules-1> and, when payload > 0, data.py holding a string
+// constant of about `payload` bytes (pseudo-random hex, so it does not
+// compress away).
+static int bench_write_project(const char *dir, long modules, long long payload) {
+    int r = bench_write_file(dir, "main.py", "import m0\nprint('main', m0.get())\n");
+    for (long i = 0; i < modules; ++i) {
+        char name[32], text[256];
+        snprintf(name, sizeof(name), "m%ld.py", i);
+        snprintf(text, sizeof(text), "VALUE = %ld\n\ndef get():\n    return VALUE\n\nclass C%ld:\n    x = %ld\n", i, i, i);
+        r |= bench_write_file(dir, name, text);
+    }
+    if (payload <= 0) return r;
+
+    char path[PATH_MAX];
+    if (bench_path(path, sizeof(path), "%s/data.py", dir) != 0) return 1;
+    FILE *f = fopen(path, "w");
+    if (!f) return 1;
+    uint64_t x = 0x9e3779b97f4a7c15ull;
+    char line[4100];
+    fputs("DATA = (\n", f);
+    for (long long left = payload; left > 0; left -= 4096) {
+        int n = left < 4096 ? (int)left : 4096;
+        for (int i = 0; i < n; ++i) {
+            x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+            line[i] = "0123456789abcdef"[x & 15];
+        }
+        line[n] = '\0';
+        fprintf(f, "'%s'\n", line);
+    }
+    fputs(")\n", f);
+    return r | (fclose(f) != 0);
+}
+
+static void bench_argv_free(char **argv) {
+    if (!argv) return;
+    for (char **a = argv; *a; ++a) free(*a);
+    free(argv);
+}
+
+// Append a copy of arg to the NULL-terminated argv; 1 if out of memory.
+static int bench_argv_push(char **argv, size_t *n, const char *arg) {
+    argv[*n] = strdup(arg);
+    if (!argv[*n]) return 1;
+    ++*n;
+    return 0;
+}
+
+// argv for building dir/main.py into out with every project module embedded.
+static char **bench_project_argv(const char *pycc, const char *dir, long modules, int data, const char *out) {
+    size_t cap = 5 + 2 * ((size_t)modules + 1);
+    char **argv = calloc(cap, sizeof(char *));
+    if (!argv) return NULL;
+    char buf[PATH_MAX + 32];
+    size_t n = 0;
+    int bad = bench_argv_push(argv, &n, pycc) || bench_argv_push(argv, &n, "--build") ||
+              bench_path(buf, sizeof(buf), "%s/main.py", dir) || bench_argv_push(argv, &n, buf) ||
+              bench_argv_push(argv, &n, out);
+    for (long i = 0; !bad && i <= modules; ++i) {
+        if (i == modules && !data) break;
+        bad = (i == modules ? bench_path(buf, sizeof(buf), "data=%s/data.py", dir)
+                            : bench_path(buf, sizeof(buf), "m%ld=%s/m%ld.py", i, dir, i)) ||
+              bench_argv_push(argv, &n, "--module") || bench_argv_push(argv, &n, buf);
+    }
+    if (bad) { bench_argv_free(argv); return NULL; }
+    return argv;
+}
+
+struct bench_build_stats {
+    struct samples wall, cpu;
+    long maxrss_kb;
+    uint64_t rchar, wchar;
+    uint64_t source_bytes;      // per build: script + every NAME=PATH file
+    size_t builds;
+};
+
+// Bytes of source a build command reads: the script and each
+// --module/--entry/--resource file. Counted here because the builder's
+// io_uring reads do not show up in rchar.
+static uint64_t bench_source_bytes(char *const argv[]) {
+    uint64_t total = 0;
+    struct stat st;
+    if (stat(argv[2], &st) == 0) total += (uint64_t)st.st_size;
+    for (int i = 4; argv[i] && argv[i + 1]; ++i) {
+        if (strcmp(argv[i], "--module") != 0 && strcmp(argv[i], "--entry") != 0 && strcmp(argv[i], "--resource") != 0) continue;
+        const char *eq = strchr(argv[++i], '=');
+        if (eq && stat(eq + 1, &st) == 0) total += (uint64_t)st.st_size;
+    }
+    return total;
+}
+
+static void bench_build_note(struct bench_build_stats *st, const struct bench_usage *u) {
+    samples_add(&st->wall, (double)u->wall_ns / 1e6);
+    samples_add(&st->cpu, u->cpu_ms);
+    if (u->maxrss_kb > st->maxrss_kb) st->maxrss_kb = u->maxrss_kb;
+    st->rchar += u->rchar;
+    st->wchar += u->wchar;
+    st->builds++;
+}
+
+// One result row, on stdout and (when json is open) as a JSON object.
+// batch_ms > 0 marks a batch row: the wall column is the whole batch.
+static void bench_build_report(const char *label, long modules, long long payload, const char *scenario,
+                               struct bench_build_stats *st, double batch_ms, FILE *json, int *first) {
+    if (st->builds == 0) {
+        printf("%-16s %-11s %10s\n", label, scenario, "failed");
+        return;
+    }
+    double wall = batch_ms > 0 ? batch_ms : samples_pct(&st->wall, 50);
+    double cpu = samples_pct(&st->cpu, 50);
+    double rd = (double)st->rchar / (double)st->builds, wr = (double)st->wchar / (double)st->builds;
+    double rate = batch_ms > 0 ? (double)st->builds * 1e3 / batch_ms : 1e3 / wall;
+    printf("%-16s %-11s %10.1f %10.1f %9.1f %10.2f %10.2f %10.2f %9.2f %5zu\n", label, scenario, wall, cpu,
+           (double)st->maxrss_kb / 1024.0, (double)st->source_bytes / 1048576.0, rd / 1048576.0, wr / 1048576.0,
+           rate, st->builds);
+    if (!json) return;
+    fprintf(json, "%s  {\"case\": \"%s\", \"modules\": %ld, \"payload_bytes\": %lld, \"scenario\": \"%s\", "
+                  "\"python\": \"%d.%d\", \"wall_ms\": %.3f, \"cpu_ms\": %.3f, \"peak_rss_kb\": %ld, "
+                  "\"source_bytes\": %llu, \"read_bytes\": %.0f, \"write_bytes\": %.0f, \"builds_per_s\": %.3f, "
+                  "\"builds\": %zu}",
+            *first ? "" : ",\n", label, modules, payload, scenario, PY_MAJOR_VERSION, PY_MINOR_VERSION,
+            wall, cpu, st->maxrss_kb, (unsigned long long)st->source_bytes, rd, wr, rate, st->builds);
+    *first = 0;
+}
+
+// "1,10,1K,100M" -> values; K/M/G are powers of 1024. Returns the count.
+static int bench_parse_list(const char *text, long long *out, int max) {
+    int n = 0;
+    const char *p = text;
+    while (*p && n < max) {
+        char *end;
+        long long v = strtoll(p, &end, 10);
+        if (end == p) return -1;
+        if (*end == 'K' || *end == 'k') { v <<= 10; ++end; }
+        else if (*end == 'M' || *end == 'm') { v <<= 20; ++end; }
+        else if (*end == 'G' || *end == 'g') { v <<= 30; ++end; }
+        out[n++] = v;
+        if (*end == ',') ++end;
+        else if (*end) return -1;
+        p = end;
+    }
+    return n;
+}
+
+// Batch builds write to <out>.<i>.
+struct bench_batch_ctx {
+    char **argv;
+    const char *out;
+    char (*outs)[PATH_MAX + 16];
+};
+
+static void bench_batch_prepare(long i, void *ctx) {
+    struct bench_batch_ctx *b = ctx;
+    snprintf(b->outs[i], sizeof(b->outs[i]), "%s.%ld", b->out, i);
+    b->argv[3] = b->outs[i];
+}
+
+// Build scenarios for one project: `runs` clean builds, `runs` rebuilds
+// after one module changed, and a batch of `batch` builds into separate
+// outputs with up to `jobs` running at once.
+static int bench_build_case(const char *pycc, const char *dir, long modules, long long payload, long runs,
+                            long jobs, long batch, FILE *json, int *first) {
+    char label[48], out[PATH_MAX];
+    if (payload > 0) snprintf(label, sizeof(label), "payload=%lldK", payload >> 10);
+    else snprintf(label, sizeof(label), "modules=%ld", modules);
+    if (bench_write_project(dir, modules, payload) != 0) {
+        fprintf(stderr, "[!] cannot write project in %s\n", dir);
+        return 1;
+    }
+    if (bench_path(out, sizeof(out), "%s/out.bin", dir) != 0) return 1;
+    char **argv = bench_project_argv(pycc, dir, modules, payload > 0, out);
+    if (!argv) return 1;
+
+    int rc = 0;
+    struct bench_usage u;
+    struct bench_build_stats clean = {0}, incr = {0}, par = {0};
+    bench_run(argv, NULL, 0);   // warm-up: page cache holds the sources
+    for (long i = 0; i < runs; ++i) {
+        unlink(out);
+        if (bench_run_usage(argv, NULL, 0, &u) >= 0) bench_build_note(&clean, &u);
+    }
+    clean.source_bytes = bench_source_bytes(argv);
+    bench_build_report(label, modules, payload, "clean", &clean, 0, json, first);
+
+    char last[32], text[256];
+    snprintf(last, sizeof(last), "m%ld.py", modules - 1);
+    for (long i = 0; i < runs; ++i) {
+        snprintf(text, sizeof(text), "VALUE = %ld\n\ndef get():\n    return VALUE + %ld\n", modules - 1, i + 1);
+        if (bench_write_file(dir, last, text) != 0) break;
+        if (bench_run_usage(argv, NULL, 0, &u) >= 0) bench_build_note(&incr, &u);
+    }
+    incr.source_bytes = bench_source_bytes(argv);
+    bench_build_report(label, modules, payload, "incremental", &incr, 0, json, first);
+
+    // batch: argv[3] is the output path; each build gets its own
+    char *out_arg = argv[3];
+    struct bench_batch_ctx bctx = { argv, out, calloc((size_t)batch, sizeof(*bctx.outs)) };
+    struct bench_usage *usage = calloc((size_t)batch, sizeof(*usage));
+    char *ok = malloc((size_t)batch);
+    if (bctx.outs && usage && ok) {
+        double total = bench_run_parallel(argv, batch, jobs, bench_batch_prepare, &bctx, usage, ok);
+        for (long i = 0; i < batch; ++i) {
+            if (ok[i]) bench_build_note(&par, &usage[i]);
+        }
+        char scenario[32];
+        snprintf(scenario, sizeof(scenario), "batch-j%ld", jobs);
+        par.source_bytes = bench_source_bytes(argv);
+        bench_build_report(label, modules, payload, scenario, &par, total, json, first);
+        for (long i = 0; i < batch; ++i) {
+            if (bctx.outs[i][0]) unlink(bctx.outs[i]);
+        }
+    } else {
+        rc = 1;
+    }
+    argv[3] = out_arg;
+    if (par.builds < (size_t)batch || clean.builds < (size_t)runs || incr.builds < (size_t)runs) rc = 1;
+    free(bctx.outs);
+    free(usage);
+    free(ok);
+    samples_free(&clean.wall); samples_free(&clean.cpu);
+    samples_free(&incr.wall); samples_free(&incr.cpu);
+    samples_free(&par.wall); samples_free(&par.cpu);
+    bench_argv_free(argv);
+    return rc;
+}
+
+static int bench_build_mode(int argc, char **argv) {
+    long runs = 5, jobs = sysconf(_SC_NPROCESSORS_ONLN), batch = 0;
+    const char *modules_arg = "1,10,100,1000,10000", *payload_arg = "1K,1M,100M";
+    const char *pycc_override = NULL, *json_path = NULL, *keep = NULL;
+    for (int i = 2; i < argc; ++i) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) runs = atol(argv[++i]);
+        else if (strcmp(argv[i], "--modules") == 0 && i + 1 < argc) modules_arg = argv[++i];
+        else if (strcmp(argv[i], "--payload") == 0 && i + 1 < argc) payload_arg = argv[++i];
+        else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) jobs = atol(argv[++i]);
+        else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc) batch = atol(argv[++i]);
+        else if (strcmp(argv[i], "--pycc") == 0 && i + 1 < argc) pycc_override = argv[++i];
+        else if (strcmp(argv[i], "--json") == 0 && i + 1 < argc) json_path = argv[++i];
+        else if (strcmp(argv[i], "--keep") == 0 && i + 1 < argc) keep = argv[++i];
+        else {
+            fprintf(stderr, "Usage: %s bench-build [-n runs] [--modules 1,10,...] [--payload 1K,1M,...]\n"
+                            "       [-j jobs] [--batch builds] [--pycc other_pycc] [--json out.json] [--keep dir]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (jobs < 1) jobs = 1;
+    if (batch < 1) batch = 4 * jobs;
+    if (runs < 1) runs = 1;
+    long long module_counts[32], payloads[32];
+    int nm = bench_parse_list(modules_arg, module_counts, 32);
+    int np = bench_parse_list(payload_arg, payloads, 32);
+    if (nm < 0 || np < 0) { fprintf(stderr, "Bad --modules or --payload list\n"); return 1; }
+
+    char self[4096], dir[PATH_MAX];
+    if (bench_corpus_dir(self, sizeof(self), dir, sizeof(dir), keep) != 0) return 1;
+    const char *pycc = pycc_override ? pycc_override : self;
+    FILE *json;
+    if (bench_json_open(json_path, &json) != 0) return 1;
+
+    printf("corpus %s, pycc %s, %ld runs, batch %ld with -j%ld\n", dir, pycc, runs, batch, jobs);
+    printf("%-16s %-11s %10s %10s %9s %10s %10s %10s %9s %5s\n", "case", "scenario", "wall(ms)", "cpu(ms)",
+           "rss(MB)", "source(MB)", "read(MB)", "write(MB)", "builds/s", "n");
+    int rc = 0, first = 1;
+    for (int c = 0; c < nm + np; ++c) {
+        long modules = c < nm ? (long)module_counts[c] : 1;
+        long long payload = c < nm ? 0 : payloads[c - nm];
+        if (modules < 1) modules = 1;
+        char case_dir[PATH_MAX];
+        if (bench_path(case_dir, sizeof(case_dir), "%s/case%d", dir, c) != 0) { rc = 1; break; }
+        mkdir(case_dir, 0755);
+        rc |= bench_build_case(pycc, case_dir, modules, payload, runs, jobs, batch, json, &first);
+        if (!keep) bench_remove_dir(case_dir);
+    }
+    if (bench_json_close(json) != 0) rc = 1;
+    if (!keep) bench_remove_dir(dir);
+    return rc;
+}
+
+// Memory/size corpus (pycc bench-memory): tools that import their share of
+// the startup corpus, report "ready" and then wait for stdin to close, so
+// running instances can be measured. In the deep-frozen mode they freeze the
+// GC heap once their imports are done, as pycc.gc_freeze() is meant to be used.
+static const char *const BENCH_MEMORY_TOOLS[] = { "tool_imports", "tool_big", "tool_bundle" };
+#define BENCH_MEMORY_NTOOLS 3
+
+static int bench_write_memory_corpus(const char *dir) {
+    static const char wait[] = "import os, sys\n"
+                               "if os.environ.get('PYCC_BENCH_GC_FREEZE'):\n"
+                               "    import pycc\n"
+                               "    pycc.gc_freeze()\n"
+                               "sys.stdout.write('ready\\n')\nsys.stdout.flush()\nsys.stdin.read()\n";
+    char text[1024];
+    int r = bench_write_corpus(dir);
+    snprintf(text, sizeof(text),
+             "import argparse, asyncio, base64, collections, dataclasses, datetime, decimal, email.parser\n"
+             "import http.client, json, logging, pathlib, re, subprocess, tempfile, typing, unittest\n"
+             "import urllib.request, uuid, xml.etree.ElementTree, zipfile\n%s", wait);
+    r |= bench_write_file(dir, "tool_imports.py", text);
+    snprintf(text, sizeof(text), "import big\n%s", wait);
+    r |= bench_write_file(dir, "tool_big.py", text);
+    snprintf(text, sizeof(text), "import importlib\nfor i in range(" Py_STRINGIFY(BENCH_BUNDLE_MODULES) "):\n"
+             "    importlib.import_module('m%%d' %% i)\n%s", wait);
+    r |= bench_write_file(dir, "tool_bundle.py", text);
+    return r;
+}
+
+// Build modes compared by bench-memory.
+enum {
+    MEM_RAW,          // one binary per tool, payload as built by default
+    MEM_COMPRESSED,   // --compress
+    MEM_FROZEN,       // --immortalize (3.12+), heap frozen after the imports
+    MEM_STRIPPED,     // stub without its symbol table
+    MEM_MULTICALL,    // one binary, every tool an --entry
+    MEM_MODES
+};
+static const char *const MEM_MODE_NAMES[MEM_MODES] = { "raw", "compressed", "deep-frozen", "stripped", "multi-call" };
+// code.immortal is a no-op on runtimes without immortal objects
+#if defined(_Py_IMMORTAL_REFCNT) && !defined(Py_GIL_DISABLED)
+#define BENCH_IMMORTALIZE 1
+#else
+#define BENCH_IMMORTALIZE 0
+#endif
+
+// Append the --module options tool t needs (all tools for t < 0) to argv.
+// Returns the new argc, or -1 if a module path does not fit.
+static int bench_memory_modules(const char *dir, int t, char **argv, int n, char mod[][PATH_MAX + 16]) {
+    if (t < 0 || t == 1) {
+        if (bench_path(mod[BENCH_BUNDLE_MODULES], PATH_MAX + 16, "big=%s/big.py", dir) != 0) return -1;
+        argv[n++] = "--module";
+        argv[n++] = mod[BENCH_BUNDLE_MODULES];
+    }
+    if (t < 0 || t == 2) {
+        for (int i = 0; i < BENCH_BUNDLE_MODULES; ++i) {
+            if (bench_path(mod[i], PATH_MAX + 16, "m%d=%s/m%d.py", i, dir, i) != 0) return -1;
+            argv[n++] = "--module";
+            argv[n++] = mod[i];
+        }
+    }
+    return n;
+}
+
+// Build the tools for one mode. out[t] gets the binary of tool t and argv1[t]
+// the subcommand that selects it (multi-call), or "". Separate binaries only
+// embed the modules their tool imports; the multi-call binary has them all.
+static int bench_memory_build(const char *pycc, const char *dir, int mode, char out[][PATH_MAX], char argv1[][32]) {
+    static char mod[BENCH_BUNDLE_MODULES + 1][PATH_MAX + 16];
+    char *argv[16 + 2 * (BENCH_BUNDLE_MODULES + 1) + 2 * BENCH_MEMORY_NTOOLS];
+    char script[PATH_MAX], entries[BENCH_MEMORY_NTOOLS][PATH_MAX + 48];
+    int rc = 0;
+    for (int t = 0; rc == 0 && t < BENCH_MEMORY_NTOOLS; ++t) {
+        int n = 0;
+        argv[n++] = (char *)pycc;
+        argv[n++] = "--build";
+        argv[n++] = script;
+        argv[n++] = out[t];
+        if (mode == MEM_COMPRESSED) argv[n++] = "--compress";
+        if (mode == MEM_FROZEN && BENCH_IMMORTALIZE) argv[n++] = "--immortalize";
+        argv1[t][0] = '\0';
+        if (mode == MEM_MULTICALL) {
+            // one build; every tool is an entry of the same binary
+            if (bench_path(script, sizeof(script), "%s/hello.py", dir) != 0) return 1;
+            for (int e = 0; e < BENCH_MEMORY_NTOOLS; ++e) {
+                if (bench_path(out[e], PATH_MAX, "%s/tools.%s", dir, MEM_MODE_NAMES[mode]) != 0 ||
+                    bench_path(entries[e], sizeof(entries[e]), "%s=%s/%s.py", BENCH_MEMORY_TOOLS[e], dir,
+                               BENCH_MEMORY_TOOLS[e]) != 0) {
+                    return 1;
+                }
+                snprintf(argv1[e], 32, "%s", BENCH_MEMORY_TOOLS[e]);
+                argv[n++] = "--entry";
+                argv[n++] = entries[e];
+            }
+            n = bench_memory_modules(dir, -1, argv, n, mod);
+            if (n < 0) return 1;
+            argv[n] = NULL;
+            return bench_run(argv, NULL, 0) < 0;
+        }
+        if (bench_path(script, sizeof(script), "%s/%s.py", dir, BENCH_MEMORY_TOOLS[t]) != 0 ||
+            bench_path(out[t], PATH_MAX, "%s/%s.%s", dir, BENCH_MEMORY_TOOLS[t], MEM_MODE_NAMES[mode]) != 0) {
+            return 1;
+        }
+        n = bench_memory_modules(dir, t, argv, n, mod);
+        if (n < 0) return 1;
+        argv[n] = NULL;
+        rc = bench_run(argv, NULL, 0) < 0;
+    }
+    return rc;
+}
+
+// Page-cache pages of a file that are resident, in KiB.
+static long bench_cached_kb(const char *path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    struct stat st;
+    long kb = -1;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        long page = sysconf(_SC_PAGESIZE);
+        size_t pages = ((size_t)st.st_size + (size_t)page - 1) / (size_t)page;
+        void *m = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        unsigned char *vec = malloc(pages);
+        if (m != MAP_FAILED && vec && mincore(m, (size_t)st.st_size, vec) == 0) {
+            size_t resident = 0;
+            for (size_t i = 0; i < pages; ++i) resident += vec[i] & 1;
+            kb = (long)(resident * (size_t)page / 1024);
+        }
+        free(vec);
+        if (m != MAP_FAILED) munmap(m, (size_t)st.st_size);
+    }
+    close(fd);
+    return kb;
+}
+
+// A running tool instance: stdin is held open until bench_instance_stop.
+struct bench_instance {
+    pid_t pid;
+    int in_fd;
+};
+
+// Start argv and wait for its "ready" line. Returns 0 when it is ready.
+static int bench_instance_start(char *const argv[], struct bench_instance *inst) {
+    int in[2], out[2];
+    inst->pid = -1;
+    inst->in_fd = -1;
+    if (pipe2(in, O_CLOEXEC) != 0) return 1;
+    if (pipe2(out, O_CLOEXEC) != 0) { close(in[0]); close(in[1]); return 1; }
+    posix_spawn_file_actions_t fa;
+    posix_spawn_file_actions_init(&fa);
+    posix_spawn_file_actions_adddup2(&fa, in[0], STDIN_FILENO);
+    posix_spawn_file_actions_adddup2(&fa, out[1], STDOUT_FILENO);
+    posix_spawn_file_actions_addopen(&fa, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+    extern char **environ;
+    int sr = posix_spawnp(&inst->pid, argv[0], &fa, NULL, argv, environ);
+    posix_spawn_file_actions_destroy(&fa);
+    close(in[0]);
+    close(out[1]);
+    if (sr != 0) { inst->pid = -1; close(in[1]); close(out[0]); return 1; }
+    inst->in_fd = in[1];
+    char line[64];
+    size_t len = 0;
+    ssize_t n;
+    while (len < sizeof(line) - 1 && (n = read(out[0], line + len, sizeof(line) - 1 - len)) > 0) {
+        len += (size_t)n;
+        if (memchr(line, '\n', len)) break;
+    }
+    close(out[0]);
+    line[len] = '\0';
+    return strncmp(line, "ready", 5) == 0 ? 0 : 1;
+}
+
+static void bench_instance_stop(struct bench_instance *inst) {
+    if (inst->in_fd >= 0) close(inst->in_fd);
+    if (inst->pid > 0) {
+        int status;
+        while (waitpid(inst->pid, &status, 0) < 0 && errno == EINTR) {}
+    }
+    inst->pid = -1;
+    inst->in_fd = -1;
+}
+
+// Memory of a process in KiB: smaps_rollup totals and the VmHWM peak.
+struct bench_mem {
+    long rss, pss, shared, private_, peak;
+};
+
+static int bench_read_mem(pid_t pid, struct bench_mem *m) {
+    char path[64], line[256];
+    memset(m, 0, sizeof(*m));
+    snprintf(path, sizeof(path), "/proc/%d/smaps_rollup", (int)pid);
+    FILE *f = fopen(path, "r");
+    if (!f) return 1;
+    while (fgets(line, sizeof(line), f)) {
+        long v;
+        if (sscanf(line, "Rss: %ld", &v) == 1) m->rss = v;
+        else if (sscanf(line, "Pss: %ld", &v) == 1) m->pss = v;
+        else if (sscanf(line, "Shared_Clean: %ld", &v) == 1 || sscanf(line, "Shared_Dirty: %ld", &v) == 1) m->shared += v;
+        else if (sscanf(line, "Private_Clean: %ld", &v) == 1 || sscanf(line, "Private_Dirty: %ld", &v) == 1) m->private_ += v;
+    }
+    fclose(f);
+    snprintf(path, sizeof(path), "/proc/%d/status", (int)pid);
+    f = fopen(path, "r");
+    while (f && fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "VmHWM: %ld", &m->peak) == 1) break;
+    }
+    if (f) fclose(f);
+    return 0;
+}
+
+static int bench_memory_mode(int argc, char **argv) {
+    long instances = 8;
+    const char *json_path = NULL, *keep = NULL, *strip = "strip";
+    unsigned modes = (1u << MEM_MODES) - 1;
+    for (int i = 2; i < argc; ++i) {
+        if (strcmp(argv[i], "-N") == 0 && i + 1 < argc) instances = atol(argv[++i]);
+        else if (strcmp(argv[i], "--json") == 0 && i + 1 < argc) json_path = argv[++i];
+        else if (strcmp(argv[i], "--keep") == 0 && i + 1 < argc) keep = argv[++i];
+        else if (strcmp(argv[i], "--strip") == 0 && i + 1 < argc) strip = argv[++i];
+        else if (strcmp(argv[i], "--modes") == 0 && i + 1 < argc) {
+            modes = 0;
+            char list[256];
+            snprintf(list, sizeof(list), "%s", argv[++i]);
+            for (char *tok = strtok(list, ","); tok; tok = strtok(NULL, ",")) {
+                int m = 0;
+                while (m < MEM_MODES && strcmp(MEM_MODE_NAMES[m], tok) != 0) ++m;
+                if (m == MEM_MODES) { fprintf(stderr, "Unknown mode %s\n", tok); return 1; }
+                modes |= 1u << m;
+            }
+        } else {
+            fprintf(stderr, "Usage: %s bench-memory [-N instances] [--modes raw,compressed,deep-frozen,stripped,multi-call]\n"
+                            "       [--strip strip] [--json out.json] [--keep dir]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (instances < 1) instances = 1;
+
+    char self[4096], dir[PATH_MAX];
+    if (bench_corpus_dir(self, sizeof(self), dir, sizeof(dir), keep) != 0) return 1;
+    if (bench_write_memory_corpus(dir) != 0) { fprintf(stderr, "Cannot write corpus in %s\n", dir); return 1; }
+    FILE *json;
+    if (bench_json_open(json_path, &json) != 0) return 1;
+    // the stripped stub: a copy of this one without its symbol table
+    char stripped[PATH_MAX];
+    if (bench_path(stripped, sizeof(stripped), "%s/pycc.stripped", dir) != 0) modes &= ~(1u << MEM_STRIPPED);
+    if (modes & (1u << MEM_STRIPPED)) {
+        char *sargv[] = { (char *)strip, "-o", stripped, self, NULL };
+        if (bench_run(sargv, NULL, 0) < 0) {
+            fprintf(stderr, "[!] %s failed; skipping the stripped mode\n", strip);
+            modes &= ~(1u << MEM_STRIPPED);
+        }
+    }
+
+    printf("corpus %s, %ld concurrent instances; sizes and memory in KiB\n", dir, instances);
+    printf("%-11s %-13s %9s %9s %9s %9s %9s %9s %9s\n", "mode", "tool", "size", "cache", "private", "shared",
+           "peak", "privateN", "pssN");
+    int rc = 0, first = 1;
+    for (int mode = 0; mode < MEM_MODES; ++mode) {
+        if (!(modes & (1u << mode))) continue;
+        char out[BENCH_MEMORY_NTOOLS][PATH_MAX], argv1[BENCH_MEMORY_NTOOLS][32];
+        if (mode == MEM_FROZEN) {
+            setenv("PYCC_BENCH_GC_FREEZE", "1", 1);
+            if (!BENCH_IMMORTALIZE) {
+                printf("%-11s %-13s %9s (--immortalize needs Python 3.12+; gc.freeze only)\n", MEM_MODE_NAMES[mode],
+                       "immortalize", "n/a");
+            }
+        } else {
+            unsetenv("PYCC_BENCH_GC_FREEZE");
+        }
+        if (bench_memory_build(mode == MEM_STRIPPED ? stripped : self, dir, mode, out, argv1) != 0) {
+            printf("%-11s %-13s %9s\n", MEM_MODE_NAMES[mode], "", "failed");
+            rc = 1;
+            continue;
+        }
+        long total_size = 0;
+        for (int t = 0; t < BENCH_MEMORY_NTOOLS; ++t) {
+            struct stat st;
+            if ((t == 0 || strcmp(out[t], out[t - 1]) != 0) && stat(out[t], &st) == 0) total_size += (long)st.st_size;
+        }
+        for (int t = 0; t < BENCH_MEMORY_NTOOLS; ++t) {
+            char *targv[] = { out[t], argv1[t][0] ? argv1[t] : NULL, NULL };
+            struct stat st;
+            long size = stat(out[t], &st) == 0 ? (long)(st.st_size / 1024) : -1;
+            // page cache a single run pulls in, starting from an evicted binary
+            const char *files[] = { out[t] };
+            bench_drop_caches(files, 1);
+            struct bench_instance *insts = calloc((size_t)instances, sizeof(*insts));
+            if (!insts) { rc = 1; break; }
+            struct bench_mem one = {0}, m;
+            long cache = -1, privN = 0, pssN = 0, started = 0;
+            if (bench_instance_start(targv, &insts[0]) == 0) {
+                started = 1;
+                cache = bench_cached_kb(out[t]);
+                bench_read_mem(insts[0].pid, &one);
+                for (long i = 1; i < instances; ++i) {
+                    if (bench_instance_start(targv, &insts[i]) != 0) break;
+                    ++started;
+                }
+                for (long i = 0; i < started; ++i) {
+                    if (bench_read_mem(insts[i].pid, &m) == 0) { privN += m.private_; pssN += m.pss; }
+                }
+            }
+            for (long i = 0; i < started; ++i) bench_instance_stop(&insts[i]);
+            free(insts);
+            if (started < instances) {
+                printf("%-11s %-13s %9s\n", MEM_MODE_NAMES[mode], BENCH_MEMORY_TOOLS[t], "failed");
+                rc = 1;
+                continue;
+            }
+            printf("%-11s %-13s %9ld %9ld %9ld %9ld %9ld %9ld %9ld\n", MEM_MODE_NAMES[mode], BENCH_MEMORY_TOOLS[t],
+                   size, cache, one.private_, one.shared, one.peak, privN / instances, pssN / instances);
+            if (json) {
+                fprintf(json, "%s  {\"mode\": \"%s\", \"tool\": \"%s\", \"python\": \"%d.%d\", \"size_kb\": %ld, "
+                              "\"mode_size_kb\": %ld, \"page_cache_kb\": %ld, \"private_kb\": %ld, \"shared_kb\": %ld, "
+                              "\"peak_rss_kb\": %ld, \"instances\": %ld, \"private_kb_n\": %ld, \"pss_kb_n\": %ld, "
+                              "\"immortal_code\": %s}",
+                        first ? "" : ",\n", MEM_MODE_NAMES[mode], BENCH_MEMORY_TOOLS[t], PY_MAJOR_VERSION,
+                        PY_MINOR_VERSION, size, total_size / 1024, cache, one.private_, one.shared, one.peak,
+                        instances, privN / instances, pssN / instances,
+                        mode == MEM_FROZEN && BENCH_IMMORTALIZE ? "true" : "false");
+                first = 0;
+            }
+        }
+        printf("%-11s %-13s %9ld\n", MEM_MODE_NAMES[mode], "(all tools)", total_size / 1024);
+    }
+    unsetenv("PYCC_BENCH_GC_FREEZE");
+    if (bench_json_close(json) != 0) rc = 1;
+    if (!keep) bench_remove_dir(dir);
+    return rc;
+}
+
+// Syscall profile of one launch (bench-launch), counted with ptrace across
+// every thread and child process, so no strace is needed on the node.
+#define BENCH_MAX_SYSCALL 512
+struct bench_syscalls {
+    unsigned long count[BENCH_MAX_SYSCALL];
+    unsigned long errors[BENCH_MAX_SYSCALL];
+    unsigned long total;
+};
+
+// Names of the syscalls a launch commonly makes. Only the common ones exist on
+// every architecture; the legacy x86-64 calls (open, stat, dup2, ...) and the
+// newer ones are listed where the headers define them. Others print by number.
+#define BENCH_SC(x) { SYS_##x, #x }
+static const struct { long nr; const char *name; } BENCH_SYSCALL_NAMES[] = {
+    BENCH_SC(read), BENCH_SC(write), BENCH_SC(close), BENCH_SC(lseek), BENCH_SC(mprotect), BENCH_SC(munmap),
+    BENCH_SC(brk), BENCH_SC(rt_sigaction), BENCH_SC(rt_sigprocmask), BENCH_SC(ioctl), BENCH_SC(pread64),
+    BENCH_SC(pwrite64), BENCH_SC(pipe2), BENCH_SC(getpid), BENCH_SC(clone), BENCH_SC(execve), BENCH_SC(exit),
+    BENCH_SC(wait4), BENCH_SC(uname), BENCH_SC(fcntl), BENCH_SC(getcwd), BENCH_SC(getuid), BENCH_SC(getgid),
+    BENCH_SC(geteuid), BENCH_SC(getegid), BENCH_SC(sigaltstack), BENCH_SC(gettid), BENCH_SC(futex),
+    BENCH_SC(getdents64), BENCH_SC(set_tid_address), BENCH_SC(clock_gettime), BENCH_SC(exit_group),
+    BENCH_SC(openat), BENCH_SC(unlinkat), BENCH_SC(readlinkat), BENCH_SC(set_robust_list), BENCH_SC(prlimit64),
+    BENCH_SC(getrandom), BENCH_SC(sysinfo), BENCH_SC(madvise), BENCH_SC(mremap), BENCH_SC(sched_getaffinity),
+#ifdef SYS_open
+    BENCH_SC(open),
+#endif
+#ifdef SYS_access
+    BENCH_SC(access),
+#endif
+#ifdef SYS_stat
+    BENCH_SC(stat),
+#endif
+#ifdef SYS_lstat
+    BENCH_SC(lstat),
+#endif
+#ifdef SYS_fstat
+    BENCH_SC(fstat),
+#endif
+#ifdef SYS_newfstatat
+    BENCH_SC(newfstatat),
+#endif
+#ifdef SYS_dup2
+    BENCH_SC(dup2),
+#endif
+#ifdef SYS_rename
+    BENCH_SC(rename),
+#endif
+#ifdef SYS_unlink
+    BENCH_SC(unlink),
+#endif
+#ifdef SYS_readlink
+    BENCH_SC(readlink),
+#endif
+#ifdef SYS_getdents
+    BENCH_SC(getdents),
+#endif
+#ifdef SYS_arch_prctl
+    BENCH_SC(arch_prctl),
+#endif
+#ifdef SYS_mmap
+    BENCH_SC(mmap),
+#endif
+#ifdef SYS_fadvise64
+    BENCH_SC(fadvise64),
+#endif
+#ifdef SYS_statx
+    BENCH_SC(statx),
+#endif
+#ifdef SYS_rseq
+    BENCH_SC(rseq),
+#endif
+#ifdef SYS_clone3
+    BENCH_SC(clone3),
+#endif
+};
+
+static const char *bench_syscall_name(long nr, char *buf, size_t len) {
+    for (size_t i = 0; i < sizeof(BENCH_SYSCALL_NAMES) / sizeof(BENCH_SYSCALL_NAMES[0]); ++i) {
+        if (BENCH_SYSCALL_NAMES[i].nr == nr) return BENCH_SYSCALL_NAMES[i].name;
+    }
+    snprintf(buf, len, "syscall_%ld", nr);
+    return buf;
+}
+
+// Run argv once under ptrace and count syscall entries (and failed exits)
+// by number. Returns 0 if the traced launch exited 0.
+static int bench_syscall_profile(char *const argv[], struct bench_syscalls *sc) {
+    memset(sc, 0, sizeof(*sc));
+    pid_t pid = fork();
+    if (pid < 0) return -1;
+    if (pid == 0) {
+        int null = open("/dev/null", O_WRONLY);
+        if (null >= 0) { dup2(null, STDOUT_FILENO); dup2(null, STDERR_FILENO); }
+        if (ptrace(PTRACE_TRACEME, 0, NULL, NULL) != 0) _exit(127);
+        raise(SIGSTOP);
+        execvp(argv[0], argv);
+        _exit(127);
+    }
+    int status;
+    if (waitpid(pid, &status, 0) < 0 || !WIFSTOPPED(status)) return -1;
+    ptrace(PTRACE_SETOPTIONS, pid, NULL, (void *)(long)(PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACECLONE |
+           PTRACE_O_TRACEFORK | PTRACE_O_TRACEVFORK | PTRACE_O_EXITKILL));
+    ptrace(PTRACE_SYSCALL, pid, NULL, NULL);
+
+    // the syscall each traced thread is in, to attribute errors on exit
+    struct { pid_t tid; long nr; } inflight[256];
+    int ninflight = 0, rc = -1;
+    for (;;) {
+        pid_t t = waitpid(-1, &status, __WALL);
+        if (t < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        if (WIFEXITED(status) || WIFSIGNALED(status)) {
+            if (t == pid) rc = WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 0 : -1;
+            continue;
+        }
+        if (!WIFSTOPPED(status)) continue;
+        int sig = WSTOPSIG(status), deliver = 0;
+        if (sig == (SIGTRAP | 0x80)) {
+            struct __ptrace_syscall_info info;
+            if (ptrace(PTRACE_GET_SYSCALL_INFO, t, (void *)sizeof(info), &info) > 0) {
+                int slot = 0;
+                while (slot < ninflight && inflight[slot].tid != t) ++slot;
+                if (info.op == PTRACE_SYSCALL_INFO_ENTRY) {
+                    long nr = (long)info.entry.nr;
+                    if (nr >= 0 && nr < BENCH_MAX_SYSCALL) sc->count[nr]++;
+                    sc->total++;
+                    if (slot == ninflight && ninflight < (int)(sizeof(inflight) / sizeof(inflight[0]))) {
+                        inflight[ninflight++].tid = t;
+                    }
+                    if (slot < ninflight) inflight[slot].nr = nr;
+                } else if (info.op == PTRACE_SYSCALL_INFO_EXIT && slot < ninflight) {
+                    long nr = inflight[slot].nr;
+                    if (info.exit.is_error && nr >= 0 && nr < BENCH_MAX_SYSCALL) sc->errors[nr]++;
+                }
+            }
+        } else if (sig != SIGTRAP && sig != SIGSTOP) {
+            deliver = sig;   // a real signal for the tracee
+        }
+        ptrace(PTRACE_SYSCALL, t, NULL, (void *)(long)deliver);
+    }
+    return rc;
+}
+
+struct bench_sc_rank {
+    long nr;
+    unsigned long count;
+};
+
+static int cmp_sc_rank(const void *a, const void *b) {
+    const struct bench_sc_rank *x = a, *y = b;
+    return x->count < y->count ? 1 : x->count > y->count ? -1 : 0;
+}
+
+// Print the `top` most frequent syscalls of a profile.
+static void bench_print_syscalls(const char *label, const struct bench_syscalls *sc, int top, FILE *json, int *first) {
+    struct bench_sc_rank rank[BENCH_MAX_SYSCALL];
+    int n = 0;
+    for (long i = 0; i < BENCH_MAX_SYSCALL; ++i) {
+        if (sc->count[i]) rank[n++] = (struct bench_sc_rank){ i, sc->count[i] };
+    }
+    qsort(rank, (size_t)n, sizeof(rank[0]), cmp_sc_rank);
+    printf("%-9s syscalls per launch: %lu total\n", label, sc->total);
+    char buf[32];
+    for (int i = 0; i < n && i < top; ++i) {
+        printf("%-9s   %-20s %7lu %7lu errors\n", "", bench_syscall_name(rank[i].nr, buf, sizeof(buf)),
+               rank[i].count, sc->errors[rank[i].nr]);
+    }
+    if (!json) return;
+    fprintf(json, "%s  {\"load\": \"%s\", \"kind\": \"syscalls\", \"total\": %lu, \"syscalls\": {",
+            *first ? "" : ",\n", label, sc->total);
+    for (int i = 0; i < n; ++i) {
+        fprintf(json, "%s\"%s\": [%lu, %lu]", i ? ", " : "", bench_syscall_name(rank[i].nr, buf, sizeof(buf)),
+                rank[i].count, sc->errors[rank[i].nr]);
+    }
+    fputs("}}", json);
+    *first = 0;
+}
+
+// Runtime load paths compared by bench-launch (PYCC_LOAD values).
+static const char *const BENCH_LOAD_PATHS[] = { "mapped", "tempfile" };
+
+static int bench_launch_mode(int argc, char **argv) {
+    long launches = 200, ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    const char *levels_arg = NULL, *script = "hello", *json_path = NULL, *keep = NULL;
+    int profile = 1;
+    for (int i = 2; i < argc; ++i) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) launches = atol(argv[++i]);
+        else if (strcmp(argv[i], "-k") == 0 && i + 1 < argc) levels_arg = argv[++i];
+        else if (strcmp(argv[i], "--script") == 0 && i + 1 < argc) script = argv[++i];
+        else if (strcmp(argv[i], "--no-syscalls") == 0) profile = 0;
+        else if (strcmp(argv[i], "--json") == 0 && i + 1 < argc) json_path = argv[++i];
+        else if (strcmp(argv[i], "--keep") == 0 && i + 1 < argc) keep = argv[++i];
+        else {
+            fprintf(stderr, "Usage: %s bench-launch [-n launches] [-k 1,2,4,...] [--script hello|imports|bigmodule|bundle]\n"
+                            "       [--no-syscalls] [--json out.json] [--keep dir]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (launches < 1) launches = 1;
+    // default concurrency: powers of two up to 4x the cores
+    long long levels[32];
+    int nl = 0;
+    if (levels_arg) {
+        nl = bench_parse_list(levels_arg, levels, 32);
+        if (nl <= 0) { fprintf(stderr, "Bad -k list\n"); return 1; }
+    } else {
+        for (long k = 1; nl < 32; k *= 2) {
+            levels[nl++] = k < 4 * ncpu ? k : 4 * ncpu;
+            if (k >= 4 * ncpu) break;
+        }
+    }
+    size_t s = 0;
+    while (s < sizeof(BENCH_STARTUP_SCRIPTS) / sizeof(BENCH_STARTUP_SCRIPTS[0]) && strcmp(BENCH_STARTUP_SCRIPTS[s], script) != 0) ++s;
+    if (s == sizeof(BENCH_STARTUP_SCRIPTS) / sizeof(BENCH_STARTUP_SCRIPTS[0])) { fprintf(stderr, "Unknown script %s\n", script); return 1; }
+
+    char self[4096], dir[PATH_MAX], bin[PATH_MAX];
+    if (bench_corpus_dir(self, sizeof(self), dir, sizeof(dir), keep) != 0) return 1;
+    if (bench_path(bin, sizeof(bin), "%s/%s.pycc", dir, script) != 0) return 1;
+    if (bench_write_corpus(dir) != 0 || bench_build(self, dir, script, bin, 1) != 0) {
+        fprintf(stderr, "Cannot build %s in %s\n", script, dir);
+        return 1;
+    }
+    // the tempfile load path cannot import embedded modules
+    int embeds = strcmp(script, "bigmodule") == 0 || strcmp(script, "bundle") == 0;
+    FILE *json;
+    if (bench_json_open(json_path, &json) != 0) return 1;
+
+    printf("binary %s, %ld launches per level, %ld cpus\n", bin, launches, ncpu);
+    printf("%-9s %5s %10s %9s %9s %9s %9s %8s %8s\n", "load", "k", "launch/s", "p50(ms)", "p99(ms)", "max(ms)",
+           "cpu(ms)", "faults", "csw");
+    char *largv[] = { bin, NULL };
+    struct bench_usage *usage = calloc((size_t)launches, sizeof(*usage));
+    char *ok = malloc((size_t)launches);
+    int rc = usage && ok ? 0 : 1, first = 1;
+    for (size_t p = 0; rc == 0 && p < sizeof(BENCH_LOAD_PATHS) / sizeof(BENCH_LOAD_PATHS[0]); ++p) {
+        if (embeds && strcmp(BENCH_LOAD_PATHS[p], "tempfile") == 0) {
+            printf("%-9s skipped: %s embeds modules, which need the mapped load path\n", BENCH_LOAD_PATHS[p], script);
+            continue;
+        }
+        setenv("PYCC_LOAD", BENCH_LOAD_PATHS[p], 1);
+        bench_run(largv, NULL, 0);   // warm-up
+        for (int l = 0; l < nl; ++l) {
+            long k = levels[l] < 1 ? 1 : (long)levels[l];
+            double total = bench_run_parallel(largv, launches, k, NULL, NULL, usage, ok);
+            struct samples lat = {0};
+            double cpu = 0, faults = 0, csw = 0;
+            long good = 0;
+            for (long i = 0; i < launches; ++i) {
+                if (!ok[i]) continue;
+                ++good;
+                samples_add(&lat, (double)usage[i].wall_ns / 1e6);
+                cpu += usage[i].cpu_ms;
+                faults += (double)(usage[i].minflt + usage[i].majflt);
+                csw += (double)usage[i].csw;
+            }
+            if (good < launches) rc = 1;
+            if (good == 0) {
+                printf("%-9s %5ld %10s\n", BENCH_LOAD_PATHS[p], k, "failed");
+                continue;
+            }
+            double rate = (double)good * 1e3 / total;
+            double p50 = samples_pct(&lat, 50), p99 = samples_pct(&lat, 99), max = samples_pct(&lat, 100);
+            printf("%-9s %5ld %10.1f %9.2f %9.2f %9.2f %9.2f %8.0f %8.1f\n", BENCH_LOAD_PATHS[p], k, rate, p50, p99,
+                   max, cpu / (double)good, faults / (double)good, csw / (double)good);
+            if (json) {
+                fprintf(json, "%s  {\"load\": \"%s\", \"kind\": \"storm\", \"script\": \"%s\", \"python\": \"%d.%d\", "
+                              "\"concurrency\": %ld, \"launches\": %ld, \"failed\": %ld, \"launches_per_s\": %.3f, "
+                              "\"p50_ms\": %.3f, \"p99_ms\": %.3f, \"max_ms\": %.3f, \"cpu_ms\": %.3f, "
+                              "\"faults\": %.1f, \"context_switches\": %.1f}",
+                        first ? "" : ",\n", BENCH_LOAD_PATHS[p], script, PY_MAJOR_VERSION, PY_MINOR_VERSION, k,
+                        launches, launches - good, rate, p50, p99, max, cpu / (double)good, faults / (double)good,
+                        csw / (double)good);
+                first = 0;
+            }
+            samples_free(&lat);
+        }
+    }
+    if (profile && rc == 0) {
+        struct bench_syscalls *sc = malloc(sizeof(*sc));
+        for (size_t p = 0; sc && p < sizeof(BENCH_LOAD_PATHS) / sizeof(BENCH_LOAD_PATHS[0]); ++p) {
+            if (embeds && strcmp(BENCH_LOAD_PATHS[p], "tempfile") == 0) continue;
+            setenv("PYCC_LOAD", BENCH_LOAD_PATHS[p], 1);
+            if (bench_syscall_profile(largv, sc) != 0) {
+                printf("%-9s syscall profile unavailable (ptrace not permitted?)\n", BENCH_LOAD_PATHS[p]);
+                continue;
+            }
+            bench_print_syscalls(BENCH_LOAD_PATHS[p], sc, 12, json, &first);
+        }
+        free(sc);
+    }
+    unsetenv("PYCC_LOAD");
+    free(usage);
+    free(ok);
+    if (bench_json_close(json) != 0) rc = 1;
+    if (!keep) bench_remove_dir(dir);
+    return rc;
+}
+
+// pycc bench <binary>: benchmark any built binary on the node it runs on.
+struct bench_stat {
+    double mean, stddev, ci95;
+    size_t n;
+};
+
+// Two-sided 95% Student t quantile for df degrees of freedom.
+static double t95(double df) {
+    static const double table[] = { 12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+                                    2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+                                    2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042 };
+    if (df < 1) return table[0];
+    if (df <= 30) return table[(int)df - 1];
+    return 1.96 + 2.4 / df;
+}
+
+static struct bench_stat samples_stat(const struct samples *s) {
+    struct bench_stat st = { 0, 0, 0, s->n };
+    if (s->n == 0) return st;
+    for (size_t i = 0; i < s->n; ++i) st.mean += s->v[i];
+    st.mean /= (double)s->n;
+    if (s->n < 2) return st;
+    double ss = 0;
+    for (size_t i = 0; i < s->n; ++i) ss += (s->v[i] - st.mean) * (s->v[i] - st.mean);
+    st.stddev = sqrt(ss / (double)(s->n - 1));
+    st.ci95 = t95((double)(s->n - 1)) * st.stddev / sqrt((double)s->n);
+    return st;
+}
+
+// Welch's t-test at 95%: is b's mean different from a's?
+static int bench_significant(struct bench_stat a, struct bench_stat b) {
+    if (a.n < 2 || b.n < 2) return 0;
+    double va = a.stddev * a.stddev / (double)a.n, vb = b.stddev * b.stddev / (double)b.n;
+    if (va + vb <= 0) return a.mean != b.mean;
+    double t = fabs(b.mean - a.mean) / sqrt(va + vb);
+    double df = (va + vb) * (va + vb) / (va * va / (double)(a.n - 1) + vb * vb / (double)(b.n - 1));
+    return t > t95(df);
+}
+
+// "0,2-3" -> CPU set. Returns 0 on success.
+static int bench_parse_cpus(const char *text, cpu_set_t *set) {
+    CPU_ZERO(set);
+    const char *p = text;
+    while (*p) {
+        char *end;
+        long lo = strtol(p, &end, 10), hi = lo;
+        if (end == p) return 1;
+        if (*end == '-') {
+            p = end + 1;
+            hi = strtol(p, &end, 10);
+            if (end == p) return 1;
+        }
+        for (long c = lo; c <= hi && c < CPU_SETSIZE; ++c) CPU_SET((int)c, set);
+        if (*end == ',') ++end;
+        else if (*end) return 1;
+        p = end;
+    }
+    return 0;
+}
+
+static void bench_json_stat(FILE *f, const char *key, struct bench_stat st, const char *tail) {
+    fprintf(f, "\"%s\": {\"mean\": %.6f, \"stddev\": %.6f, \"ci95\": %.6f, \"n\": %zu}%s", key, st.mean, st.stddev,
+            st.ci95, st.n, tail);
+}
+
+// Read back a stat written by bench_json_stat. Returns 0 if found.
+static int bench_json_read_stat(const char *text, const char *key, struct bench_stat *st) {
+    char pat[64];
+    snprintf(pat, sizeof(pat), "\"%s\": {", key);
+    const char *p = strstr(text, pat);
+    if (!p) return 1;
+    unsigned long long n = 0;
+    if (sscanf(p + strlen(pat), "\"mean\": %lf, \"stddev\": %lf, \"ci95\": %lf, \"n\": %llu",
+               &st->mean, &st->stddev, &st->ci95, &n) != 4) return 1;
+    st->n = (size_t)n;
+    return 0;
+}
+
+static int bench_binary_mode(int argc, char **argv) {
+    long warmup = 3, min_runs = 10, max_runs = 1000;
+    double budget_s = 30, precision = 0.01, threshold = 0.02;
+    const char *json_path = NULL, *compare = NULL, *cpus = NULL;
+    int cold = 0, i = 2;
+    for (; i < argc && argv[i][0] == '-'; ++i) {
+        if (strcmp(argv[i], "--") == 0) { ++i; break; }
+        if (strcmp(argv[i], "-w") == 0 && i + 1 < argc) warmup = atol(argv[++i]);
+        else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) min_runs = atol(argv[++i]);
+        else if (strcmp(argv[i], "--max-runs") == 0 && i + 1 < argc) max_runs = atol(argv[++i]);
+        else if (strcmp(argv[i], "--time") == 0 && i + 1 < argc) budget_s = atof(argv[++i]);
+        else if (strcmp(argv[i], "--precision") == 0 && i + 1 < argc) precision = atof(argv[++i]) / 100.0;
+        else if (strcmp(argv[i], "--threshold") == 0 && i + 1 < argc) threshold = atof(argv[++i]) / 100.0;
+        else if (strcmp(argv[i], "--cold") == 0) cold = 1;
+        else if (strcmp(argv[i], "--cpus") == 0 && i + 1 < argc) cpus = argv[++i];
+        else if (strcmp(argv[i], "--json") == 0 && i + 1 < argc) json_path = argv[++i];
+        else if (strcmp(argv[i], "--compare") == 0 && i + 1 < argc) compare = argv[++i];
+        else { i = argc; break; }
+    }
+    if (i >= argc) {
+        fprintf(stderr, "Usage: %s bench [-w warmup] [-n min_runs] [--max-runs n] [--time seconds] [--precision pct]\n"
+                        "       [--cold] [--cpus 0,2-3] [--json out.json] [--compare base.json] [--threshold pct]\n"
+                        "       [--] <binary> [args...]\n", argv[0]);
+        return 1;
+    }
+    char **target = argv + i;
+    if (min_runs < 2) min_runs = 2;
+    if (max_runs < min_runs) max_runs = min_runs;
+
+    if (cpus) {
+        cpu_set_t set;
+        if (bench_parse_cpus(cpus, &set) != 0 || sched_setaffinity(0, sizeof(set), &set) != 0) {
+            fprintf(stderr, "Cannot pin to CPUs %s: %s\n", cpus, errno ? strerror(errno) : "bad list");
+            return 1;
+        }
+    }
+    // cold runs evict the binary and, for pycc binaries, the libpython it maps
+    char libpython[PATH_MAX], python[PATH_MAX];
+    bench_find_python(libpython, sizeof(libpython), python, sizeof(python));
+    const char *cold_files[] = { target[0], libpython };
+    const char *cold_method = NULL;
+
+    char *err = malloc(65536);
+    if (!err) return 1;
+    setenv("PYCC_TRACE", "1", 1);
+    for (long w = 0; w < warmup; ++w) bench_run(target, NULL, 0);
+
+    struct samples wall = {0}, phases[PHASE_COUNT];
+    memset(phases, 0, sizeof(phases));
+    int traced = 0;
+    long failed = 0;
+    uint64_t t0 = now_ns();
+    // failed runs count against max_runs and the time budget too, so a
+    // target that starts failing cannot keep the loop going
+    while ((long)wall.n + failed < max_runs) {
+        if (cold) cold_method = bench_drop_caches(cold_files, 2);
+        int64_t t = bench_run(target, err, 65536);
+        if (t < 0) {
+            if (++failed > 3 && wall.n == 0) break;
+            if ((double)(now_ns() - t0) / 1e9 > budget_s) break;
+            continue;
+        }
+        samples_add(&wall, (double)t / 1e6);
+        double ms[PHASE_COUNT];
+        if (bench_parse_phases(err, ms) > 0) {
+            traced = 1;
+            for (int p = 0; p < PHASE_COUNT; ++p) samples_add(&phases[p], ms[p]);
+        }
+        if ((long)wall.n < min_runs) continue;
+        struct bench_stat st = samples_stat(&wall);
+        if (st.ci95 <= precision * st.mean) break;
+        if ((double)(now_ns() - t0) / 1e9 > budget_s) break;
+    }
+    unsetenv("PYCC_TRACE");
+    free(err);
+    if (wall.n < 2) {
+        fprintf(stderr, "%s failed to run (%ld failures)\n", target[0], failed);
+        samples_free(&wall);
+        for (int p = 0; p < PHASE_COUNT; ++p) samples_free(&phases[p]);
+        return 1;
+    }
+
+    struct bench_stat st = samples_stat(&wall), pst[PHASE_COUNT];
+    for (int p = 0; p < PHASE_COUNT; ++p) pst[p] = samples_stat(&phases[p]);
+    double p50 = samples_pct(&wall, 50), p90 = samples_pct(&wall, 90), p99 = samples_pct(&wall, 99);
+    double mn = wall.v[0], mx = wall.v[wall.n - 1];   // sorted by samples_pct
+    printf("%s: %zu runs (%ld failed)%s%s\n", target[0], wall.n, failed, cold ? ", cold via " : "",
+           cold ? cold_method : "");
+    printf("  wall  %.3f ms +- %.3f (95%% CI, sd %.3f)\n", st.mean, st.ci95, st.stddev);
+    printf("  min %.3f  p50 %.3f  p90 %.3f  p99 %.3f  max %.3f ms\n", mn, p50, p90, p99, mx);
+    if (st.ci95 > precision * st.mean) {
+        printf("  note: CI is %.1f%% of the mean, above the %.1f%% target\n", 100 * st.ci95 / st.mean, 100 * precision);
+    }
+    if (traced) {
+        printf("  phases:");
+        for (int p = 0; p < PHASE_COUNT; ++p) printf(" %s %.3f", PHASE_NAMES[p], pst[p].mean);
+        printf(" ms\n");
+    }
+
+    int rc = 0;
+    if (json_path) {
+        FILE *f = fopen(json_path, "w");
+        if (!f) { fprintf(stderr, "Cannot write %s: %s\n", json_path, strerror(errno)); rc = 1; }
+        if (f) {
+            fprintf(f, "{\"binary\": \"%s\", \"args\": %d, \"cold\": %s, \"failed\": %ld,\n ",
+                    target[0], argc - i - 1, cold ? "true" : "false", failed);
+            bench_json_stat(f, "wall_ms", st, ",\n ");
+            fprintf(f, "\"percentiles_ms\": {\"min\": %.6f, \"p50\": %.6f, \"p90\": %.6f, \"p99\": %.6f, \"max\": %.6f},\n ",
+                    mn, p50, p90, p99, mx);
+            fputs("\"phases\": {", f);
+            for (int p = 0; traced && p < PHASE_COUNT; ++p) {
+                char key[32];
+                snprintf(key, sizeof(key), "phase_%s", PHASE_NAMES[p]);
+                bench_json_stat(f, key, pst[p], p + 1 < PHASE_COUNT ? ", " : "");
+            }
+            fputs("},\n \"samples_ms\": [", f);
+            for (size_t k = 0; k < wall.n; ++k) fprintf(f, "%s%.6f", k ? ", " : "", wall.v[k]);
+            fputs("]}\n", f);
+            if (fclose(f) != 0) rc = 1;
+        }
+    }
+
+    if (compare) {
+        uint64_t len = 0;
+        char *text = (char *)read_file(compare, &len);
+        struct bench_stat base;
+        if (!text || bench_json_read_stat((text[len] = '\0', text), "wall_ms", &base) != 0) {
+            fprintf(stderr, "Cannot read a bench result from %s\n", compare);
+            free(text);
+            rc = 1;
+        } else {
+            printf("compared with %s:\n", compare);
+            int regressions = 0;
+            for (int p = -1; p < PHASE_COUNT; ++p) {
+                char key[32];
+                struct bench_stat a = base, b = st;
+                if (p >= 0) {
+                    snprintf(key, sizeof(key), "phase_%s", PHASE_NAMES[p]);
+                    if (!traced || bench_json_read_stat(text, key, &a) != 0) continue;
+                    b = pst[p];
+                } else {
+                    snprintf(key, sizeof(key), "wall");
+                }
+                double delta = a.mean > 0 ? (b.mean - a.mean) / a.mean : 0;
+                int sig = bench_significant(a, b);
+                // phases under 0.1 ms are too small to call
+                int regression = sig && delta > threshold && b.mean - a.mean > 0.1;
+                int improvement = sig && delta < -threshold && a.mean - b.mean > 0.1;
+                regressions += regression && p < 0 ? 1 : 0;
+                printf("  %-16s %10.3f -> %10.3f ms %+7.1f%%  %s\n", p < 0 ? "wall" : key + 6, a.mean, b.mean,
+                       100 * delta, regression ? "REGRESSION" : improvement ? "improved" : sig ? "changed" : "no significant change");
+            }
+            free(text);
+            if (regressions) rc = 2;
+        }
+    }
+    samples_free(&wall);
+    for (int p = 0; p < PHASE_COUNT; ++p) samples_free(&phases[p]);
+    return rc;
+}
+
+// pycc inspect: what the payload of a built binary holds and what each entry
+// costs to load. Sizes come from the index; code entries are decoded and
+// unmarshalled on their own, best of `runs`, by the Python this pycc embeds
+// (entries built for another Python get sizes only).
+struct inspect_entry {
+    uint8_t kind;
+    uint8_t codec;
+    uint32_t flags;
+    char name[256];
+    uint64_t stored;
+    uint64_t raw;
+    long code_objects;          // -1: not code, or not this Python's
+    double inflate_ms;          // -1: not measured
+    double unmarshal_ms;
+};
+
+struct inspect_binary {
+    const char *path;
+    uint64_t file_size, stub_size, payload_size, index_size, padding;
+    uint32_t flags;
+    uint32_t magic;             // pyc magic of the code entries, 0 if none
+    char settings[1024];        // ENTRY_META lines joined by ", "
+    unsigned n;
+    struct inspect_entry *e;
+};
+
+static const char *const inspect_kinds[] = { "?", "main", "meta", "module", "resource", "dict" };
+static const char *const inspect_codecs[] = { "raw", "zlib", "zlib-frames", "zlib-dict" };
+
+static const char *inspect_kind(uint8_t kind) {
+    return kind < sizeof(inspect_kinds) / sizeof(inspect_kinds[0]) ? inspect_kinds[kind] : "?";
+}
+
+static const char *inspect_codec(uint8_t codec) {
+    return codec < sizeof(inspect_codecs) / sizeof(inspect_codecs[0]) ? inspect_codecs[codec] : "?";
+}
+
+static long inspect_count_code(PyObject *co) {
+    if (!PyCode_Check(co)) return 0;
+    long n = 1;
+    PyObject *consts = PyObject_GetAttrString(co, "co_consts");
+    if (!consts) { PyErr_Clear(); return n; }
+    for (Py_ssize_t i = 0; i < PyTuple_GET_SIZE(consts); ++i) n += inspect_count_code(PyTuple_GET_ITEM(consts, i));
+    Py_DECREF(consts);
+    return n;
+}
+
+// Raw bytes of entry e of the payload in `payload`, timing the decode. Raw
+// entries are returned in place (*owned = NULL).
+static const unsigned char *inspect_decode(const struct payload_entry *e, unsigned char **owned, double *ms) {
+    const unsigned char *data = (const unsigned char *)payload.data + e->offset;
+    *owned = NULL;
+    *ms = 0;
+    if (e->codec == CODEC_RAW) return data;
+    unsigned char *raw = malloc(e->raw_size ? (size_t)e->raw_size : 1);
+    if (!raw) return NULL;
+    uint64_t t0 = now_ns();
+    int r = 1;
+    if (e->codec == CODEC_ZLIB || e->codec == CODEC_ZLIB_DICT) {
+        const struct payload_entry *dict = e->codec == CODEC_ZLIB_DICT ? find_entry(ENTRY_DICT, NULL) : NULL;
+        r = inflate_with_dict(data, e->stored_size, raw, e->raw_size,
+                              dict ? (const unsigned char *)payload.data + dict->offset : NULL,
+                              dict ? dict->stored_size : 0);
+    } else if (e->codec == CODEC_ZLIB_FRAMES && e->stored_size >= FRAME_TABLE_HEADER) {
+        uint32_t frame_size = get_u32_le(data), nframes = get_u32_le(data + 4);
+        r = frame_size == 0 || (uint64_t)nframes * frame_size < e->raw_size;
+        for (uint32_t i = 0; r == 0 && i < nframes; ++i) r = frame_decode(e, i, raw + (uint64_t)i * frame_size);
+    }
+    *ms = (double)(now_ns() - t0) / 1e6;
+    if (r != 0) {
+        free(raw);
+        return NULL;
+    }
+    *owned = raw;
+    return raw;
+}
+
+// Read and measure one binary. Returns 0 on success (errors are printed).
+static int inspect_load(const char *path, int runs, struct inspect_binary *b) {
+    memset(b, 0, sizeof(*b));
+    b->path = path;
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        fprintf(stderr, "Cannot open %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+    long start;
+    int lr = locate_payload(f, &start, &b->payload_size, &b->flags);
+    if (lr != 0) {
+        fprintf(stderr, "%s: no pycc payload (code %d)\n", path, lr);
+        fclose(f);
+        return 1;
+    }
+    b->stub_size = (uint64_t)start;
+    unsigned char *buf = malloc((size_t)b->payload_size);
+    int r = !buf || fseek(f, 0, SEEK_END) != 0 || (b->file_size = (uint64_t)ftell(f), fseek(f, start, SEEK_SET) != 0) || fread(buf, 1, (size_t)b->payload_size, f) != b->payload_size;
+    fclose(f);
+    if (r) {
+        fprintf(stderr, "%s: cannot read payload\n", path);
+        free(buf);
+        return 1;
+    }
+    payload.data = (const char *)buf;
+    payload.size = b->payload_size;
+    payload.flags = b->flags;
+    if (b->flags & FOOTER_FLAG_INDEXED) {
+        if (parse_payload_index(buf, b->payload_size, b->payload_size) != 0) {
+            fprintf(stderr, "%s: corrupt payload index\n", path);
+            r = 1;
+            goto end;
+        }
+        b->index_size = get_u64_le(buf + 16);
+    } else {
+        // single-pyc payload of older binaries
+        struct payload_entry *e = calloc(1, sizeof(*e));
+        if (!e) { r = 1; goto end; }
+        e->kind = ENTRY_MAIN;
+        strcpy(e->name, "__main__");
+        e->stored_size = e->raw_size = b->payload_size;
+        free(payload.entries);
+        payload.entries = e;
+        payload.nentries = 1;
+    }
+
+    b->n = payload.nentries;
+    b->e = calloc(b->n ? b->n : 1, sizeof(*b->e));
+    if (!b->e) { r = 1; goto end; }
+    uint32_t magic = (uint32_t)PyImport_GetMagicNumber();
+    b->padding = b->payload_size - b->index_size;
+    for (unsigned i = 0; i < b->n; ++i) {
+        const struct payload_entry *pe = &payload.entries[i];
+        struct inspect_entry *ie = &b->e[i];
+        ie->kind = pe->kind;
+        ie->codec = pe->codec;
+        ie->flags = pe->flags;
+        memcpy(ie->name, pe->name, sizeof(ie->name));
+        ie->stored = pe->stored_size;
+        ie->raw = pe->raw_size;
+        ie->code_objects = -1;
+        ie->inflate_ms = ie->unmarshal_ms = -1;
+        b->padding -= pe->stored_size;
+        int code = pe->kind == ENTRY_MAIN || pe->kind == ENTRY_MODULE;
+        if (!code && pe->kind != ENTRY_META) continue;
+        unsigned char *owned;
+        double ms;
+        const unsigned char *raw = inspect_decode(pe, &owned, &ms);
+        if (!raw) {
+            fprintf(stderr, "%s: entry '%s' does not decode (codec %u)\n", path, pe->name, pe->codec);
+            continue;
+        }
+        if (pe->kind == ENTRY_META) {
+            for (uint64_t p = 0; p < pe->raw_size; ) {
+                const unsigned char *nl = memchr(raw + p, '\n', (size_t)(pe->raw_size - p));
+                size_t len = nl ? (size_t)(nl - raw - p) : (size_t)(pe->raw_size - p);
+                size_t used = strlen(b->settings);
+                if (len) snprintf(b->settings + used, sizeof(b->settings) - used, "%s%.*s", used ? ", " : "", (int)len, raw + p);
+                p += len + 1;
+            }
+            free(owned);
+            continue;
+        }
+        if (runs > 0) ie->inflate_ms = ms;
+        if (pe->raw_size > 16 && !b->magic) b->magic = get_u32_le(raw);
+        if (pe->raw_size > 16 && get_u32_le(raw) == magic) {
+            double best = -1;
+            long count = -1;
+            for (int k = 0; k < (runs > 0 ? runs : 1); ++k) {
+                uint64_t t0 = now_ns();
+                PyObject *co = PyMarshal_ReadObjectFromString((const char *)raw + 16, (Py_ssize_t)(pe->raw_size - 16));
+                double t = (double)(now_ns() - t0) / 1e6;
+                if (!co) { PyErr_Clear(); break; }
+                if (best < 0 || t < best) best = t;
+                if (count < 0) count = inspect_count_code(co);
+                Py_DECREF(co);
+            }
+            ie->code_objects = count;
+            if (runs > 0) ie->unmarshal_ms = best;
+        }
+        free(owned);
+    }
+end:
+    free(payload.entries);
+    payload.entries = NULL;
+    payload.nentries = 0;
+    payload.data = NULL;
+    free(buf);
+    if (r) {
+        free(b->e);
+        b->e = NULL;
+    }
+    return r;
+}
+
+static void inspect_json_str(FILE *f, const char *s, size_t len) {
+    fputc('"', f);
+    for (size_t i = 0; i < len; ++i) {
+        unsigned char c = (unsigned char)s[i];
+        if (c == '"' || c == '\\') fprintf(f, "\\%c", c);
+        else if (c < 0x20) fprintf(f, "\\u%04x", c);
+        else fputc(c, f);
+    }
+    fputc('"', f);
+}
+
+static void inspect_json_leaf(FILE *f, int level, const struct inspect_entry *e, const char *label, size_t label_len,
+                              int *first) {
+    fprintf(f, "%s\n%*s{\"name\": ", *first ? "" : ",", 2 * level, "");
+    *first = 0;
+    inspect_json_str(f, label, label_len);
+    fputs(", \"entry\": ", f);
+    inspect_json_str(f, e->name, strlen(e->name));
+    fprintf(f, ", \"kind\": \"%s\", \"codec\": \"%s\", \"size\": %llu, \"raw\": %llu", inspect_kind(e->kind),
+            inspect_codec(e->codec), (unsigned long long)e->stored, (unsigned long long)e->raw);
+    if (e->code_objects >= 0) fprintf(f, ", \"code_objects\": %ld", e->code_objects);
+    if (e->inflate_ms >= 0) fprintf(f, ", \"inflate_ms\": %.4f", e->inflate_ms);
+    if (e->unmarshal_ms >= 0) fprintf(f, ", \"unmarshal_ms\": %.4f", e->unmarshal_ms);
+    fputc('}', f);
+}
+
+// Dotted component `depth` of name (length in *len), NULL if there is none.
+static const char *inspect_component(const char *name, int depth, size_t *len) {
+    for (int d = 0; d < depth; ++d) {
+        name = strchr(name, '.');
+        if (!name) return NULL;
+        name++;
+    }
+    const char *dot = strchr(name, '.');
+    *len = dot ? (size_t)(dot - name) : strlen(name);
+    return name;
+}
+
+// Modules sorted by name, nested by package; a package's own code is its
+// "__init__" leaf.
+static void inspect_json_modules(FILE *f, struct inspect_entry **v, unsigned n, int depth, int level) {
+    int first = 1;
+    for (unsigned i = 0; i < n; ) {
+        size_t len, len2;
+        const char *c = inspect_component(v[i]->name, depth, &len);
+        if (!c) {
+            inspect_json_leaf(f, level, v[i++], "__init__", 8, &first);
+            continue;
+        }
+        unsigned j = i + 1;
+        for (const char *c2; j < n && (c2 = inspect_component(v[j]->name, depth, &len2)) && len2 == len &&
+                             memcmp(c, c2, len) == 0; ++j) {}
+        if (j == i + 1 && !inspect_component(v[i]->name, depth + 1, &len2) && !(v[i]->flags & ENTRY_FLAG_PACKAGE)) {
+            inspect_json_leaf(f, level, v[i], c, len, &first);
+        } else {
+            fprintf(f, "%s\n%*s{\"name\": ", first ? "" : ",", 2 * level, "");
+            first = 0;
+            inspect_json_str(f, c, len);
+            fputs(", \"children\": [", f);
+            inspect_json_modules(f, v + i, j - i, depth + 1, level + 1);
+            fputs("]}", f);
+        }
+        i = j;
+    }
+}
+
+static int inspect_cmp_name(const void *a, const void *b) {
+    return strcmp((*(struct inspect_entry *const *)a)->name, (*(struct inspect_entry *const *)b)->name);
+}
+
+// Treemap JSON: a d3.hierarchy-style tree whose leaf "size" is stored bytes,
+// with the stub, index, padding and footer as leaves next to the entries.
+static int inspect_write_json(const char *json_path, const struct inspect_binary *b) {
+    FILE *f = fopen(json_path, "w");
+    if (!f) { fprintf(stderr, "Cannot write %s: %s\n", json_path, strerror(errno)); return 1; }
+    struct inspect_entry **v = malloc((b->n ? b->n : 1) * sizeof(*v));
+    if (!v) { fclose(f); return 1; }
+    fputs("{\"name\": ", f);
+    inspect_json_str(f, b->path, strlen(b->path));
+    fprintf(f, ", \"file_size\": %llu, \"python\": \"%d.%d\", \"children\": [\n"
+               "  {\"name\": \"stub\", \"size\": %llu},\n  {\"name\": \"index\", \"size\": %llu},\n"
+               "  {\"name\": \"padding\", \"size\": %llu},\n  {\"name\": \"footer\", \"size\": %llu}",
+            (unsigned long long)b->file_size, PY_MAJOR_VERSION, PY_MINOR_VERSION, (unsigned long long)b->stub_size,
+            (unsigned long long)b->index_size, (unsigned long long)b->padding,
+            (unsigned long long)(b->file_size - b->stub_size - b->payload_size));
+    static const struct { uint8_t kind; const char *group; } groups[] = {
+        { ENTRY_MAIN, "main" }, { ENTRY_MODULE, "modules" }, { ENTRY_RESOURCE, "resources" },
+        { ENTRY_META, NULL }, { ENTRY_DICT, NULL },
+    };
+    for (size_t g = 0; g < sizeof(groups) / sizeof(groups[0]); ++g) {
+        unsigned m = 0;
+        for (unsigned i = 0; i < b->n; ++i) {
+            if (b->e[i].kind == groups[g].kind) v[m++] = &b->e[i];
+        }
+        if (m == 0) continue;
+        if (!groups[g].group) {
+            for (unsigned i = 0; i < m; ++i) {
+                int first = 0;
+                inspect_json_leaf(f, 1, v[i], inspect_kind(v[i]->kind), strlen(inspect_kind(v[i]->kind)), &first);
+            }
+            continue;
+        }
+        qsort(v, m, sizeof(*v), inspect_cmp_name);
+        fprintf(f, ",\n  {\"name\": \"%s\", \"children\": [", groups[g].group);
+        if (groups[g].kind == ENTRY_MODULE) {
+            inspect_json_modules(f, v, m, 0, 2);
+        } else {
+            int first = 1;
+            for (unsigned i = 0; i < m; ++i) inspect_json_leaf(f, 2, v[i], v[i]->name, strlen(v[i]->name), &first);
+        }
+        fputs("]}", f);
+    }
+    fputs("\n]}\n", f);
+    free(v);
+    return fclose(f) != 0;
+}
+
+static const char *inspect_sort_key = "stored";
+
+static double inspect_sort_value(const struct inspect_entry *e) {
+    if (strcmp(inspect_sort_key, "raw") == 0) return (double)e->raw;
+    if (strcmp(inspect_sort_key, "load") == 0) return (e->inflate_ms > 0 ? e->inflate_ms : 0) + (e->unmarshal_ms > 0 ? e->unmarshal_ms : 0);
+    return (double)e->stored;
+}
+
+static int inspect_cmp(const void *a, const void *b) {
+    const struct inspect_entry *x = *(struct inspect_entry *const *)a, *y = *(struct inspect_entry *const *)b;
+    if (strcmp(inspect_sort_key, "name") == 0) return strcmp(x->name, y->name);
+    double vx = inspect_sort_value(x), vy = inspect_sort_value(y);
+    return vx > vy ? -1 : vx < vy ? 1 : strcmp(x->name, y->name);
+}
+
+static void inspect_print_header(const struct inspect_binary *b) {
+    printf("%s: %llu bytes = stub %llu + payload %llu (index %llu, padding %llu) + footer %llu\n", b->path,
+           (unsigned long long)b->file_size, (unsigned long long)b->stub_size, (unsigned long long)b->payload_size,
+           (unsigned long long)b->index_size, (unsigned long long)b->padding,
+           (unsigned long long)(b->file_size - b->stub_size - b->payload_size));
+    printf("  %s, %s", b->flags & FOOTER_FLAG_INDEXED ? "indexed" : "single pyc",
+           b->flags & FOOTER_FLAG_FREE_THREADED ? "runs without the GIL" : "requires the GIL");
+    if (b->magic && b->magic != (uint32_t)PyImport_GetMagicNumber()) {
+        printf(", code for another Python (magic %u; this pycc embeds %d.%d)", b->magic & 0xffff, PY_MAJOR_VERSION,
+               PY_MINOR_VERSION);
+    }
+    printf("\n");
+    if (b->settings[0]) printf("  settings: %s\n", b->settings);
+}
+
+static void inspect_fmt_ms(char *out, size_t size, double ms) {
+    if (ms < 0) snprintf(out, size, "-");
+    else snprintf(out, size, "%.3f", ms);
+}
+
+static int inspect_list(const struct inspect_binary *b, long top) {
+    inspect_print_header(b);
+    struct inspect_entry **v = malloc((b->n ? b->n : 1) * sizeof(*v));
+    if (!v) return 1;
+    for (unsigned i = 0; i < b->n; ++i) v[i] = &b->e[i];
+    qsort(v, b->n, sizeof(*v), inspect_cmp);
+    printf("\n  %-8s %-11s %10s %10s %6s %6s %10s %12s  %s\n", "KIND", "CODEC", "STORED", "RAW", "RATIO", "CODE",
+           "INFLATE ms", "UNMARSHAL ms", "NAME");
+    uint64_t stored = 0, raw = 0;
+    long code = 0;
+    double inflate = 0, unmarshal = 0;
+    for (unsigned i = 0; i < b->n; ++i) {
+        const struct inspect_entry *e = v[i];
+        stored += e->stored;
+        raw += e->raw;
+        if (e->code_objects > 0) code += e->code_objects;
+        if (e->inflate_ms > 0) inflate += e->inflate_ms;
+        if (e->unmarshal_ms > 0) unmarshal += e->unmarshal_ms;
+        if (top > 0 && i >= (unsigned long)top) continue;
+        char ncode[24], tin[24], tun[24];
+        if (e->code_objects >= 0) snprintf(ncode, sizeof(ncode), "%ld", e->code_objects);
+        else snprintf(ncode, sizeof(ncode), "-");
+        inspect_fmt_ms(tin, sizeof(tin), e->inflate_ms);
+        inspect_fmt_ms(tun, sizeof(tun), e->unmarshal_ms);
+        printf("  %-8s %-11s %10llu %10llu %5.2fx %6s %10s %12s  %s%s\n", inspect_kind(e->kind), inspect_codec(e->codec),
+               (unsigned long long)e->stored, (unsigned long long)e->raw,
+               e->stored ? (double)e->raw / (double)e->stored : 1.0, ncode, tin, tun, e->name,
+               e->flags & ENTRY_FLAG_PACKAGE ? " (package)" : "");
+    }
+    if (top > 0 && b->n > (unsigned long)top) printf("  ... %lu more\n", (unsigned long)(b->n - top));
+    printf("  %-8s %-11s %10llu %10llu %5.2fx %6ld %10.3f %12.3f  %u entries\n", "total", "",
+           (unsigned long long)stored, (unsigned long long)raw, stored ? (double)raw / (double)stored : 1.0, code,
+           inflate, unmarshal, b->n);
+    free(v);
+    return 0;
+}
+
+struct inspect_delta {
+    const struct inspect_entry *old, *new;
+    int64_t delta;
+};
+
+static int inspect_cmp_delta(const void *a, const void *b) {
+    const struct inspect_delta *x = a, *y = b;
+    int64_t ax = x->delta < 0 ? -x->delta : x->delta, ay = y->delta < 0 ? -y->delta : y->delta;
+    if (ax != ay) return ax > ay ? -1 : 1;
+    const struct inspect_entry *ex = x->new ? x->new : x->old, *ey = y->new ? y->new : y->old;
+    return strcmp(ex->name, ey->name);
+}
+
+static const struct inspect_entry *inspect_find(const struct inspect_binary *b, uint8_t kind, const char *name) {
+    for (unsigned i = 0; i < b->n; ++i) {
+        if (b->e[i].kind == kind && strcmp(b->e[i].name, name) == 0) return &b->e[i];
+    }
+    return NULL;
+}
+
+static void inspect_diff_line(const char *label, uint64_t a, uint64_t b) {
+    int64_t d = (int64_t)(b - a);
+    printf("  %-8s %12llu -> %12llu  %+10lld", label, (unsigned long long)a, (unsigned long long)b, (long long)d);
+    if (a) printf(" (%+.1f%%)", 100.0 * (double)d / (double)a);
+    printf("\n");
+}
+
+// Entries matched by kind and name between two builds, largest stored-size
+// change first.
+static int inspect_diff(const struct inspect_binary *a, const struct inspect_binary *b, int all, long top,
+                        const char *json_path) {
+    struct inspect_delta *d = calloc(a->n + b->n + 1, sizeof(*d));
+    if (!d) return 1;
+    unsigned n = 0, unchanged = 0;
+    for (unsigned i = 0; i < b->n; ++i) {
+        d[n].new = &b->e[i];
+        d[n].old = inspect_find(a, b->e[i].kind, b->e[i].name);
+        d[n].delta = (int64_t)b->e[i].stored - (int64_t)(d[n].old ? d[n].old->stored : 0);
+        n++;
+    }
+    for (unsigned i = 0; i < a->n; ++i) {
+        if (inspect_find(b, a->e[i].kind, a->e[i].name)) continue;
+        d[n].old = &a->e[i];
+        d[n].delta = -(int64_t)a->e[i].stored;
+        n++;
+    }
+    qsort(d, n, sizeof(*d), inspect_cmp_delta);
+
+    printf("%s -> %s\n", a->path, b->path);
+    inspect_diff_line("file", a->file_size, b->file_size);
+    inspect_diff_line("stub", a->stub_size, b->stub_size);
+    inspect_diff_line("payload", a->payload_size, b->payload_size);
+    inspect_diff_line("index", a->index_size, b->index_size);
+    inspect_diff_line("padding", a->padding, b->padding);
+    if (strcmp(a->settings, b->settings) != 0) printf("  settings: %s\n         -> %s\n", a->settings, b->settings);
+    printf("\n  %-8s %-8s %10s %10s %10s %10s %10s %11s  %s\n", "KIND", "STATUS", "OLD", "NEW", "DELTA", "OLD RAW",
+           "NEW RAW", "CODE", "NAME");
+    unsigned shown = 0;
+    for (unsigned i = 0; i < n; ++i) {
+        const struct inspect_entry *o = d[i].old, *w = d[i].new, *e = w ? w : o;
+        const char *status = !o ? "added" : !w ? "removed" : o->stored != w->stored || o->raw != w->raw ? "changed"
+                           : o->codec != w->codec ? "codec" : NULL;
+        if (!status) {
+            unchanged++;
+            if (!all) continue;
+            status = "same";
+        }
+        if (top > 0 && shown >= (unsigned long)top) continue;
+        shown++;
+        char os[24] = "-", ns[24] = "-", orw[24] = "-", nrw[24] = "-", code[32] = "-";
+        if (o) snprintf(os, sizeof(os), "%llu", (unsigned long long)o->stored);
+        if (w) snprintf(ns, sizeof(ns), "%llu", (unsigned long long)w->stored);
+        if (o) snprintf(orw, sizeof(orw), "%llu", (unsigned long long)o->raw);
+        if (w) snprintf(nrw, sizeof(nrw), "%llu", (unsigned long long)w->raw);
+        long oc = o ? o->code_objects : -1, nc = w ? w->code_objects : -1;
+        if (oc >= 0 && nc >= 0) snprintf(code, sizeof(code), "%ld->%ld", oc, nc);
+        else if (oc >= 0 || nc >= 0) snprintf(code, sizeof(code), "%s%ld", nc < 0 ? "-" : "+", oc < 0 ? nc : oc);
+        printf("  %-8s %-8s %10s %10s %+10lld %10s %10s %11s  %s\n", inspect_kind(e->kind), status, os, ns,
+               (long long)d[i].delta, orw, nrw, code, e->name);
+    }
+    if (shown < n - (all ? 0 : unchanged)) printf("  ... %u more\n", n - (all ? 0 : unchanged) - shown);
+    if (!all && unchanged) printf("  (%u unchanged entries; -a lists them)\n", unchanged);
+
+    int rc = 0;
+    if (json_path) {
+        FILE *f = fopen(json_path, "w");
+        if (!f) { fprintf(stderr, "Cannot write %s: %s\n", json_path, strerror(errno)); free(d); return 1; }
+        fprintf(f, "{\"old\": {\"file_size\": %llu, \"stub\": %llu, \"payload\": %llu, \"index\": %llu, \"padding\": %llu},\n"
+                   " \"new\": {\"file_size\": %llu, \"stub\": %llu, \"payload\": %llu, \"index\": %llu, \"padding\": %llu},\n"
+                   " \"entries\": [",
+                (unsigned long long)a->file_size, (unsigned long long)a->stub_size, (unsigned long long)a->payload_size,
+                (unsigned long long)a->index_size, (unsigned long long)a->padding,
+                (unsigned long long)b->file_size, (unsigned long long)b->stub_size, (unsigned long long)b->payload_size,
+                (unsigned long long)b->index_size, (unsigned long long)b->padding);
+        for (unsigned i = 0; i < n; ++i) {
+            const struct inspect_entry *o = d[i].old, *w = d[i].new, *e = w ? w : o;
+            fprintf(f, "%s\n  {\"name\": ", i ? "," : "");
+            inspect_json_str(f, e->name, strlen(e->name));
+            fprintf(f, ", \"kind\": \"%s\", \"delta\": %lld", inspect_kind(e->kind), (long long)d[i].delta);
+            if (o) fprintf(f, ", \"old\": {\"codec\": \"%s\", \"size\": %llu, \"raw\": %llu, \"code_objects\": %ld}",
+                           inspect_codec(o->codec), (unsigned long long)o->stored, (unsigned long long)o->raw, o->code_objects);
+            if (w) fprintf(f, ", \"new\": {\"codec\": \"%s\", \"size\": %llu, \"raw\": %llu, \"code_objects\": %ld}",
+                           inspect_codec(w->codec), (unsigned long long)w->stored, (unsigned long long)w->raw, w->code_objects);
+            fputc('}', f);
+        }
+        fputs("\n]}\n", f);
+        rc = fclose(f) != 0;
+    }
+    free(d);
+    return rc;
+}
+
+static int inspect_mode(int argc, char **argv) {
+    const char *json_path = NULL;
+    long top = 0, runs = 5;
+    int diff = 0, all = 0, i = 2;
+    for (; i < argc && argv[i][0] == '-'; ++i) {
+        if (strcmp(argv[i], "--") == 0) { ++i; break; }
+        if (strcmp(argv[i], "--json") == 0 && i + 1 < argc) json_path = argv[++i];
+        else if (strcmp(argv[i], "--sort") == 0 && i + 1 < argc) inspect_sort_key = argv[++i];
+        else if (strcmp(argv[i], "--top") == 0 && i + 1 < argc) top = atol(argv[++i]);
+        else if (strcmp(argv[i], "--runs") == 0 && i + 1 < argc) runs = atol(argv[++i]);
+        else if (strcmp(argv[i], "--diff") == 0) diff = 1;
+        else if (strcmp(argv[i], "-a") == 0) all = 1;
+        else { i = argc; break; }
+    }
+    int sort_ok = strcmp(inspect_sort_key, "stored") == 0 || strcmp(inspect_sort_key, "raw") == 0 ||
+                  strcmp(inspect_sort_key, "load") == 0 || strcmp(inspect_sort_key, "name") == 0;
+    if (argc - i != (diff ? 2 : 1) || !sort_ok) {
+        fprintf(stderr, "Usage: %s inspect [--sort stored|raw|load|name] [--top n] [--runs n] [--json treemap.json] <binary>\n"
+                        "       %s inspect --diff [-a] [--top n] [--json diff.json] <old_binary> <new_binary>\n",
+                argv[0], argv[0]);
+        return 1;
+    }
+
+    int own_python = !Py_IsInitialized();
+    PyGILState_STATE gil = PyGILState_UNLOCKED;
+    if (own_python) Py_InitializeEx(0);
+    else gil = PyGILState_Ensure();
+    struct inspect_binary a, b;
+    int rc = inspect_load(argv[i], diff ? 0 : (int)runs, &a);
+    if (rc == 0 && diff) {
+        rc = inspect_load(argv[i + 1], 0, &b);
+        if (rc == 0) {
+            rc = inspect_diff(&a, &b, all, top, json_path);
+            free(b.e);
+        }
+    } else if (rc == 0) {
+        rc = inspect_list(&a, top);
+        if (rc == 0 && json_path) rc = inspect_write_json(json_path, &a);
+    }
+    free(a.e);
+    if (own_python) Py_FinalizeEx();
+    else PyGILState_Release(gil);
+    return rc;
+}
+
+// Builder source reads. The script and every --module/--entry source are
+// read ahead on one thread while the main thread starts Python and compiles
+// them in order, so compiling source i waits only for read i. The reads go
+// through a single io_uring: one batch of openat + statx for every file,
+// then one batch of reads into a single registered arena. Where io_uring is
+// unavailable (old kernel, seccomp) or PYCC_IO_URING=0, the same thread
+// does open/fstat/read itself.
+struct source_read {
+    const char *path;
+    unsigned char *data;        // slot in the arena, with room for a NUL
+    uint64_t size;
+    uint64_t got;               // bytes read so far
+    uint32_t mtime;
+    int fd;
+    int err;                    // errno of a failed open/stat/read
+    int done;
+    struct statx stx;
+};
+
+struct source_reader {
+    struct source_read *files;
+    int n;
+    unsigned char *arena;
+    int uring;                  // 1 when the reads went through io_uring
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t thread;
+};
+
+// A minimal io_uring on the raw syscalls; liburing is not required.
+struct uring {
+    int fd;
+    unsigned entries, inflight;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ptr, *cq_ptr;
+    size_t sq_len, cq_len;
+};
+
+static void uring_close(struct uring *u) {
+    if (u->sqes) munmap(u->sqes, u->entries * sizeof(*u->sqes));
+    if (u->cq_ptr && u->cq_ptr != u->sq_ptr) munmap(u->cq_ptr, u->cq_len);
+    if (u->sq_ptr) munmap(u->sq_ptr, u->sq_len);
+    if (u->fd >= 0) close(u->fd);
+    memset(u, 0, sizeof(*u));
+    u->fd = -1;
+}
+
+static int uring_init(struct uring *u, unsigned entries) {
+    struct io_uring_params p;
+    memset(u, 0, sizeof(*u));
+    memset(&p, 0, sizeof(p));
+    u->fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+    if (u->fd < 0) return 1;
+    u->entries = p.sq_entries;
+    u->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    u->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) u->sq_len = u->cq_len = u->sq_len > u->cq_len ? u->sq_len : u->cq_len;
+    u->sq_ptr = mmap(NULL, u->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+    if (u->sq_ptr == MAP_FAILED) { u->sq_ptr = NULL; uring_close(u); return 1; }
+    u->cq_ptr = (p.features & IORING_FEAT_SINGLE_MMAP) ? u->sq_ptr
+              : mmap(NULL, u->cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+    if (u->cq_ptr == MAP_FAILED) { u->cq_ptr = NULL; uring_close(u); return 1; }
+    u->sqes = mmap(NULL, p.sq_entries * sizeof(*u->sqes), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd,
+                   IORING_OFF_SQES);
+    if (u->sqes == MAP_FAILED) { u->sqes = NULL; uring_close(u); return 1; }
+    char *sq = u->sq_ptr, *cq = u->cq_ptr;
+    u->sq_head = (unsigned *)(sq + p.sq_off.head);
+    u->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    u->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    u->sq_array = (unsigned *)(sq + p.sq_off.array);
+    u->cq_head = (unsigned *)(cq + p.cq_off.head);
+    u->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    u->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    return 0;
+}
+
+// Next free submission slot, zeroed, or NULL while `entries` ops are in
+// flight (the completion ring is twice as large, so it cannot overflow).
+static struct io_uring_sqe *uring_sqe(struct uring *u) {
+    if (u->inflight == u->entries) return NULL;
+    unsigned tail = *u->sq_tail;
+    unsigned idx = tail & *u->sq_mask;
+    struct io_uring_sqe *sqe = &u->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    u->sq_array[idx] = idx;
+    __atomic_store_n(u->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    u->inflight++;
+    return sqe;
+}
+
+// Submit everything queued and wait for at least one completion.
+static int uring_enter(struct uring *u) {
+    unsigned queued = *u->sq_tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+    for (;;) {
+        long r = syscall(__NR_io_uring_enter, u->fd, queued, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+        if (r >= 0) return 0;
+        if (errno != EINTR) return 1;
+    }
+}
+
+static int uring_cqe(struct uring *u, struct io_uring_cqe *out) {
+    unsigned head = *u->cq_head;
+    if (head == __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE)) return 0;
+    *out = u->cqes[head & *u->cq_mask];
+    __atomic_store_n(u->cq_head, head + 1, __ATOMIC_RELEASE);
+    u->inflight--;
+    return 1;
+}
+
+static void source_read_done(struct source_reader *r, struct source_read *f, int err) {
+    if (f->fd >= 0) close(f->fd);
+    f->fd = -1;
+    pthread_mutex_lock(&r->lock);
+    f->err = err;
+    f->done = 1;
+    pthread_cond_broadcast(&r->cond);
+    pthread_mutex_unlock(&r->lock);
+}
+
+// Lay the files out in one arena once their sizes are known.
+static int source_arena(struct source_reader *r, size_t *len) {
+    size_t total = 0;
+    for (int i = 0; i < r->n; ++i) total += ((size_t)r->files[i].size + 64) & ~(size_t)63;
+    r->arena = malloc(total ? total : 1);
+    if (!r->arena) return 1;
+    size_t pos = 0;
+    for (int i = 0; i < r->n; ++i) {
+        r->files[i].data = r->arena + pos;
+        pos += ((size_t)r->files[i].size + 64) & ~(size_t)63;
+    }
+    *len = total;
+    return 0;
+}
+
+// The io_uring path. Returns nonzero only if the ring could not be used at
+// all, in which case nothing has been marked done yet.
+static int source_read_uring(struct source_reader *r) {
+    struct uring u;
+    if (uring_init(&u, r->n < 256 ? (unsigned)r->n * 2 : 512) != 0) return 1;
+    r->uring = 1;
+    // user_data: file index << 2 | op
+    enum { OP_OPEN, OP_STATX, OP_READ };
+    struct io_uring_cqe cqe;
+    int next = 0, op = OP_OPEN;
+    while (next < r->n || u.inflight > 0) {
+        struct io_uring_sqe *sqe;
+        while (next < r->n && (sqe = uring_sqe(&u)) != NULL) {
+            struct source_read *f = &r->files[next];
+            sqe->opcode = op == OP_OPEN ? IORING_OP_OPENAT : IORING_OP_STATX;
+            sqe->fd = AT_FDCWD;
+            sqe->addr = (uint64_t)(uintptr_t)f->path;
+            if (op == OP_OPEN) {
+                sqe->open_flags = O_RDONLY | O_CLOEXEC;
+            } else {
+                sqe->len = STATX_SIZE | STATX_MTIME;
+                sqe->off = (uint64_t)(uintptr_t)&f->stx;
+            }
+            sqe->user_data = (uint64_t)next << 2 | (uint64_t)op;
+            if (op == OP_STATX) ++next;
+            op = op == OP_OPEN ? OP_STATX : OP_OPEN;
+        }
+        if (uring_enter(&u) != 0) break;
+        while (uring_cqe(&u, &cqe)) {
+            struct source_read *f = &r->files[cqe.user_data >> 2];
+            if (cqe.res < 0) f->err = -cqe.res;
+            else if ((cqe.user_data & 3) == OP_OPEN) f->fd = cqe.res;
+            else { f->size = f->stx.stx_size; f->mtime = (uint32_t)f->stx.stx_mtime.tv_sec; }
+        }
+    }
+    // kernels before 5.6 have the ring but not these ops
+    int unsupported = 0;
+    for (int i = 0; i < r->n; ++i) unsupported |= r->files[i].err == EINVAL;
+    if (unsupported) {
+        for (int i = 0; i < r->n; ++i) {
+            if (r->files[i].fd >= 0) close(r->files[i].fd);
+            r->files[i].fd = -1;
+            r->files[i].err = 0;
+        }
+        r->uring = 0;
+        uring_close(&u);
+        return 1;
+    }
+
+    size_t arena_len = 0;
+    int fixed = 0;
+    if (source_arena(r, &arena_len) == 0) {
+        // one registered buffer for all reads; without the memlock budget
+        // for it, plain reads into the same arena
+        struct iovec iov = { r->arena, arena_len };
+        fixed = syscall(__NR_io_uring_register, u.fd, IORING_REGISTER_BUFFERS, &iov, 1) == 0;
+    }
+    next = 0;
+    int resubmit = -1;
+    while (next < r->n || resubmit >= 0 || u.inflight > 0) {
+        struct io_uring_sqe *sqe;
+        while ((resubmit >= 0 || next < r->n) && (sqe = uring_sqe(&u)) != NULL) {
+            int i = resubmit >= 0 ? resubmit : next++;
+            struct source_read *f = &r->files[i];
+            resubmit = -1;
+            if (f->err == 0 && !r->arena) f->err = ENOMEM;
+            if (f->err != 0 || f->fd < 0 || f->got == f->size) {
+                // nothing to read: hand the slot back as a no-op
+                sqe->opcode = IORING_OP_NOP;
+                sqe->user_data = (uint64_t)i << 2 | OP_OPEN;
+                continue;
+            }
+            uint64_t left = f->size - f->got;
+            sqe->opcode = fixed ? IORING_OP_READ_FIXED : IORING_OP_READ;
+            sqe->fd = f->fd;
+            sqe->addr = (uint64_t)(uintptr_t)(f->data + f->got);
+            sqe->len = left > (1u << 30) ? 1u << 30 : (unsigned)left;
+            sqe->off = f->got;
+            sqe->buf_index = 0;
+            sqe->user_data = (uint64_t)i << 2 | OP_READ;
+        }
+        if (uring_enter(&u) != 0) break;
+        while (uring_cqe(&u, &cqe)) {
+            int i = (int)(cqe.user_data >> 2);
+            struct source_read *f = &r->files[i];
+            if ((cqe.user_data & 3) == OP_READ) {
+                if (cqe.res < 0) f->err = -cqe.res;
+                else if (cqe.res == 0) f->size = f->got;    // the file shrank
+                else f->got += (uint64_t)cqe.res;
+                if (f->err == 0 && f->got < f->size) { resubmit = i; break; }
+            }
+            source_read_done(r, f, f->err);
+        }
+    }
+    // anything left unfinished if the ring failed midway
+    for (int i = 0; i < r->n; ++i) {
+        if (!r->files[i].done) source_read_done(r, &r->files[i], r->files[i].err ? r->files[i].err : EIO);
+    }
+    if (fixed) syscall(__NR_io_uring_register, u.fd, IORING_UNREGISTER_BUFFERS, NULL, 0);
+    uring_close(&u);
+    return 0;
+}
+
+static void source_read_sync(struct source_reader *r) {
+    for (int i = 0; i < r->n; ++i) {
+        struct source_read *f = &r->files[i];
+        struct stat st;
+        f->fd = open(f->path, O_RDONLY | O_CLOEXEC);
+        if (f->fd < 0 || fstat(f->fd, &st) != 0) { f->err = errno; continue; }
+        f->size = (uint64_t)st.st_size;
+        f->mtime = (uint32_t)st.st_mtime;
+    }
+    size_t arena_len;
+    int nomem = source_arena(r, &arena_len) != 0;
+    for (int i = 0; i < r->n; ++i) {
+        struct source_read *f = &r->files[i];
+        if (f->err == 0 && nomem) f->err = ENOMEM;
+        while (f->err == 0 && f->got < f->size) {
+            ssize_t n = pread(f->fd, f->data + f->got, (size_t)(f->size - f->got), (off_t)f->got);
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0) f->err = errno;
+            else if (n == 0) f->size = f->got;
+            else f->got += (uint64_t)n;
+        }
+        source_read_done(r, f, f->err);
+    }
+}
+
+static void *source_reader_main(void *arg) {
+    struct source_reader *r = arg;
+    const char *env = getenv("PYCC_IO_URING");
+    if ((env && strcmp(env, "0") == 0) || source_read_uring(r) != 0) source_read_sync(r);
+    return NULL;
+}
+
+static int source_reader_start(struct source_reader *r, const char *const *paths, int n) {
+    memset(r, 0, sizeof(*r));
+    r->files = calloc((size_t)n, sizeof(*r->files));
+    if (!r->files) return 1;
+    r->n = n;
+    for (int i = 0; i < n; ++i) {
+        r->files[i].path = paths[i];
+        r->files[i].fd = -1;
+    }
+    pthread_mutex_init(&r->lock, NULL);
+    pthread_cond_init(&r->cond, NULL);
+    if (pthread_create(&r->thread, NULL, source_reader_main, r) != 0) {
+        free(r->files);
+        r->files = NULL;
+        return 1;
+    }
+    return 0;
+}
+
+// Block until source i has been read. data is NUL-terminated on success.
+static struct source_read *source_reader_wait(struct source_reader *r, int i) {
+    struct source_read *f = &r->files[i];
+    pthread_mutex_lock(&r->lock);
+    while (!f->done) pthread_cond_wait(&r->cond, &r->lock);
+    pthread_mutex_unlock(&r->lock);
+    if (f->err == 0) f->data[f->size] = '\0';
+    return f;
+}
+
+static void source_reader_finish(struct source_reader *r) {
+    if (!r->files) return;
+    pthread_join(r->thread, NULL);
+    pthread_mutex_destroy(&r->lock);
+    pthread_cond_destroy(&r->cond);
+    free(r->arena);
+    free(r->files);
+    memset(r, 0, sizeof(*r));
+}
+
+// Compile source text (NUL-terminated at src_size) read from path to pyc
+// bytes in memory: the 16-byte header (magic, flags, source mtime, source
+// size) followed by the marshalled code, as py_compile would write it.
+// Python must be initialized. Returns 0 on success, 2 on a compile error
+// (already printed).
+static int compile_to_pyc(const char *path, const unsigned char *src, uint64_t src_size, uint32_t mtime,
+                          unsigned char **out, uint64_t *out_size) {
+    if (memchr(src, '\0', (size_t)src_size)) {
+        fprintf(stderr, "%s: source code cannot contain null bytes\n", path);
+        return 2;
+    }
+
+    PyObject *filename = PyUnicode_DecodeFSDefault(path);
+    PyObject *code = filename ? Py_CompileStringObject((const char *)src, filename, Py_file_input, NULL, -1) : NULL;
+    Py_XDECREF(filename);
+    PyObject *marshalled = code ? PyMarshal_WriteObjectToString(code, Py_MARSHAL_VERSION) : NULL;
+    Py_XDECREF(code);
+    if (!marshalled) {
+        PyErr_Print();
+        return 2;
+    }
+
+    size_t n = (size_t)PyBytes_GET_SIZE(marshalled);
+    unsigned char *pyc = malloc(16 + n);
+    if (!pyc) { Py_DECREF(marshalled); return 1; }
+    long magic = PyImport_GetMagicNumber();
+    put_u32_le(pyc, (uint32_t)magic);
+    put_u32_le(pyc + 4, 0);             // flags: timestamp-based
+    put_u32_le(pyc + 8, mtime);
+    put_u32_le(pyc + 12, (uint32_t)src_size);
+    memcpy(pyc + 16, PyBytes_AS_STRING(marshalled), n);
+    Py_DECREF(marshalled);
+    *out = pyc;
+    *out_size = 16 + n;
+    return 0;
+}
+
+// Payload under construction: entries are held in memory until written.
+struct build_entry {
+    uint8_t kind;
+    uint8_t codec;
+    uint32_t flags;
+    char *name;
+    unsigned char *data;
+    uint64_t size;
+    uint64_t raw_size;
+    uint64_t offset;      // assigned by serialize_payload
+};
+
+struct payload_builder {
+    struct build_entry *entries;
+    unsigned count;
+    unsigned cap;
+};
+
+// Add an entry; takes ownership of `data` (malloc'd). Returns 0 on success.
+static int pb_add(struct payload_builder *pb, uint8_t kind, const char *name, unsigned char *data, uint64_t size) {
+    if (pb->count == pb->cap) {
+        unsigned cap = pb->cap ? pb->cap * 2 : 8;
+        struct build_entry *e = realloc(pb->entries, cap * sizeof(*e));
+        if (!e) { free(data); return 1; }
+        pb->entries = e;
+        pb->cap = cap;
+    }
+    struct build_entry *e = &pb->entries[pb->count];
+    memset(e, 0, sizeof(*e));
+    e->kind = kind;
+    e->codec = CODEC_RAW;
+    e->name = strdup(name);
+    e->data = data;
+    e->size = size;
+    e->raw_size = size;
+    if (!e->name) { free(data); return 1; }
+    pb->count++;
+    return 0;
+}
+
+static void pb_free(struct payload_builder *pb) {
+    for (unsigned i = 0; i < pb->count; ++i) {
+        free(pb->entries[i].name);
+        free(pb->entries[i].data);
+    }
+    free(pb->entries);
+    memset(pb, 0, sizeof(*pb));
+}
+
+// --compress: deflate code entries one by one, so each can still be loaded
+// on its own. Entries that would not shrink stay raw.
+static int pb_compress(struct payload_builder *pb) {
+    for (unsigned i = 0; i < pb->count; ++i) {
+        struct build_entry *e = &pb->entries[i];
+        if ((e->kind != ENTRY_MAIN && e->kind != ENTRY_MODULE) || e->codec != CODEC_RAW) continue;
+        uLongf n = compressBound((uLong)e->size);
+        unsigned char *z = malloc(n);
+        if (!z) return 1;
+        if (compress2(z, &n, e->data, (uLong)e->size, Z_BEST_COMPRESSION) != Z_OK || n >= e->size) {
+            free(z);
+            continue;
+        }
+        free(e->data);
+        e->data = z;
+        e->size = n;
+        e->codec = CODEC_ZLIB;
+    }
+    return 0;
+}
+
+// --compress-dict: train one zlib preset dictionary over the bundle's code
+// entries and deflate each entry against it. Small modules share most of
+// their bytes (opcode runs, common names, stdlib constants), which plain
+// per-entry deflate cannot see; a shared dictionary recovers most of that
+// while every entry stays independently loadable.
+//
+// The trainer is a cut-down COVER: score each DICT_DMER-byte substring by
+// how many entries contain it, then per epoch keep the DICT_SEGMENT-byte
+// window with the highest total score and zero the substrings it covers.
+// Deflate matches most cheaply near the end of the dictionary, so the best
+// segments go last.
+#define DICT_MAX (32u << 10)        // deflate window
+#define DICT_RATIO 32u              // code bytes per dictionary byte
+#define DICT_SEGMENT 64u
+#define DICT_DMER 8u
+#define DICT_SAMPLE_MAX (2u << 20)
+#define DICT_MIN_ENTRIES 8u
+#define DICT_HASH_BITS 20
+#define DICT_SKIP 16                // pyc header
+
+struct dict_segment {
+    uint64_t pos;
+    uint64_t score;
+};
+
+static int dict_segment_cmp(const void *a, const void *b) {
+    const struct dict_segment *x = a, *y = b;
+    return x->score < y->score ? -1 : x->score > y->score;
+}
+
+static uint32_t dict_dmer_hash(const unsigned char *p) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return (uint32_t)((v * 0x9E3779B97F4A7C15ull) >> (64 - DICT_HASH_BITS));
+}
+
+// Build a dictionary of at most `max` bytes from `samples` (entries
+// concatenated, `ends[i]` the end of entry i). Returns its size, 0 when
+// nothing repeats.
+static uint64_t dict_train(const unsigned char *samples, const uint64_t *ends, unsigned n, unsigned char *dict, uint64_t max) {
+    uint64_t total = ends[n - 1];
+    uint32_t *freq = calloc((size_t)1 << DICT_HASH_BITS, sizeof(uint32_t));
+    uint32_t *seen = calloc((size_t)1 << DICT_HASH_BITS, sizeof(uint32_t));
+    unsigned nseg = (unsigned)(max / DICT_SEGMENT);
+    struct dict_segment *segs = calloc(nseg, sizeof(*segs));
+    uint64_t size = 0;
+    if (!freq || !seen || !segs || total < DICT_SEGMENT) goto end;
+
+    // document frequency: count each dmer once per entry
+    uint64_t start = 0;
+    for (unsigned i = 0; i < n; ++i) {
+        for (uint64_t p = start; p + DICT_DMER <= ends[i]; ++p) {
+            uint32_t h = dict_dmer_hash(samples + p);
+            if (seen[h] != i + 1) {
+                seen[h] = i + 1;
+                freq[h]++;
+            }
+        }
+        start = ends[i];
+    }
+    // a dmer found in one entry only does not help any other
+    for (size_t h = 0; h < (size_t)1 << DICT_HASH_BITS; ++h) {
+        if (freq[h] < 2) freq[h] = 0;
+    }
+
+    uint64_t epoch = total / nseg;
+    if (epoch < DICT_SEGMENT) {
+        epoch = DICT_SEGMENT;
+        nseg = (unsigned)(total / epoch);
+    }
+    unsigned used = 0;
+    for (unsigned k = 0; k < nseg; ++k) {
+        uint64_t lo = k * epoch, hi = k + 1 == nseg ? total : lo + epoch;
+        if (hi - lo < DICT_SEGMENT) continue;
+        // sliding window over the dmers starting in [p, p + SEGMENT - DMER]
+        uint64_t win = DICT_SEGMENT - DICT_DMER + 1, score = 0, best = 0, best_pos = lo;
+        for (uint64_t p = lo; p < lo + win; ++p) score += freq[dict_dmer_hash(samples + p)];
+        best = score;
+        for (uint64_t p = lo + 1; p + DICT_SEGMENT <= hi; ++p) {
+            score -= freq[dict_dmer_hash(samples + p - 1)];
+            score += freq[dict_dmer_hash(samples + p + win - 1)];
+            if (score > best) {
+                best = score;
+                best_pos = p;
+            }
+        }
+        if (best == 0) continue;
+        for (uint64_t p = best_pos; p < best_pos + win; ++p) freq[dict_dmer_hash(samples + p)] = 0;
+        segs[used].pos = best_pos;
+        segs[used].score = best;
+        used++;
+    }
+    qsort(segs, used, sizeof(*segs), dict_segment_cmp);
+    for (unsigned k = 0; k < used; ++k) {
+        memcpy(dict + size, samples + segs[k].pos, DICT_SEGMENT);
+        size += DICT_SEGMENT;
+    }
+end:
+    free(freq);
+    free(seen);
+    free(segs);
+    return size;
+}
+
+static int deflate_with_dict(const unsigned char *in, uint64_t in_size, const unsigned char *dict, uint64_t dict_size,
+                             unsigned char **out, uint64_t *out_size) {
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    if (deflateInit(&zs, Z_BEST_COMPRESSION) != Z_OK) return 1;
+    uLong cap = deflateBound(&zs, (uLong)in_size) + 4;   // + dictionary id
+    unsigned char *z = malloc(cap);
+    int ok = z && deflateSetDictionary(&zs, dict, (uInt)dict_size) == Z_OK;
+    if (ok) {
+        zs.next_in = (unsigned char *)in;
+        zs.avail_in = (uInt)in_size;
+        zs.next_out = z;
+        zs.avail_out = (uInt)cap;
+        ok = deflate(&zs, Z_FINISH) == Z_STREAM_END;
+    }
+    *out_size = zs.total_out;
+    deflateEnd(&zs);
+    if (!ok) {
+        free(z);
+        return 1;
+    }
+    *out = z;
+    return 0;
+}
+
+static int pb_compress_dict(struct payload_builder *pb) {
+    const struct build_entry *de = NULL;
+    int trained = 0;
+    unsigned ncode = 0;
+    uint64_t code_size = 0;
+    for (unsigned i = 0; i < pb->count; ++i) {
+        const struct build_entry *e = &pb->entries[i];
+        if (e->kind == ENTRY_DICT) de = e;
+        if ((e->kind == ENTRY_MAIN || e->kind == ENTRY_MODULE) && e->codec == CODEC_RAW && e->size > DICT_SKIP) {
+            ncode++;
+            code_size += e->size - DICT_SKIP;
+        }
+    }
+    // --watch keeps the dictionary of the first build, so entries compressed
+    // then stay valid
+    if (!de) {
+        if (ncode < DICT_MIN_ENTRIES) return pb_compress(pb);
+        // sample an even share of every entry, skipping the pyc header
+        uint64_t share = code_size <= DICT_SAMPLE_MAX ? UINT64_MAX : DICT_SAMPLE_MAX / ncode;
+        unsigned char *samples = malloc((size_t)(code_size < DICT_SAMPLE_MAX ? code_size : DICT_SAMPLE_MAX) + 1);
+        uint64_t *ends = malloc(ncode * sizeof(*ends));
+        unsigned char *dict = malloc(DICT_MAX);
+        if (!samples || !ends || !dict) {
+            free(samples);
+            free(ends);
+            free(dict);
+            return 1;
+        }
+        uint64_t pos = 0;
+        unsigned n = 0;
+        for (unsigned i = 0; i < pb->count; ++i) {
+            const struct build_entry *e = &pb->entries[i];
+            if ((e->kind != ENTRY_MAIN && e->kind != ENTRY_MODULE) || e->codec != CODEC_RAW || e->size <= DICT_SKIP) continue;
+            uint64_t len = e->size - DICT_SKIP < share ? e->size - DICT_SKIP : share;
+            memcpy(samples + pos, e->data + DICT_SKIP, (size_t)len);
+            pos += len;
+            ends[n++] = pos;
+        }
+        uint64_t max = code_size / DICT_RATIO < DICT_MAX ? code_size / DICT_RATIO : DICT_MAX;
+        uint64_t dict_size = dict_train(samples, ends, n, dict, max);
+        free(samples);
+        free(ends);
+        if (dict_size == 0) {
+            free(dict);
+            return pb_compress(pb);
+        }
+        if (pb_add(pb, ENTRY_DICT, "zdict", dict, dict_size) != 0) return 1;
+        de = &pb->entries[pb->count - 1];
+        trained = 1;
+    }
+
+    // a fresh dictionary must pay for itself against plain --compress
+    unsigned char **z = calloc(pb->count, sizeof(*z));
+    uint64_t *zn = calloc(pb->count, sizeof(*zn));
+    uint64_t with = de->size, without = 0;
+    int r = !z || !zn;
+    for (unsigned i = 0; r == 0 && i < pb->count; ++i) {
+        struct build_entry *e = &pb->entries[i];
+        if ((e->kind != ENTRY_MAIN && e->kind != ENTRY_MODULE) || e->codec != CODEC_RAW) continue;
+        r = deflate_with_dict(e->data, e->size, de->data, de->size, &z[i], &zn[i]);
+        if (r == 0 && zn[i] >= e->size) {
+            free(z[i]);
+            z[i] = NULL;
+        }
+        with += z[i] ? zn[i] : e->size;
+        if (r == 0 && trained) {
+            uLongf n = compressBound((uLong)e->size);
+            unsigned char *tmp = malloc(n);
+            if (!tmp) r = 1;
+            else if (compress2(tmp, &n, e->data, (uLong)e->size, Z_BEST_COMPRESSION) == Z_OK && n < e->size) without += n;
+            else without += e->size;
+            free(tmp);
+        }
+    }
+    int keep = r == 0 && (!trained || with < without);
+    for (unsigned i = 0; i < pb->count; ++i) {
+        if (!z || !z[i]) continue;
+        if (keep) {
+            struct build_entry *e = &pb->entries[i];
+            free(e->data);
+            e->data = z[i];
+            e->size = zn[i];
+            e->codec = CODEC_ZLIB_DICT;
+        } else {
+            free(z[i]);
+        }
+    }
+    free(z);
+    free(zn);
+    if (r != 0 || keep) return r;
+    pb->count--;    // the dictionary just added
+    free(pb->entries[pb->count].name);
+    free(pb->entries[pb->count].data);
+    return pb_compress(pb);
+}
+
+// --compress-resources: split each resource into frames of frame_size raw
+// bytes and deflate them independently, so a reader only inflates the
+// frames it touches. Resources that would not shrink stay raw (and keep
+// zero-copy access); within a compressed one, frames that would not shrink
+// are stored raw.
+static int pb_compress_resources(struct payload_builder *pb, uint32_t frame_size) {
+    for (unsigned i = 0; i < pb->count; ++i) {
+        struct build_entry *e = &pb->entries[i];
+        if (e->kind != ENTRY_RESOURCE || e->codec != CODEC_RAW || e->size == 0) continue;
+        uint64_t nframes = (e->size + frame_size - 1) / frame_size;
+        if (nframes > UINT32_MAX) continue;
+        uint64_t table = FRAME_TABLE_HEADER + 8 * (nframes + 1);
+        uint64_t cap = table + nframes * compressBound(frame_size);
+        unsigned char *out = malloc((size_t)cap);
+        if (!out) return 1;
+        put_u32_le(out, frame_size);
+        put_u32_le(out + 4, (uint32_t)nframes);
+        uint64_t pos = table;
+        for (uint64_t f = 0; f < nframes; ++f) {
+            uint64_t off = f * frame_size;
+            uLong len = (uLong)(e->size - off < frame_size ? e->size - off : frame_size);
+            uLongf n = compressBound(len);
+            uint64_t mark = 0;
+            if (compress2(out + pos, &n, e->data + off, len, Z_DEFAULT_COMPRESSION) != Z_OK || n >= len) {
+                memcpy(out + pos, e->data + off, len);
+                n = len;
+                mark = FRAME_RAW_BIT;
+            }
+            put_u64_le(out + FRAME_TABLE_HEADER + 8 * f, pos | mark);
+            pos += n;
+        }
+        put_u64_le(out + FRAME_TABLE_HEADER + 8 * nframes, pos);
+        if (pos >= e->size) { free(out); continue; }
+        free(e->data);
+        e->data = out;
+        e->size = pos;
+        e->codec = CODEC_ZLIB_FRAMES;
+    }
+    return 0;
+}
+
+// Lay out the payload that follows `stub_size` bytes of stub: index, entry
+// data aligned to ENTRY_ALIGN in the file, then the v2 footer. The result is
+// one malloc'd buffer so the output gets a single write.
+static unsigned char *serialize_payload(struct payload_builder *pb, uint64_t stub_size, uint32_t flags, size_t *out_len) {
+    uint64_t index_size = INDEX_HEADER_LEN;
+    for (unsigned i = 0; i < pb->count; ++i) {
+        index_size += ENTRY_RECORD_LEN + ((strlen(pb->entries[i].name) + 7u) & ~(uint64_t)7u);
+    }
+    uint64_t pos = index_size;
+    for (unsigned i = 0; i < pb->count; ++i) {
+        uint64_t abs = stub_size + pos;
+        uint64_t align = pb->entries[i].kind == ENTRY_RESOURCE && pb->entries[i].size >= RESOURCE_PAGE_ALIGN
+                       ? RESOURCE_PAGE_ALIGN : ENTRY_ALIGN;
+        pos += (align - abs % align) % align;
+        pb->entries[i].offset = pos;
+        pos += pb->entries[i].size;
+    }
+    uint64_t payload_size = pos;
+
+    size_t total = (size_t)payload_size + FOOTER_V2_LEN;
+    unsigned char *buf = calloc(1, total);   // padding stays zero
+    if (!buf) return NULL;
+    memcpy(buf, INDEX_MAGIC, 8);
+    put_u32_le(buf + 8, pb->count);
+    put_u64_le(buf + 16, index_size);
+    unsigned char *rec = buf + INDEX_HEADER_LEN;
+    for (unsigned i = 0; i < pb->count; ++i) {
+        const struct build_entry *e = &pb->entries[i];
+        size_t name_len = strlen(e->name);
+        rec[0] = e->kind;
+        rec[1] = e->codec;
+        rec[2] = (unsigned char)(name_len & 0xFF);
+        rec[3] = (unsigned char)(name_len >> 8);
+        put_u32_le(rec + 4, e->flags);
+        put_u64_le(rec + 8, e->offset);
+        put_u64_le(rec + 16, e->size);
+        put_u64_le(rec + 24, e->raw_size);
+        memcpy(rec + ENTRY_RECORD_LEN, e->name, name_len);
+        rec += ENTRY_RECORD_LEN + ((name_len + 7u) & ~(size_t)7u);
+        memcpy(buf + e->offset, e->data, (size_t)e->size);
+    }
+    // v2 footer: flags (u32 LE) + magic + payload_size (u64 LE)
+    unsigned char *footer = buf + payload_size;
+    put_u32_le(footer, flags | FOOTER_FLAG_INDEXED);
+    memcpy(footer + 4, FOOTER_MAGIC_V2, FOOTER_MAGIC_LEN);
+    put_u64_le(footer + 4 + FOOTER_MAGIC_LEN, payload_size);
+    *out_len = total;
+    return buf;
+}
+
+static int pwrite_all(int fd, const void *data, size_t len, uint64_t off) {
+    const char *p = data;
+    while (len > 0) {
+        ssize_t n = pwrite(fd, p, len, (off_t)off);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return 1;
+        p += n;
+        len -= (size_t)n;
+        off += (uint64_t)n;
+    }
+    return 0;
+}
+
+// Copies the stub (or writes the #! line of a thin binary) into the start of
+// the output on its own thread while the main thread compiles.
+// With thin_runtime set, a "#!<thin_runtime> --pycc-thin" line takes the place
+// of the stub.
+struct stub_copy {
+    const char *stub_exe;
+    const char *thin_runtime;
+    int out_fd;
+    uint64_t size;      // known before the copy starts
+    int rc;
+    pthread_t thread;
+};
+
+static void *stub_copy_main(void *arg) {
+    struct stub_copy *c = arg;
+    c->rc = 1;
+    if (c->thin_runtime) {
+        char line[512];
+        int w = snprintf(line, sizeof(line), "#!%s " THIN_FLAG "\n", c->thin_runtime);
+        if (pwrite_all(c->out_fd, line, (size_t)w, 0) == 0) c->rc = 0;
+        return NULL;
+    }
+    int in = open(c->stub_exe, O_RDONLY | O_CLOEXEC);
+    if (in < 0) return NULL;
+    // in-kernel copy; plain read/write where copy_file_range is unsupported
+    loff_t in_off = 0, out_off = 0;
+    while ((uint64_t)out_off < c->size) {
+        ssize_t n = copy_file_range(in, &in_off, c->out_fd, &out_off, (size_t)(c->size - (uint64_t)out_off), 0);
+        if (n > 0) continue;
+        if (n < 0 && errno == EINTR) continue;
+        if (n == 0 || (errno != EXDEV && errno != ENOSYS && errno != EINVAL && errno != EOPNOTSUPP)) break;
+        char buf[65536];
+        ssize_t got;
+        while ((got = pread(in, buf, sizeof(buf), in_off)) > 0) {
+            if (pwrite_all(c->out_fd, buf, (size_t)got, (uint64_t)out_off) != 0) break;
+            in_off += got;
+            out_off += got;
+        }
+        break;
+    }
+    close(in);
+    if ((uint64_t)out_off == c->size) c->rc = 0;
+    return NULL;
+}
+
+// Size the stub part of the output and start copying it into out_fd.
+static int stub_copy_start(struct stub_copy *c, const char *stub_exe, const char *thin_runtime, int out_fd) {
+    memset(c, 0, sizeof(*c));
+    c->stub_exe = stub_exe;
+    c->thin_runtime = thin_runtime;
+    c->out_fd = out_fd;
+    if (thin_runtime) {
+        // the kernel reads at most 255 bytes of the #! line
+        int w = snprintf(NULL, 0, "#!%s " THIN_FLAG "\n", thin_runtime);
+        if (w > 255) { fprintf(stderr, "Runtime path too long: %s\n", thin_runtime); return 1; }
+        c->size = (uint64_t)w;
+    } else {
+        struct stat st;
+        if (stat(stub_exe, &st) != 0) { fprintf(stderr, "Failed to open stub: %s\n", stub_exe); return 1; }
+        c->size = (uint64_t)st.st_size;
+    }
+    if (pthread_create(&c->thread, NULL, stub_copy_main, c) != 0) { fprintf(stderr, "Cannot start stub copy\n"); return 1; }
+    return 0;
+}
+
+
+// Runtime options, read from the environment once at startup.
+//   PYCC_TRACE=1            print per-phase timings and metrics at exit
+//   PYCC_SHM=1              publish the live metrics page in /dev/shm
+//   PYCC_SHM_INTERVAL_MS=n  page refresh interval (default 250)
+//   PYCC_GIL_STATS=1        GIL wait/hold accounting, histograms and wait
+//                           sites, reported at exit and on SIGUSR2
+//   PYCC_GIL_SAMPLE_MS=n    wait-site sampling interval (default 10)
+static void runtime_begin(void) {
+    metrics.start_ns = now_ns();
+    metrics.phase_enter_ns = metrics.start_ns;
+    metrics.phase = PHASE_BOOT;
+    if (env_flag("PYCC_SHM")) shm_start();
+}
+
+// Called right after Py_Initialize(), with the GIL held.
+// Finder placed at sys.meta_path[0]. Modules embedded in the payload win;
+// builtin and frozen modules are left to their own importers; otherwise each
+// path entry is listed once and candidates are looked up in
+// the cached listing instead of being probed with stat/openat per suffix.
+// With a sealed path (path.sealed) sys.path is fixed to the build-time list
+// and the stock PathFinder is dropped, so a miss fails without touching the
+// filesystem. A path entry that is a file (a zip) hands the search to the
+// stock finders, which then stay installed. importlib.invalidate_caches() drops the listings.
+static const char IMPORT_FINDER_SRC[] =
+    "import sys, pycc, _imp\n"
+    "import _frozen_importlib as _m, _frozen_importlib_external as _mx\n"
+    "_spec_from_file = _mx.spec_from_file_location\n"
+    "_LOADERS = ([(s, _mx.ExtensionFileLoader) for s in _imp.extension_suffixes()] +\n"
+    "            [(s, _mx.SourceFileLoader) for s in _mx.SOURCE_SUFFIXES] +\n"
+    "            [(s, _mx.SourcelessFileLoader) for s in _mx.BYTECODE_SUFFIXES])\n"
+    "class PayloadLoader:\n"
+    "    @staticmethod\n"
+    "    def create_module(spec):\n"
+    "        return None\n"
+    "    @staticmethod\n"
+    "    def exec_module(module):\n"
+    "        exec(pycc._payload_code(module.__spec__.name), module.__dict__)\n"
+    "class PyccFinder:\n"
+    "    listings = {}\n"
+    "    builtin = frozenset(sys.builtin_module_names)\n"
+    "    listing_enabled = _listing_enabled\n"
+    "    sealed = _sealed is not None\n"
+    "    @classmethod\n"
+    "    def invalidate_caches(cls):\n"
+    "        cls.listings.clear()\n"
+    "    @classmethod\n"
+    "    def _listing(cls, path):\n"
+    "        try:\n"
+    "            return cls.listings[path]\n"
+    "        except KeyError:\n"
+    "            names = cls.listings[path] = pycc._listdir(path)\n"
+    "            return names\n"
+    "    @classmethod\n"
+    "    def find_spec(cls, fullname, path=None, target=None):\n"
+    "        if fullname in cls.builtin:\n"
+    "            return None\n"
+    "        kind = pycc._payload_kind(fullname)\n"
+    "        if kind:\n"
+    "            pycc._finder_note(True)\n"
+    "            return _m.ModuleSpec(fullname, PayloadLoader, origin='<payload>', is_package=kind == 'package')\n"
+    "        if _imp.is_frozen(fullname):\n"
+    "            return None\n"
+    "        if not cls.listing_enabled:\n"
+    "            return None\n"
+    "        tail = fullname.rpartition('.')[2]\n"
+    "        namespace = []\n"
+    "        for entry in (sys.path if path is None else path):\n"
+    "            if not isinstance(entry, str):\n"
+    "                continue\n"
+    "            names = cls._listing(entry or '.')\n"
+    "            if names is False:\n"
+    "                break\n"
+    "            if not names:\n"
+    "                continue\n"
+    "            base = entry + '/' + tail if entry else tail\n"
+    "            if names.get(tail):\n"
+    "                inner = cls._listing(base) or {}\n"
+    "                for suffix, loader in _LOADERS:\n"
+    "                    if inner.get('__init__' + suffix) is False:\n"
+    "                        pycc._finder_note(True)\n"
+    "                        init = base + '/__init__' + suffix\n"
+    "                        return _spec_from_file(fullname, init, loader=loader(fullname, init),\n"
+    "                                               submodule_search_locations=[base])\n"
+    "                namespace.append(base)\n"
+    "            for suffix, loader in _LOADERS:\n"
+    "                if names.get(tail + suffix) is False:\n"
+    "                    pycc._finder_note(True)\n"
+    "                    return _spec_from_file(fullname, base + suffix, loader=loader(fullname, base + suffix))\n"
+    "        if namespace and cls.sealed:\n"
+    "            pycc._finder_note(True)\n"
+    "            spec = _m.ModuleSpec(fullname, None, is_package=True)\n"
+    "            spec.submodule_search_locations = namespace\n"
+    "            return spec\n"
+    "        pycc._finder_note(False)\n"
+    "        return None\n"
+    "if _sealed is not None:\n"
+    "    sys.path[:] = [p for p in _sealed.split(':') if p]\n"
+    "    if _listing_enabled and all(PyccFinder._listing(p) is not False for p in sys.path):\n"
+    "        sys.meta_path[:] = [f for f in sys.meta_path if f is not _mx.PathFinder]\n"
+    "sys.meta_path.insert(0, PyccFinder)\n";
+
+// Install the finder in the current interpreter. import.finder=0 leaves
+// filesystem lookups to the stock finders; payload modules still need it.
+static int install_import_finder(void) {
+    const char *on = setting("import.finder");
+    int listing = !(on && strcmp(on, "0") == 0);
+    const char *sealed = setting("path.sealed");
+    PyObject *g = PyDict_New();
+    PyObject *sealed_obj = sealed ? PyUnicode_FromString(sealed) : Py_NewRef(Py_None);
+    PyObject *r = NULL;
+    if (g && sealed_obj && PyDict_SetItemString(g, "__builtins__", PyEval_GetBuiltins()) == 0 &&
+        PyDict_SetItemString(g, "_sealed", sealed_obj) == 0 &&
+        PyDict_SetItemString(g, "_listing_enabled", listing ? Py_True : Py_False) == 0) {
+        r = PyRun_String(IMPORT_FINDER_SRC, Py_file_input, g, g);
+    }
+    Py_XDECREF(sealed_obj);
+    Py_XDECREF(g);
+    if (!r) {
+        fprintf(stderr, "[pycc] failed to install import finder:\n");
+        PyErr_Print();
+        return 1;
+    }
+    Py_DECREF(r);
+    return 0;
+}
+
+// gc.threshold and gc.freeze build settings; main interpreter only.
+static int apply_gc_settings(void) {
+    const char *threshold = setting("gc.threshold");
+    const char *freeze = setting("gc.freeze");
+    if (!threshold && !freeze) return 0;
+
+    int rc = 1;
+    PyObject *mod = NULL, *r = NULL;
+    if (threshold) {
+        long t[3];
+        int n = sscanf(threshold, "%ld,%ld,%ld", &t[0], &t[1], &t[2]);
+        if (n < 1) { fprintf(stderr, "[pycc] bad gc.threshold: %s\n", threshold); goto end; }
+        mod = PyImport_ImportModule("gc");
+        if (!mod) goto end;
+        r = n == 1 ? PyObject_CallMethod(mod, "set_threshold", "l", t[0])
+          : n == 2 ? PyObject_CallMethod(mod, "set_threshold", "ll", t[0], t[1])
+          : PyObject_CallMethod(mod, "set_threshold", "lll", t[0], t[1], t[2]);
+        if (!r) goto end;
+        Py_CLEAR(r);
+        Py_CLEAR(mod);
+    }
+    if (freeze && strcmp(freeze, "fork") == 0) {
+        mod = PyImport_ImportModule("os");
+        PyObject *pycc = mod ? PyImport_ImportModule("pycc") : NULL;
+        PyObject *hook = pycc ? PyObject_GetAttrString(pycc, "_freeze_before_fork") : NULL;
+        PyObject *reg = mod ? PyObject_GetAttrString(mod, "register_at_fork") : NULL;
+        PyObject *kw = hook ? Py_BuildValue("{sO}", "before", hook) : NULL;
+        PyObject *noargs = PyTuple_New(0);
+        r = (reg && kw && noargs) ? PyObject_Call(reg, noargs, kw) : NULL;
+        Py_XDECREF(noargs);
+        Py_XDECREF(kw);
+        Py_XDECREF(reg);
+        Py_XDECREF(hook);
+        Py_XDECREF(pycc);
+        if (!r) goto end;
+    } else if (freeze && strcmp(freeze, "off") != 0 && strcmp(freeze, "0") != 0) {
+        fprintf(stderr, "[pycc] unknown gc.freeze mode: %s (use fork or off)\n", freeze);
+    }
+    rc = 0;
+
+end:
+    if (rc != 0 && PyErr_Occurred()) PyErr_Print();
+    Py_XDECREF(r);
+    Py_XDECREF(mod);
+    return rc;
+}
+
+static void runtime_python_ready(void) {
+    install_import_finder();
+    apply_gc_settings();
+#ifdef PYCC_SQLITE_VFS
+    if (payload.data && find_entry(ENTRY_RESOURCE, NULL)) PySys_AddAuditHook(sqlite_audit_hook, NULL);
+#endif
+    if (shm.page || env_flag("PYCC_TRACE")) install_gc_callback();
+    int gil_stats = env_flag("PYCC_GIL_STATS");
+    if (shm.page || gil_stats) {
+        int r = enable_gil_accounting();
+        if (r != 0 && gil_stats) fprintf(stderr, "[pycc] GIL accounting unavailable (code %d)\n", r);
+        else if (gil_stats) gil_sampler_start();
+    }
+}
+
+// Called before Py_FinalizeEx(), with the GIL held.
+static void runtime_python_done(void) {
+    gil_sampler_stop();
+    if (gil_tls.holding && gil_tls.slot) {
+        uint64_t t = now_ns();
+        __atomic_fetch_add(&gil_tls.slot->gil_hold_ns, t - gil_tls.hold_start, __ATOMIC_RELAXED);
+        gil_tls.hold_start = t;
+    }
+}
+
+static void runtime_end(void) {
+    shm_stop();
+    if (env_flag("PYCC_TRACE")) print_exit_metrics();
+    if (env_flag("PYCC_GIL_STATS") && metrics.gil_accounting) print_gil_report();
+}
+
+// How this process was launched. Built binaries re-exec themselves as
+// multiprocessing children (sys.executable is the binary), so besides a normal
+// run the command line can be one of the multiprocessing handshakes:
+//   exe --multiprocessing-fork k=v ...      spawn child (sys.frozen is set)
+//   exe [flags] -c "from multiprocessing.forkserver import main; ..."
+//   exe [flags] -c "from multiprocessing.<helper> import main; ..."
+enum {
+    MP_NONE,
+    MP_SPAWN,
+    MP_FORKSERVER,
+    MP_HELPER
+};
+
+static struct {
+    int argc;
+    char **argv;
+    int mp_role;
+    int code_index;   // argv index of the -c code for MP_FORKSERVER/MP_HELPER
+} launch;
+
+static void detect_mp_child(int argc, char **argv) {
+    launch.argc = argc;
+    launch.argv = argv;
+    launch.mp_role = MP_NONE;
+    if (argc >= 2 && strcmp(argv[1], "--multiprocessing-fork") == 0) {
+        launch.mp_role = MP_SPAWN;
+        return;
+    }
+    // skip the interpreter flags multiprocessing forwards
+    // (util._args_from_interpreter_flags()), then expect -c <code>
+    for (int i = 1; i < argc; ++i) {
+        const char *a = argv[i];
+        if (strcmp(a, "-c") == 0) {
+            if (i + 1 < argc && strncmp(argv[i + 1], "from multiprocessing.", 21) == 0) {
+                launch.code_index = i + 1;
+                launch.mp_role = strstr(argv[i + 1], "multiprocessing.forkserver") ? MP_FORKSERVER : MP_HELPER;
+            }
+            return;
+        }
+        if (a[0] != '-' || a[1] == '-' || a[1] == '\0') return;
+        if ((strcmp(a, "-W") == 0 || strcmp(a, "-X") == 0) && i + 1 < argc) ++i;
+    }
+}
+
+// Multi-call binaries (--entry NAME=PATH) hold several ENTRY_MAIN entries.
+// The one to run is basename(argv[0]) (tools installed as symlinks), else the
+// first argument as a subcommand, which is then dropped from sys.argv; the
+// build script (__main__) is the fallback. Multiprocessing children re-exec the
+// real binary, so the choice is passed down in PYCC_MP_ENTRY, which only they
+// honour.
+static void select_entry(void) {
+    payload.main_name = NULL;
+    if (!(payload.flags & FOOTER_FLAG_INDEXED)) return;
+    if (launch.mp_role != MP_NONE) {
+        const char *inherited = getenv("PYCC_MP_ENTRY");
+        if (inherited && find_entry(ENTRY_MAIN, inherited)) payload.main_name = inherited;
+        return;
+    }
+    const char *base = launch.argc > 0 ? strrchr(launch.argv[0], '/') : NULL;
+    base = base ? base + 1 : (launch.argc > 0 ? launch.argv[0] : "");
+    if (find_entry(ENTRY_MAIN, base) && strcmp(base, "__main__") != 0) {
+        payload.main_name = base;
+    } else if (launch.argc > 1 && strcmp(launch.argv[1], "__main__") != 0 && find_entry(ENTRY_MAIN, launch.argv[1])) {
+        payload.main_name = launch.argv[1];
+        launch.argv++;
+        launch.argc--;
+    }
+    if (payload.main_name) setenv("PYCC_MP_ENTRY", payload.main_name, 1);
+    else unsetenv("PYCC_MP_ENTRY");
+}
+
+// --pycc-install DIR: symlink every entry name in DIR to this binary.
+static int install_entry_links(const char *dir) {
+    char selfpath[4096];
+    if (!get_payload_path(selfpath, sizeof(selfpath))) { fprintf(stderr, "Failed to get self path\n"); return 1; }
+    int rc = 0;
+    for (unsigned i = 0; i < payload.nentries; ++i) {
+        const struct payload_entry *e = &payload.entries[i];
+        if (e->kind != ENTRY_MAIN || strcmp(e->name, "__main__") == 0) continue;
+        char link_path[PATH_MAX];
+        int n = snprintf(link_path, sizeof(link_path), "%s/%s", dir, e->name);
+        if (n < 0 || (size_t)n >= sizeof(link_path)) {
+            fprintf(stderr, "Link path too long: %s/%s\n", dir, e->name);
+            rc = 1;
+            continue;
+        }
+        unlink(link_path);
+        if (symlink(selfpath, link_path) != 0) {
+            fprintf(stderr, "Failed to link %s: %s\n", link_path, strerror(errno));
+            rc = 1;
+        } else {
+            printf("%s -> %s\n", link_path, selfpath);
+        }
+    }
+    return rc;
+}
+
+// Initialize the embedded interpreter for running the payload. sys.argv is
+// the real command line (or "-c" + the trailing args for -c children, as
+// python itself would set it).
+static int init_python(void) {
+    PyImport_AppendInittab("pycc", PyInit_pycc);
+
+    PyConfig config;
+    PyConfig_InitPythonConfig(&config);
+    config.parse_argv = 0;
+#ifdef Py_GIL_DISABLED
+    // keep the GIL on for payloads not marked free-threading compatible
+    if (!(payload.flags & FOOTER_FLAG_FREE_THREADED)) config.enable_gil = 1;
+#endif
+    PyStatus status;
+    if (launch.code_index > 0) {
+        char *argv_c[256];
+        int n = 0;
+        argv_c[n++] = "-c";
+        for (int i = launch.code_index + 1; i < launch.argc && n < 256; ++i) argv_c[n++] = launch.argv[i];
+        status = PyConfig_SetBytesArgv(&config, n, argv_c);
+    } else {
+        status = PyConfig_SetBytesArgv(&config, launch.argc, launch.argv);
+    }
+    if (!PyStatus_Exception(status)) status = Py_InitializeFromConfig(&config);
+    PyConfig_Clear(&config);
+    if (PyStatus_Exception(status)) {
+        fprintf(stderr, "Failed to initialize Python: %s\n", status.err_msg ? status.err_msg : "unknown error");
+        return 1;
+    }
+
+    // sys.executable must be this binary (not the libpython install; the thin
+    // file for thin binaries) for multiprocessing and subprocess re-execs;
+    // sys.frozen makes spawn use the --multiprocessing-fork command line.
+    char selfpath[4096];
+    if (get_payload_path(selfpath, sizeof(selfpath))) {
+        PyObject *exe = PyUnicode_DecodeFSDefault(selfpath);
+        if (exe) PySys_SetObject("executable", exe);
+        Py_XDECREF(exe);
+        PyErr_Clear();
+    }
+    PySys_SetObject("frozen", Py_True);
+    return 0;
+}
+
+// Execute the payload as a fresh module that also stands in for __main__,
+// like multiprocessing does when it re-imports the parent's main module in a
+// child: top-level code runs, the `if __name__ == "__main__":` block does not,
+// and pickled references to __main__ resolve. Returns 0 on success.
+static int exec_payload_as_mp_main(PyObject *code) {
+    PyObject *modules = PyImport_GetModuleDict();
+    PyObject *mod = PyModule_New("__mp_main__");
+    if (!mod) return -1;
+    PyObject *d = PyModule_GetDict(mod);
+    int rc = -1;
+    if (PyDict_SetItemString(d, "__builtins__", PyEval_GetBuiltins()) == 0 &&
+        PyDict_SetItemString(modules, "__mp_main__", mod) == 0 &&
+        PyDict_SetItemString(modules, "__main__", mod) == 0) {
+        PyObject *res = PyEval_EvalCode(code, d, d);
+        if (res) { Py_DECREF(res); rc = 0; }
+    }
+    Py_DECREF(mod);
+    return rc;
+}
+
+// Run a multiprocessing child. Spawn children and the forkserver first load the
+// payload as __mp_main__; the forkserver then forks every pool worker from
+// that state, so workers start with the payload already imported.
+static int run_mp_child(PyObject *code) {
+    if (launch.mp_role == MP_SPAWN || launch.mp_role == MP_FORKSERVER) {
+        if (exec_payload_as_mp_main(code) != 0) return -1;
+    }
+
+    PyObject *main_mod = PyImport_AddModule("__main__");
+    PyObject *d = main_mod ? PyModule_GetDict(main_mod) : NULL;
+    if (!d) return -1;
+    const char *src = launch.mp_role == MP_SPAWN
+        ? "from multiprocessing.spawn import freeze_support\nfreeze_support()\n"
+        : launch.argv[launch.code_index];
+    PyObject *res = PyRun_String(src, Py_file_input, d, d);
+    if (!res) return -1;
+    Py_DECREF(res);
+    return 0;
+}
+
+// The marshalled code only loads on the minor version it was built with;
+// returns 15 after reporting a mismatch with the payload's python_version.
+static int check_python_version(void) {
+    const char *built_for = setting("python_version");
+    char runtime_version[16];
+    snprintf(runtime_version, sizeof(runtime_version), "%d.%d", PY_MAJOR_VERSION, PY_MINOR_VERSION);
+    if (built_for && strcmp(built_for, runtime_version) != 0) {
+        fprintf(stderr, "Payload was built for Python %s, this runtime is %s\n", built_for, runtime_version);
+        return 15;
+    }
+    return 0;
+}
+
+// Legacy load path (PYCC_LOAD=tempfile): copy the payload out to a temp .pyc
+// and have Python read it back.
+static int run_payload_tempfile(FILE *f, long payload_start, uint64_t payload_size) {
+    unsigned char buf[4096];
+    uint8_t codec = CODEC_RAW;
+    uint64_t raw_size = 0;
+    unsigned char *dict = NULL;
+    uint64_t dict_size = 0;
+
+    set_phase(PHASE_LOAD);
+
+    if (payload.flags & FOOTER_FLAG_INDEXED) {
+        // read the index (and settings), then copy just the main entry
+        unsigned char hdr[INDEX_HEADER_LEN];
+        if (fseek(f, payload_start, SEEK_SET) != 0 || fread(hdr, 1, sizeof(hdr), f) != sizeof(hdr)) { fclose(f); return 10; }
+        uint64_t index_size = get_u64_le(hdr + 16);
+        unsigned char *index = index_size <= payload_size ? malloc((size_t)index_size) : NULL;
+        int ok = index && fseek(f, payload_start, SEEK_SET) == 0 && fread(index, 1, (size_t)index_size, f) == index_size &&
+                 parse_payload_index(index, index_size, payload_size) == 0;
+        free(index);
+        if (ok) select_entry();
+        const struct payload_entry *main_e = ok ? find_entry(ENTRY_MAIN, payload.main_name) : NULL;
+        if (!main_e) { fclose(f); fprintf(stderr, "Invalid payload index\n"); return 10; }
+        // only the main entry is copied out; nothing could import the rest
+        if (find_entry(ENTRY_MODULE, NULL)) {
+            fclose(f);
+            fprintf(stderr, "Embedded modules need the mapped load path (PYCC_LOAD=tempfile is set)\n");
+            return 10;
+        }
+        const struct payload_entry *meta = find_entry(ENTRY_META, NULL);
+        if (meta) {
+            char *text = malloc((size_t)meta->stored_size);
+            if (text && fseek(f, payload_start + (long)meta->offset, SEEK_SET) == 0 &&
+                fread(text, 1, (size_t)meta->stored_size, f) == meta->stored_size) {
+                load_settings(text, (size_t)meta->stored_size);
+            }
+            free(text);
+        }
+        int vr = check_python_version();
+        if (vr != 0) { fclose(f); return vr; }
+        const struct payload_entry *dict_e = main_e->codec == CODEC_ZLIB_DICT ? find_entry(ENTRY_DICT, NULL) : NULL;
+        if (dict_e) {
+            dict = malloc((size_t)dict_e->stored_size + 1);
+            if (!dict || fseek(f, payload_start + (long)dict_e->offset, SEEK_SET) != 0 ||
+                fread(dict, 1, (size_t)dict_e->stored_size, f) != dict_e->stored_size) {
+                free(dict);
+                fclose(f);
+                fprintf(stderr, "Invalid payload dictionary\n");
+                return 10;
+            }
+            dict_size = dict_e->stored_size;
+        }
+        payload_start += (long)main_e->offset;
+        payload_size = main_e->stored_size;
+        codec = main_e->codec;
+        raw_size = main_e->raw_size;
+    }
+    if (fseek(f, payload_start, SEEK_SET) != 0) { free(dict); fclose(f); return 10; }
+    if (codec != CODEC_RAW && codec != CODEC_ZLIB && codec != CODEC_ZLIB_DICT) {
+        free(dict);
+        fclose(f);
+        fprintf(stderr, "Unknown payload codec %u\n", codec);
+        return 10;
+    }
+
+    // create temp filename
+    char tmpname[PATH_MAX];
+    const char *td = getenv("TMPDIR");
+    if (!td) td = "/tmp";
+    snprintf(tmpname, sizeof(tmpname), "%s/embedded_payload_%ld.pyc", td, (long)getpid());
+
+    FILE *fp = fopen(tmpname, "wb");
+    if (!fp) { free(dict); fclose(f); fprintf(stderr, "Failed to create temp pyc\n"); return 11; }
+
+    uint64_t remaining = codec == CODEC_RAW ? payload_size : 0;
+    if (codec != CODEC_RAW) {
+        unsigned char *stored = malloc((size_t)payload_size + 1);
+        unsigned char *raw = malloc((size_t)raw_size + 1);
+        int ok = stored && raw && fread(stored, 1, (size_t)payload_size, f) == payload_size &&
+                 inflate_with_dict(stored, payload_size, raw, raw_size, dict, dict_size) == 0 &&
+                 fwrite(raw, 1, (size_t)raw_size, fp) == raw_size;
+        free(stored);
+        free(raw);
+        free(dict);
+        if (!ok) { fclose(fp); fclose(f); remove(tmpname); fprintf(stderr, "Failed to inflate payload\n"); return 11; }
+    }
+    while (remaining > 0) {
+        size_t toread = (remaining > sizeof(buf)) ? sizeof(buf) : (size_t)remaining;
+        size_t got = fread(buf, 1, toread, f);
+        if (got == 0) break;
+        fwrite(buf, 1, got, fp);
+        remaining -= got;
+    }
+    fclose(fp);
+    fclose(f);
+
+    // Now run the pyc using embedded Python
+    set_phase(PHASE_INIT);
+    if (init_python() != 0) { remove(tmpname); return 14; }
+    runtime_python_ready();
+
+    // Create Python code to load and execute the pyc file
+    char py_code_str[2048];
+    int code_len = snprintf(py_code_str, sizeof(py_code_str),
+        "import marshal, pycc\n"
+        "pycc._set_phase(%d)\n"
+        "with open('%s', 'rb') as f:\n"
+        "    data = f.read()\n"
+        "# the pyc header is 16 bytes since Python 3.7; older layouts used 12 or 8.\n"
+        "# Only unmarshalling is retried: the script itself runs once.\n"
+        "code_obj = None\n"
+        "for header in (16, 12, 8):\n"
+        "    try:\n"
+        "        code_obj = marshal.loads(data[header:])\n"
+        "    except Exception:\n"
+        "        continue\n"
+        "    if isinstance(code_obj, type(compile('', '', 'exec'))):\n"
+        "        break\n"
+        "else:\n"
+        "    raise ValueError('embedded payload is not a marshalled code object')\n"
+        "pycc._set_phase(%d)\n"
+        "exec(code_obj)\n",
+        PHASE_UNMARSHAL, tmpname, PHASE_EXEC);
+    if (code_len < 0 || (size_t)code_len >= sizeof(py_code_str)) {
+        fprintf(stderr, "Temp path too long: %s\n", tmpname);
+        Py_FinalizeEx();
+        remove(tmpname);
+        return 13;
+    }
+
+    int result = PyRun_SimpleString(py_code_str);
+    
+    runtime_python_done();
+    set_phase(PHASE_FINALIZE);
+    if (result != 0) {
+        fprintf(stderr, "Failed to execute embedded Python code\n");
+        Py_FinalizeEx();
+        remove(tmpname);
+        return 13;
+    }
+
+    // finalize
+    Py_FinalizeEx();
+
+    // Remove temp pyc
+    remove(tmpname);
+
+    return 0;
+}
+
+// Execute payload code as module `name` instead of __main__, so its
+// `if __name__ == "__main__":` block does not run. Returns the module dict
+// (borrowed) or NULL with an exception set.
+static PyObject *exec_code_as_module(PyObject *code, const char *name) {
+    PyObject *mod = PyImport_AddModule(name);
+    PyObject *d = mod ? PyModule_GetDict(mod) : NULL;
+    if (!d) return NULL;
+    PyObject *builtins = dict_get_ref(d, "__builtins__");
+    if (!builtins) PyDict_SetItemString(d, "__builtins__", PyEval_GetBuiltins());
+    Py_XDECREF(builtins);
+    PyObject *res = PyEval_EvalCode(code, d, d);
+    if (!res) return NULL;
+    Py_DECREF(res);
+    return d;
+}
+
+// Run the payload's worker entry inside the current (sub)interpreter, with
+// the payload executed as module __pycc_worker__.
+static void run_worker_entry(void) {
+    PyObject *code = load_main_code();
+    PyObject *d = code ? exec_code_as_module(code, "__pycc_worker__") : NULL;
+    PyObject *res = NULL;
+    if (d) {
+        PyObject *entry = dict_get_ref(d, workers.entry);
+        if (entry) res = PyObject_CallNoArgs(entry);
+        else { res = NULL; PyErr_Format(PyExc_AttributeError, "payload has no worker entry '%s'", workers.entry); }
+        Py_XDECREF(entry);
+        Py_XDECREF(res);
+    }
+    if (PyErr_Occurred()) {
+        // PyErr_Print() would exit the whole process on SystemExit
+        if (PyErr_ExceptionMatches(PyExc_SystemExit)) PyErr_Clear();
+        else {
+            fprintf(stderr, "[pycc] worker %d failed:\n", worker_index);
+            PyErr_Print();
+        }
+    }
+    Py_XDECREF(code);
+}
+
+static PyInterpreterState *main_interp;
+
+static void *subinterp_worker_main(void *arg) {
+    worker_index = (int)(intptr_t)arg;
+
+    PyThreadState *main_ts = PyThreadState_New(main_interp);
+    PyEval_RestoreThread(main_ts);
+
+    PyThreadState *sub = NULL;
+#if PY_VERSION_HEX >= 0x030C0000
+    // own GIL: the main interpreter's GIL is released once this returns
+    PyInterpreterConfig cfg = {
+        .use_main_obmalloc = 0,
+        .allow_fork = 0,
+        .allow_exec = 0,
+        .allow_threads = 1,
+        .allow_daemon_threads = 0,
+        .check_multi_interp_extensions = 1,
+        .gil = PyInterpreterConfig_OWN_GIL,
+    };
+    PyStatus status = Py_NewInterpreterFromConfig(&sub, &cfg);
+    if (PyStatus_Exception(status)) sub = NULL;
+#else
+    sub = Py_NewInterpreter();
+#endif
+
+    if (sub) {
+        install_import_finder();
+        run_worker_entry();
+        Py_EndInterpreter(sub);
+#if PY_VERSION_HEX >= 0x030C0000
+        PyEval_RestoreThread(main_ts);
+#else
+        PyThreadState_Swap(main_ts);
+#endif
+    } else {
+        fprintf(stderr, "[pycc] worker %d: failed to create subinterpreter\n", worker_index);
+    }
+    PyThreadState_Clear(main_ts);
+    PyThreadState_DeleteCurrent();
+
+    if (__atomic_sub_fetch(&workers.live, 1, __ATOMIC_ACQ_REL) == 0) channel_close(&result_channel);
+    return NULL;
+}
+
+// Start n subinterpreter workers. Called from the main thread with the GIL held.
+static int start_workers(int n) {
+    main_interp = PyInterpreterState_Get();
+    workers.entry = getenv("PYCC_WORKER_ENTRY");
+    if (!workers.entry || !*workers.entry) workers.entry = "worker";
+    workers.threads = calloc((size_t)n, sizeof(pthread_t));
+    if (!workers.threads) return 1;
+#if PY_VERSION_HEX < 0x030C0000
+    if (env_flag("PYCC_TRACE")) fprintf(stderr, "[pycc] subinterpreters share one GIL before Python 3.12\n");
+#endif
+    workers.live = n;
+    for (int i = 0; i < n; ++i) {
+        if (pthread_create(&workers.threads[i], NULL, subinterp_worker_main, (void *)(intptr_t)i) != 0) {
+            workers.live -= n - i;
+            if (workers.live == 0) channel_close(&result_channel);
+            break;
+        }
+        workers.count++;
+    }
+    return 0;
+}
+
+// Close the work channel and wait for every worker. GIL held on entry.
+static void join_workers(void) {
+    if (!workers.count) return;
+    channel_close(&work_channel);
+    Py_BEGIN_ALLOW_THREADS
+    for (int i = 0; i < workers.count; ++i) pthread_join(workers.threads[i], NULL);
+    Py_END_ALLOW_THREADS
+    free(workers.threads);
+    workers.threads = NULL;
+    workers.count = 0;
+}
+
+// Default load path: map the binary and unmarshal the payload in place.
+//   PYCC_SUBINTERPRETERS=n  also run the payload's worker entry in n
+//                           subinterpreters (own GIL on 3.12+)
+//   PYCC_WORKER_ENTRY=name  worker entry function (default "worker")
+// Serve mode (setting serve=stdin or serve=unix:PATH): the payload is
+// imported once as module __pycc_serve__ and its handler (serve.entry,
+// default "handle") is called for every request. Requests are newline-delimited
+// JSON (serve.format=ndjson, the default) or frames of a u32 LE length followed
+// by that many bytes (serve.format=frame). Responses use the same framing; a
+// frame response with SERVE_FRAME_ERROR set in its length carries an error
+// message. With serve.pipeline=n a reader thread parses up to n requests ahead
+// of the handler and responses are flushed once the queue runs dry.
+#define SERVE_MAX_REQUEST (64u << 20)
+#define SERVE_FRAME_ERROR 0x80000000u
+
+enum { SERVE_NDJSON, SERVE_FRAME };
+
+struct serve_conn {
+    int in_fd, out_fd;
+    int is_socket;
+    int format;
+    int eof;
+    int read_errno;
+    char *buf;          // unparsed input
+    size_t len, cap;
+    char *out;          // responses not yet written
+    size_t out_len, out_cap;
+};
+
+static void serve_conn_free(struct serve_conn *c) {
+    free(c->buf);
+    free(c->out);
+    free(c);
+}
+
+// Next request from the connection. Makes no Python calls, so it runs
+// without the GIL. Returns 1 with *msg (caller frees), 0 at end of input,
+// -1 on error (c->read_errno) and -2 when interrupted by a signal.
+static int serve_read(struct serve_conn *c, struct channel_msg **msg) {
+    for (;;) {
+        size_t start = 0, len = 0, used = 0;
+        if (c->format == SERVE_NDJSON) {
+            char *nl = memchr(c->buf, '\n', c->len);
+            if (nl) { len = (size_t)(nl - c->buf); used = len + 1; }
+            else if (c->eof && c->len) { len = used = c->len; }
+            size_t k = 0;
+            while (k < len && isspace((unsigned char)c->buf[k])) ++k;
+            if (used && k == len) {
+                // blank line: skip it
+                memmove(c->buf, c->buf + used, c->len - used);
+                c->len -= used;
+                continue;
+            }
+        } else if (c->len >= 4) {
+            uint32_t n = get_u32_le((const unsigned char *)c->buf);
+            if (n > SERVE_MAX_REQUEST) { c->read_errno = EMSGSIZE; return -1; }
+            if (c->len - 4 >= n) { start = 4; len = n; used = 4 + (size_t)n; }
+        }
+        if (used) {
+            *msg = malloc(sizeof(**msg) + len);
+            if (!*msg) { c->read_errno = ENOMEM; return -1; }
+            (*msg)->len = len;
+            memcpy((*msg)->data, c->buf + start, len);
+            memmove(c->buf, c->buf + used, c->len - used);
+            c->len -= used;
+            return 1;
+        }
+        if (c->eof) return 0;  // a truncated frame is dropped
+        if (c->len > SERVE_MAX_REQUEST + 4) { c->read_errno = EMSGSIZE; return -1; }
+        if (c->len == c->cap) {
+            size_t cap = c->cap ? c->cap * 2 : 65536;
+            char *b = realloc(c->buf, cap);
+            if (!b) { c->read_errno = ENOMEM; return -1; }
+            c->buf = b;
+            c->cap = cap;
+        }
+        ssize_t n = read(c->in_fd, c->buf + c->len, c->cap - c->len);
+        if (n < 0 && errno == EINTR) return -2;
+        if (n < 0) { c->read_errno = errno; return -1; }
+        if (n == 0) c->eof = 1;
+        c->len += (size_t)n;
+    }
+}
+
+static int serve_append(struct serve_conn *c, const void *data, size_t len) {
+    if (c->out_len + len > c->out_cap) {
+        size_t cap = c->out_cap ? c->out_cap : 65536;
+        while (cap < c->out_len + len) cap *= 2;
+        char *o = realloc(c->out, cap);
+        if (!o) return -1;
+        c->out = o;
+        c->out_cap = cap;
+    }
+    memcpy(c->out + c->out_len, data, len);
+    c->out_len += len;
+    return 0;
+}
+
+// Write buffered responses. Returns 0, or -1 once the peer is gone.
+static int serve_flush(struct serve_conn *c) {
+    size_t off = 0;
+    int rc = 0;
+    Py_BEGIN_ALLOW_THREADS
+    while (off < c->out_len) {
+        ssize_t n = c->is_socket ? send(c->out_fd, c->out + off, c->out_len - off, MSG_NOSIGNAL)
+                                 : write(c->out_fd, c->out + off, c->out_len - off);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) { rc = -1; break; }
+        off += (size_t)n;
+    }
+    Py_END_ALLOW_THREADS
+    c->out_len = 0;
+    return rc;
+}
+
+// "Type: message" for the raised exception, which is cleared.
+static PyObject *exception_summary(void) {
+#if PY_VERSION_HEX >= 0x030C0000
+    PyObject *exc = PyErr_GetRaisedException();
+#else
+    PyObject *type, *exc, *tb;
+    PyErr_Fetch(&type, &exc, &tb);
+    PyErr_NormalizeException(&type, &exc, &tb);
+    Py_XDECREF(type);
+    Py_XDECREF(tb);
+#endif
+    PyObject *text = exc ? PyUnicode_FromFormat("%s: %S", Py_TYPE(exc)->tp_name, exc) : NULL;
+    Py_XDECREF(exc);
+    return text;
+}
+
+struct serve_handler {
+    PyObject *entry;
+    PyObject *loads, *dumps;    // json functions, ndjson only
+};
+
+// Call the handler for one request and buffer its response. Exceptions
+// derived from Exception become error responses; anything else (SystemExit,
+// KeyboardInterrupt) is left set and -1 returned to stop serving.
+static int serve_respond(struct serve_conn *c, const struct serve_handler *h, const struct channel_msg *msg) {
+    PyObject *req = PyBytes_FromStringAndSize(msg->data, (Py_ssize_t)msg->len);
+    if (req && c->format == SERVE_NDJSON) Py_SETREF(req, PyObject_CallOneArg(h->loads, req));
+    PyObject *res = req ? PyObject_CallOneArg(h->entry, req) : NULL;
+    Py_XDECREF(req);
+
+    int rc = -1;
+    PyObject *out = NULL;
+    if (res && c->format == SERVE_NDJSON) {
+        out = PyObject_CallOneArg(h->dumps, res);
+    } else if (res && res == Py_None) {
+        out = PyBytes_FromStringAndSize("", 0);
+    } else if (res && PyUnicode_Check(res)) {
+        out = PyUnicode_AsUTF8String(res);
+    } else if (res) {
+        out = PyBytes_FromObject(res);
+    }
+    Py_XDECREF(res);
+
+    int failed = out == NULL;
+    if (failed) {
+        if (!PyErr_ExceptionMatches(PyExc_Exception)) return -1;
+        PyObject *text = exception_summary();
+        if (text && c->format == SERVE_NDJSON) {
+            PyObject *err = Py_BuildValue("{sO}", "error", text);
+            out = err ? PyObject_CallOneArg(h->dumps, err) : NULL;
+            Py_XDECREF(err);
+        } else if (text) {
+            out = PyUnicode_AsUTF8String(text);
+        }
+        Py_XDECREF(text);
+        if (!out) return -1;
+    }
+
+    const char *data;
+    Py_ssize_t len;
+    if (PyUnicode_Check(out)) data = PyUnicode_AsUTF8AndSize(out, &len);
+    else if (PyBytes_AsStringAndSize(out, (char **)&data, &len) != 0) data = NULL;
+    if (!data) goto end;
+    if (c->format == SERVE_NDJSON) {
+        if (serve_append(c, data, (size_t)len) != 0 || serve_append(c, "\n", 1) != 0) { PyErr_NoMemory(); goto end; }
+    } else {
+        unsigned char hdr[4];
+        put_u32_le(hdr, (uint32_t)len | (failed ? SERVE_FRAME_ERROR : 0));
+        if ((uint64_t)len >= SERVE_FRAME_ERROR) { PyErr_SetString(PyExc_OverflowError, "response frame too large"); goto end; }
+        if (serve_append(c, hdr, 4) != 0 || serve_append(c, data, (size_t)len) != 0) { PyErr_NoMemory(); goto end; }
+    }
+    rc = 0;
+
+end:
+    Py_DECREF(out);
+    return rc;
+}
+
+struct serve_reader {
+    struct serve_conn *conn;
+    struct channel ch;
+    int done;           // under ch.mu
+};
+
+static void *serve_reader_main(void *arg) {
+    struct serve_reader *rd = arg;
+    for (;;) {
+        struct channel_msg *msg;
+        int r = serve_read(rd->conn, &msg);
+        if (r == -2) continue;
+        if (r < 0) fprintf(stderr, "[pycc] serve: read failed: %s\n", strerror(rd->conn->read_errno));
+        if (r <= 0 || channel_push(&rd->ch, msg) != 0) break;
+    }
+    channel_close(&rd->ch);
+    pthread_mutex_lock(&rd->ch.mu);
+    rd->done = 1;
+    pthread_mutex_unlock(&rd->ch.mu);
+    return NULL;
+}
+
+// Serve one connection until end of input. Returns -1 with an exception set
+// when serving must stop. Takes ownership of c.
+static int serve_connection(struct serve_conn *c, const struct serve_handler *h, long pipeline) {
+    int rc = 0;
+    if (pipeline <= 0) {
+        for (;;) {
+            struct channel_msg *msg = NULL;
+            int r;
+            Py_BEGIN_ALLOW_THREADS
+            r = serve_read(c, &msg);
+            Py_END_ALLOW_THREADS
+            if (r == -2) {
+                if (PyErr_CheckSignals() < 0) { rc = -1; break; }
+                continue;
+            }
+            if (r < 0) fprintf(stderr, "[pycc] serve: read failed: %s\n", strerror(c->read_errno));
+            if (r <= 0) break;
+            r = serve_respond(c, h, msg);
+            free(msg);
+            if (r != 0) { rc = -1; break; }
+            if (serve_flush(c) != 0) break;
+        }
+        serve_flush(c);
+        serve_conn_free(c);
+        return rc;
+    }
+
+    struct serve_reader *rd = calloc(1, sizeof(*rd));
+    if (!rd) { serve_conn_free(c); PyErr_NoMemory(); return -1; }
+    rd->conn = c;
+    pthread_mutex_init(&rd->ch.mu, NULL);
+    pthread_cond_init(&rd->ch.cv, NULL);
+    rd->ch.capacity = (size_t)pipeline;
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, serve_reader_main, rd) != 0) {
+        free(rd);
+        serve_conn_free(c);
+        PyErr_SetString(PyExc_RuntimeError, "cannot start serve reader thread");
+        return -1;
+    }
+    for (;;) {
+        struct channel_msg *msg;
+        int closed;
+        Py_BEGIN_ALLOW_THREADS
+        msg = channel_get(&rd->ch, 100, &closed);
+        Py_END_ALLOW_THREADS
+        if (!msg) {
+            if (closed) break;
+            if (PyErr_CheckSignals() < 0) { rc = -1; break; }
+            continue;
+        }
+        int r = serve_respond(c, h, msg);
+        free(msg);
+        if (r != 0) { rc = -1; break; }
+        if (channel_empty(&rd->ch) && serve_flush(c) != 0) break;
+    }
+    serve_flush(c);
+
+    // stop the reader; one blocked on a pipe cannot be woken, so it is left
+    // to die with the process along with what it references
+    channel_close(&rd->ch);
+    if (c->is_socket) shutdown(c->in_fd, SHUT_RDWR);
+    int reader_done;
+    pthread_mutex_lock(&rd->ch.mu);
+    reader_done = rd->done;
+    pthread_mutex_unlock(&rd->ch.mu);
+    if (!c->is_socket && !reader_done) {
+        pthread_detach(tid);
+        return rc;
+    }
+    Py_BEGIN_ALLOW_THREADS
+    pthread_join(tid, NULL);
+    Py_END_ALLOW_THREADS
+    struct channel_msg *m;
+    while ((m = rd->ch.head) != NULL) { rd->ch.head = m->next; free(m); }
+    pthread_mutex_destroy(&rd->ch.mu);
+    pthread_cond_destroy(&rd->ch.cv);
+    free(rd);
+    serve_conn_free(c);
+    return rc;
+}
+
+static struct serve_conn *serve_conn_new(int in_fd, int out_fd, int is_socket, int format) {
+    struct serve_conn *c = calloc(1, sizeof(*c));
+    if (!c) return NULL;
+    c->in_fd = in_fd;
+    c->out_fd = out_fd;
+    c->is_socket = is_socket;
+    c->format = format;
+    return c;
+}
+
+static int serve_unix(const char *path, const struct serve_handler *h, int format, long pipeline) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        PyErr_Format(PyExc_ValueError, "socket path too long: %s", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+    int lfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (lfd < 0) { PyErr_SetFromErrno(PyExc_OSError); return -1; }
+    unlink(path);
+    if (bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(lfd, 64) != 0) {
+        PyErr_SetFromErrnoWithFilename(PyExc_OSError, path);
+        close(lfd);
+        return -1;
+    }
+    if (env_flag("PYCC_TRACE")) fprintf(stderr, "[pycc] serving on %s\n", path);
+
+    int rc = 0;
+    for (;;) {
+        // a SIGINT taken while serve_connection() was joining its reader or
+        // flushing only set Python's pending flag; accept4() would not wake
+        if (PyErr_CheckSignals() != 0) { rc = -1; break; }
+        int fd;
+        Py_BEGIN_ALLOW_THREADS
+        fd = accept4(lfd, NULL, NULL, SOCK_CLOEXEC);
+        Py_END_ALLOW_THREADS
+        if (fd < 0) {
+            if (errno == EINTR && PyErr_CheckSignals() == 0) continue;
+            if (!PyErr_Occurred()) PyErr_SetFromErrno(PyExc_OSError);
+            rc = -1;
+            break;
+        }
+        struct serve_conn *c = serve_conn_new(fd, fd, 1, format);
+        if (!c) { close(fd); PyErr_NoMemory(); rc = -1; break; }
+        rc = serve_connection(c, h, pipeline);
+        close(fd);
+        if (rc != 0) break;
+    }
+    close(lfd);
+    unlink(path);
+    return rc;
+}
+
+// Import the payload and serve requests until input ends (stdin) or the
+// process is interrupted (socket). Returns 0, or -1 with an exception set.
+static int run_serve(PyObject *code) {
+    const char *spec = setting("serve");
+    const char *entry_name = setting("serve.entry");
+    const char *format_name = setting("serve.format");
+    const char *pipeline_str = setting("serve.pipeline");
+    if (!entry_name) entry_name = "handle";
+    long pipeline = pipeline_str ? strtol(pipeline_str, NULL, 10) : 0;
+    int format;
+    if (!format_name || strcmp(format_name, "ndjson") == 0) format = SERVE_NDJSON;
+    else if (strcmp(format_name, "frame") == 0) format = SERVE_FRAME;
+    else { PyErr_Format(PyExc_ValueError, "unknown serve.format '%s' (use ndjson or frame)", format_name); return -1; }
+
+    PyObject *d = exec_code_as_module(code, "__pycc_serve__");
+    if (!d) return -1;
+    struct serve_handler h = { dict_get_ref(d, entry_name), NULL, NULL };
+    if (!h.entry) {
+        if (!PyErr_Occurred()) PyErr_Format(PyExc_AttributeError, "payload has no serve entry '%s'", entry_name);
+        return -1;
+    }
+    int rc = -1;
+    if (format == SERVE_NDJSON) {
+        PyObject *json = PyImport_ImportModule("json");
+        h.loads = json ? PyObject_GetAttrString(json, "loads") : NULL;
+        h.dumps = json ? PyObject_GetAttrString(json, "dumps") : NULL;
+        Py_XDECREF(json);
+        if (!h.loads || !h.dumps) goto end;
+    }
+
+    if (strcmp(spec, "stdin") == 0 || strcmp(spec, "1") == 0) {
+        // responses get a private copy of stdout; print() in the handler goes
+        // to stderr instead of corrupting the response stream
+        int out_fd = dup(1);
+        if (out_fd < 0 || dup2(2, 1) < 0) { PyErr_SetFromErrno(PyExc_OSError); goto end; }
+        struct serve_conn *c = serve_conn_new(0, out_fd, 0, format);
+        if (!c) { PyErr_NoMemory(); goto end; }
+        rc = serve_connection(c, &h, pipeline);
+        close(out_fd);
+    } else if (strncmp(spec, "unix:", 5) == 0) {
+        rc = serve_unix(spec + 5, &h, format, pipeline);
+    } else {
+        PyErr_Format(PyExc_ValueError, "unknown serve target '%s' (use stdin or unix:PATH)", spec);
+    }
+
+end:
+    if (rc != 0 && PyErr_ExceptionMatches(PyExc_KeyboardInterrupt)) {
+        PyErr_Clear();
+        rc = 0;
+    }
+    Py_XDECREF(h.entry);
+    Py_XDECREF(h.loads);
+    Py_XDECREF(h.dumps);
+    return rc;
+}
+
+static int run_payload_mapped(FILE *f, long payload_start, uint64_t payload_size) {
+    set_phase(PHASE_LOAD);
+    int mr = map_payload(f, payload_start, payload_size);
+    fclose(f);
+    if (mr != 0) { fprintf(stderr, "Failed to map payload\n"); return 12; }
+    if (launch.mp_role == MP_NONE && launch.argc == 3 && strcmp(launch.argv[1], "--pycc-install") == 0) {
+        int ir = install_entry_links(launch.argv[2]);
+        unmap_payload();
+        return ir;
+    }
+    select_entry();
+    int vr = check_python_version();
+    if (vr != 0) { unmap_payload(); return vr; }
+
+    set_phase(PHASE_INIT);
+    if (init_python() != 0) { unmap_payload(); return 14; }
+    runtime_python_ready();
+
+    long nworkers = launch.mp_role == MP_NONE ? env_long("PYCC_SUBINTERPRETERS", 0) : 0;
+    if (nworkers > 0) start_workers((int)nworkers);
+    else channel_close(&result_channel); // no producers: get_result() returns None
+
+    set_phase(PHASE_UNMARSHAL);
+    PyObject *code = load_main_code();
+
+    int result = -1;
+    if (code && launch.mp_role != MP_NONE) {
+        set_phase(PHASE_EXEC);
+        result = run_mp_child(code);
+        Py_DECREF(code);
+    } else if (code && setting("serve")) {
+        set_phase(PHASE_EXEC);
+        result = run_serve(code);
+        Py_DECREF(code);
+    } else if (code) {
+        set_phase(PHASE_EXEC);
+        PyObject *main_mod = PyImport_AddModule("__main__");
+        PyObject *d = main_mod ? PyModule_GetDict(main_mod) : NULL;
+        PyObject *res = d ? PyEval_EvalCode(code, d, d) : NULL;
+        if (res) { Py_DECREF(res); result = 0; }
+        Py_DECREF(code);
+    }
+    // workers must be gone before PyErr_Print() can exit on SystemExit
+    join_workers();
+    if (result != 0) PyErr_Print();
+
+    runtime_python_done();
+    set_phase(PHASE_FINALIZE);
+    if (result != 0) {
+        fprintf(stderr, "Failed to execute embedded Python code\n");
+        Py_FinalizeEx();
+        frame_cache_stop();
+        unmap_payload();
+        return 13;
+    }
+
+    Py_FinalizeEx();
+    frame_cache_stop();
+    unmap_payload();
+    return 0;
+}
+
+// Find the appended payload in self and run it with embedded Python
+static int run_appended_payload() {
+    char selfpath[4096];
+
+    if (!get_payload_path(selfpath, sizeof(selfpath))) {
+        fprintf(stderr, "Failed to get self path\n");
+        return 1;
+    }
+
+    FILE *f = fopen(selfpath, "rb");
+    if (!f) {
+        fprintf(stderr, "Failed to open self binary\n");
+        return 2;
+    }
+
+    // find footer at end
+    long payload_start = 0;
+    uint64_t payload_size = 0;
+    int lr = locate_payload(f, &payload_start, &payload_size, &payload.flags);
+    if (lr != 0) {
+        fclose(f);
+        if (lr == 7) fprintf(stderr, "No embedded payload found in binary\n");
+        else if (lr == 8) fprintf(stderr, "Embedded payload size is zero\n");
+        else if (lr == 9) fprintf(stderr, "Invalid payload start\n");
+        return lr;
+    }
+
+    const char *load = getenv("PYCC_LOAD");
+    if (load && strcmp(load, "tempfile") == 0 && launch.mp_role == MP_NONE) {
+        return run_payload_tempfile(f, payload_start, payload_size);
+    }
+    return run_payload_mapped(f, payload_start, payload_size);
+}
+
+// Options accepted after `--build <script.py> <out_binary>`.
+struct build_options {
+    uint32_t footer_flags;
+    char meta[8192];            // settings entry, "key=value" lines
+    size_t meta_len;
+    struct build_source {
+        uint8_t kind;           // ENTRY_MAIN for --entry, ENTRY_MODULE for --module,
+                                // ENTRY_RESOURCE for --resource
+        const char *spec;       // NAME=PATH
+    } *sources;                 // one slot per two argv words, freed by the caller
+    int nsources;
+    int seal_path;
+    int compress;               // --compress: zlib code entries, 2 = --compress-dict
+    uint32_t resource_frame;    // --compress-resources: frame size, 0 = raw
+    int quiet;                  // no "[*]" lines (libpycc PYCC_BUILD_QUIET)
+    const char *stub;           // --stub: stub to copy instead of this binary
+    const char *depfile;        // --depfile: Makefile-format dependency list
+    int watch;                  // --watch: rebuild whenever a source changes
+    int64_t fixed_mtime;        // --reproducible: pyc header mtime, else -1
+    pycc_progress_fn progress;  // libpycc progress callback
+    void *progress_ctx;
+    uint64_t start_ns;
+    unsigned compiled, to_compile;
+    const char *thin_runtime;   // --thin: runtime path for the #! line
+    char default_runtime[PATH_MAX];
+};
+
+static int add_setting(struct build_options *opts, const char *key, const char *value) {
+    size_t room = sizeof(opts->meta) - opts->meta_len;
+    int n = snprintf(opts->meta + opts->meta_len, room, "%s=%s\n", key, value);
+    if (n < 0 || (size_t)n >= room || strchr(value, '\n')) {
+        fprintf(stderr, "Build setting too long: %s\n", key);
+        return 1;
+    }
+    opts->meta_len += (size_t)n;
+    return 0;
+}
+
+static int parse_build_options(int argc, char **argv, int first, struct build_options *opts) {
+    memset(opts, 0, sizeof(*opts));
+    char version[16];
+    snprintf(version, sizeof(version), "%d.%d", PY_MAJOR_VERSION, PY_MINOR_VERSION);
+    add_setting(opts, "python_version", version);
+    opts->sources = calloc((size_t)argc / 2 + 1, sizeof(*opts->sources));
+    if (!opts->sources) return 1;
+    opts->fixed_mtime = -1;
+#ifdef Py_GIL_DISABLED
+    // free-threaded stub: payloads run without the GIL unless told otherwise
+    opts->footer_flags |= FOOTER_FLAG_FREE_THREADED;
+#endif
+    for (int i = first; i < argc; ++i) {
+        int r = 0;
+        if (strcmp(argv[i], "--require-gil") == 0) {
+            opts->footer_flags &= ~FOOTER_FLAG_FREE_THREADED;
+        } else if (strcmp(argv[i], "--gc-freeze") == 0) {
+            r = add_setting(opts, "gc.freeze", "fork");
+        } else if (strncmp(argv[i], "--gc-freeze=", 12) == 0) {
+            r = add_setting(opts, "gc.freeze", argv[i] + 12);
+        } else if (strcmp(argv[i], "--gc-threshold") == 0 && i + 1 < argc) {
+            r = add_setting(opts, "gc.threshold", argv[++i]);
+        } else if (strcmp(argv[i], "--immortalize") == 0) {
+            r = add_setting(opts, "code.immortal", "1");
+        } else if ((strcmp(argv[i], "--module") == 0 || strcmp(argv[i], "--entry") == 0 ||
+                    strcmp(argv[i], "--resource") == 0) && i + 1 < argc) {
+            if (!strchr(argv[i + 1], '=')) {
+                fprintf(stderr, "Bad %s option: %s\n", argv[i], argv[i + 1]);
+                return 1;
+            }
+            opts->sources[opts->nsources].kind = argv[i][2] == 'e' ? ENTRY_MAIN
+                                               : argv[i][2] == 'r' ? ENTRY_RESOURCE : ENTRY_MODULE;
+            opts->sources[opts->nsources++].spec = argv[++i];
+        } else if (strcmp(argv[i], "--thin") == 0) {
+            snprintf(opts->default_runtime, sizeof(opts->default_runtime), "%s/runtime-%d.%d",
+                     PYCC_RUNTIME_DIR, PY_MAJOR_VERSION, PY_MINOR_VERSION);
+            opts->thin_runtime = opts->default_runtime;
+        } else if (strncmp(argv[i], "--thin=", 7) == 0) {
+            opts->thin_runtime = argv[i] + 7;
+        } else if (strcmp(argv[i], "--compress") == 0) {
+            if (!opts->compress) opts->compress = 1;
+        } else if (strcmp(argv[i], "--compress-dict") == 0) {
+            opts->compress = 2;
+        } else if (strcmp(argv[i], "--compress-resources") == 0) {
+            opts->resource_frame = RESOURCE_FRAME_DEFAULT;
+        } else if (strncmp(argv[i], "--compress-resources=", 21) == 0) {
+            long kb = atol(argv[i] + 21);
+            if (kb < 4 || kb > (1L << 20)) {
+                fprintf(stderr, "Bad frame size (KB): %s\n", argv[i] + 21);
+                return 1;
+            }
+            opts->resource_frame = (uint32_t)kb << 10;
+        } else if (strcmp(argv[i], "--stub") == 0 && i + 1 < argc) {
+            opts->stub = argv[++i];
+        } else if (strcmp(argv[i], "--depfile") == 0 && i + 1 < argc) {
+            opts->depfile = argv[++i];
+        } else if (strcmp(argv[i], "--watch") == 0) {
+            opts->watch = 1;
+        } else if (strcmp(argv[i], "--reproducible") == 0) {
+            // the only build-time input in the output besides the sources
+            const char *epoch = getenv("SOURCE_DATE_EPOCH");
+            opts->fixed_mtime = epoch ? (int64_t)strtoull(epoch, NULL, 10) & 0xffffffff : 0;
+        } else if (strcmp(argv[i], "--seal-path") == 0) {
+            opts->seal_path = 1;
+        } else if (strcmp(argv[i], "--no-import-finder") == 0) {
+            r = add_setting(opts, "import.finder", "0");
+        } else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc) {
+            r = add_setting(opts, "serve", argv[++i]);
+        } else if (strcmp(argv[i], "--serve-format") == 0 && i + 1 < argc) {
+            r = add_setting(opts, "serve.format", argv[++i]);
+        } else if (strcmp(argv[i], "--serve-entry") == 0 && i + 1 < argc) {
+            r = add_setting(opts, "serve.entry", argv[++i]);
+        } else if (strcmp(argv[i], "--serve-pipeline") == 0 && i + 1 < argc) {
+            r = add_setting(opts, "serve.pipeline", argv[++i]);
+        } else {
+            fprintf(stderr, "Unknown build option: %s\n", argv[i]);
+            return 1;
+        }
+        if (r != 0) return r;
+    }
+    return 0;
+}
+
+// Builder status line on stdout, unless the build is quiet.
+static void build_log(const struct build_options *opts, const char *fmt, ...) {
+    if (opts->quiet) return;
+    va_list ap;
+    va_start(ap, fmt);
+    vprintf(fmt, ap);
+    va_end(ap);
+}
+
+static void build_progress(const struct build_options *opts, int stage, const char *name, uint64_t bytes) {
+    if (!opts->progress) return;
+    struct pycc_progress p = { stage, name, opts->compiled, opts->to_compile, (unsigned long long)bytes,
+                               (double)(now_ns() - opts->start_ns) / 1e6 };
+    opts->progress(opts->progress_ctx, &p);
+}
+
+// Compile source i of the reader (or, for a resource, copy it) and add it
+// to the payload. The calling thread must hold the GIL; it is released
+// while the read is outstanding.
+static int compile_entry(struct payload_builder *pb, struct build_options *opts, struct source_reader *reader, int i,
+                         uint8_t kind, const char *name, uint32_t flags) {
+    struct source_read *f;
+    Py_BEGIN_ALLOW_THREADS
+    f = source_reader_wait(reader, i);
+    Py_END_ALLOW_THREADS
+    build_log(opts, kind == ENTRY_RESOURCE ? "[*] Adding resource %s\n" : "[*] Compiling %s\n", f->path);
+    if (f->err != 0) { fprintf(stderr, "Cannot read %s: %s\n", f->path, strerror(f->err)); return 1; }
+    unsigned char *pyc = NULL;
+    uint64_t pyc_size = 0;
+    int r = 0;
+    if (kind == ENTRY_RESOURCE) {
+        pyc_size = f->size;
+        pyc = malloc(pyc_size ? (size_t)pyc_size : 1);
+        if (!pyc) return 1;
+        memcpy(pyc, f->data, (size_t)pyc_size);
+    } else {
+        r = compile_to_pyc(f->path, f->data, f->size, opts->fixed_mtime >= 0 ? (uint32_t)opts->fixed_mtime : f->mtime,
+                           &pyc, &pyc_size);
+    }
+    if (r != 0) {
+        fprintf(stderr, "[!] Compile failed (code %d)\n", r);
+        return r;
+    }
+    if (pb_add(pb, kind, name, pyc, pyc_size) != 0) return 1;
+    pb->entries[pb->count - 1].flags = flags;
+    opts->compiled++;
+    build_progress(opts, PYCC_STAGE_COMPILE, name, pyc_size);
+    return 0;
+}
+
+// Entry name, source path and entry flags of --module/--entry/--resource
+// source i.
+static int build_source_info(const struct build_options *opts, int i, char *name, size_t name_size,
+                             const char **path, uint32_t *flags) {
+    const char *spec = opts->sources[i].spec;
+    const char *eq = strchr(spec, '=');
+    size_t len = (size_t)(eq - spec);
+    if (len == 0 || len >= name_size) { fprintf(stderr, "[!] Bad name: %s\n", spec); return 1; }
+    memcpy(name, spec, len);
+    name[len] = '\0';
+    *path = eq + 1;
+    const char *base = strrchr(*path, '/');
+    base = base ? base + 1 : *path;
+    uint8_t kind = opts->sources[i].kind;
+    if (kind == ENTRY_MAIN && (strcmp(name, "__main__") == 0 || strchr(name, '/'))) {
+        fprintf(stderr, "[!] Bad entry name: %s\n", name);
+        return 1;
+    }
+    *flags = kind == ENTRY_MODULE && strcmp(base, "__init__.py") == 0 ? ENTRY_FLAG_PACKAGE : 0;
+    return 0;
+}
+
+// Write path as one make word: blanks and '#' escaped with a backslash, '$' as "$$".
+static int depfile_word(FILE *f, const char *path) {
+    for (const char *p = path; *p; ++p) {
+        if (*p == ' ' || *p == '\t' || *p == '#') fputc('\\', f);
+        else if (*p == '$') fputc('$', f);
+        else if (*p == '\n') { fprintf(stderr, "Cannot list %s in a depfile\n", path); return 1; }
+        fputc(*p, f);
+    }
+    return 0;
+}
+
+// --depfile: "out: script modules... stub" in Makefile syntax, plus an empty
+// rule per prerequisite (as gcc -MP) so make and ninja don't fail once a
+// module is deleted from the build. Thin binaries don't copy the runtime, so
+// they list no stub.
+static int write_depfile(const struct build_options *opts, const char *out_exe, const char *script, const char *stub) {
+    FILE *f = fopen(opts->depfile, "w");
+    if (!f) { fprintf(stderr, "Cannot write %s: %s\n", opts->depfile, strerror(errno)); return 1; }
+    int r = depfile_word(f, out_exe);
+    fputs(":", f);
+    for (int pass = 0; pass < 2 && r == 0; ++pass) {
+        for (int i = -1; i <= opts->nsources && r == 0; ++i) {
+            const char *dep = i < 0 ? script : i < opts->nsources ? strchr(opts->sources[i].spec, '=') + 1 : stub;
+            if (!dep) continue;
+            fputs(pass == 0 ? " \\\n  " : "\n", f);
+            r = depfile_word(f, dep);
+            if (pass == 1) fputs(":\n", f);
+        }
+        if (pass == 0) fputs("\n", f);
+    }
+    if (fclose(f) != 0 && r == 0) { fprintf(stderr, "Write error: %s\n", opts->depfile); r = 1; }
+    if (r != 0) remove(opts->depfile);
+    return r;
+}
+
+// path.sealed: the build interpreter's sys.path (PYTHONPATH included).
+static int capture_sys_path(struct build_options *opts) {
+    PyObject *path = PySys_GetObject("path");
+    char buf[4096 - 48];
+    size_t n = 0;
+    for (Py_ssize_t i = 0; path && PyList_Check(path) && i < PyList_GET_SIZE(path); ++i) {
+        const char *p = PyUnicode_Check(PyList_GET_ITEM(path, i)) ? PyUnicode_AsUTF8(PyList_GET_ITEM(path, i)) : NULL;
+        if (!p || !*p) { PyErr_Clear(); continue; }
+        int w = snprintf(buf + n, sizeof(buf) - n, "%s%s", n ? ":" : "", p);
+        if (w < 0 || (size_t)w >= sizeof(buf) - n) { fprintf(stderr, "[!] sys.path too long to seal\n"); return 1; }
+        n += (size_t)w;
+    }
+    buf[n] = '\0';
+    build_log(opts, "[*] Sealed sys.path: %s\n", buf);
+    return add_setting(opts, "path.sealed", buf);
+}
+
+// Builder mode: compile the script (and any --module/--entry files) in
+// memory and write the output exe in one pass, the stub copy running on a
+// second thread while Python starts up and compiles. Inside a running
+// interpreter (libpycc) the build borrows it and holds the GIL only while
+// compiling; otherwise it initializes and finalizes its own.
+static int builder_mode(const char *script_path, const char *out_exe_path, struct build_options *opts) {
+    char selfpath[4096];
+    opts->start_ns = now_ns();
+    opts->compiled = 0;
+    opts->to_compile = 1 + (unsigned)opts->nsources;
+    if (opts->stub) {
+        snprintf(selfpath, sizeof(selfpath), "%s", opts->stub);
+    } else {
+#ifdef PYCC_LIBRARY
+        if (!opts->thin_runtime) { fprintf(stderr, "No stub given: pass --stub <pycc>\n"); return 1; }
+#endif
+        if (!get_self_path(selfpath, sizeof(selfpath))) {
+            fprintf(stderr, "Cannot get self path for stub copy\n");
+            return 1;
+        }
+    }
+
+    int out_fd = open(out_exe_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0755);
+    if (out_fd < 0) { fprintf(stderr, "Failed to create output exe: %s\n", out_exe_path); return 1; }
+    struct stub_copy copy;
+    if (opts->thin_runtime) build_log(opts, "[*] Thin binary using runtime %s\n", opts->thin_runtime);
+    if (stub_copy_start(&copy, selfpath, opts->thin_runtime, out_fd) != 0) {
+        close(out_fd);
+        remove(out_exe_path);
+        return 1;
+    }
+
+    // sources are read on their own thread while Python starts
+    const char **paths = calloc((size_t)opts->nsources + 1, sizeof(*paths));
+    char (*names)[256] = calloc((size_t)opts->nsources + 1, sizeof(*names));
+    uint32_t *flags = calloc((size_t)opts->nsources + 1, sizeof(*flags));
+    struct source_reader reader = {0};
+    int r = paths && names && flags ? 0 : 1;
+    if (r == 0) {
+        paths[0] = script_path;
+        snprintf(names[0], sizeof(names[0]), "__main__");
+    }
+    for (int i = 0; r == 0 && i < opts->nsources; ++i) {
+        r = build_source_info(opts, i, names[i + 1], sizeof(names[i + 1]), &paths[i + 1], &flags[i + 1]);
+    }
+    if (r == 0) r = source_reader_start(&reader, paths, opts->nsources + 1);
+
+    struct payload_builder pb = {0};
+    int own_python = !Py_IsInitialized();
+    PyGILState_STATE gil = PyGILState_UNLOCKED;
+    if (r == 0) {
+        if (own_python) Py_Initialize();
+        else gil = PyGILState_Ensure();
+        for (int i = 0; r == 0 && i <= opts->nsources; ++i) {
+            r = compile_entry(&pb, opts, &reader, i, i ? opts->sources[i - 1].kind : ENTRY_MAIN, names[i], flags[i]);
+        }
+        if (r == 0 && opts->seal_path) r = capture_sys_path(opts);
+        if (own_python) Py_FinalizeEx();
+        else PyGILState_Release(gil);
+    }
+    source_reader_finish(&reader);
+    free(paths);
+    free(names);
+    free(flags);
+    if (r == 0 && (opts->compress || opts->resource_frame)) {
+        if (opts->compress) r = opts->compress == 2 ? pb_compress_dict(&pb) : pb_compress(&pb);
+        if (r == 0 && opts->resource_frame) r = pb_compress_resources(&pb, opts->resource_frame);
+        build_progress(opts, PYCC_STAGE_COMPRESS, NULL, 0);
+    }
+
+    if (r == 0) {
+        unsigned char *meta = malloc(opts->meta_len);
+        if (meta) memcpy(meta, opts->meta, opts->meta_len);
+        if (!meta || pb_add(&pb, ENTRY_META, "meta", meta, opts->meta_len) != 0) r = 1;
+    }
+    size_t payload_len = 0;
+    unsigned char *payload_buf = r == 0 ? serialize_payload(&pb, copy.size, opts->footer_flags, &payload_len) : NULL;
+    pb_free(&pb);
+    if (r == 0) {
+        build_log(opts, "[*] Writing payload to %s\n", out_exe_path);
+        if (!payload_buf || pwrite_all(out_fd, payload_buf, payload_len, copy.size) != 0) {
+            fprintf(stderr, "[!] Failed to write payload\n");
+            r = 1;
+        }
+        build_progress(opts, PYCC_STAGE_WRITE, NULL, payload_len);
+    }
+    free(payload_buf);
+
+    pthread_join(copy.thread, NULL);
+    if (r == 0 && copy.rc != 0) { fprintf(stderr, "[!] Failed to copy stub\n"); r = 1; }
+    if (r == 0) build_progress(opts, PYCC_STAGE_STUB, NULL, copy.size);
+    if (close(out_fd) != 0 && r == 0) { fprintf(stderr, "Write error\n"); r = 1; }
+    if (r != 0) {
+        remove(out_exe_path);
+        return r;
+    }
+    // the mode given to open() only applies to new files
+    chmod(out_exe_path, 0755);
+    if (opts->depfile && write_depfile(opts, out_exe_path, script_path, opts->thin_runtime ? NULL : selfpath) != 0) {
+        remove(out_exe_path);
+        return 1;
+    }
+
+    build_log(opts, "[+] Built %s successfully\n", out_exe_path);
+    build_progress(opts, PYCC_STAGE_DONE, NULL, copy.size + payload_len);
+    return 0;
+}
+
+// --watch state: one cached payload entry per source, in payload order
+// (script first, meta last), and the stub image kept in memory.
+struct watch_state {
+    struct build_options *opts;
+    const char *out_exe;
+    struct payload_builder pb;
+    const char **paths;         // source path of pb.entries[i]
+    int *wds;                   // inotify watch on the source's directory
+    int nsources;
+    unsigned char *stub;        // stub bytes, or the #! line of a thin binary
+    uint64_t stub_size;
+    const char *stub_path;
+    int stub_wd;
+};
+
+// Compile source i into its cached entry; on a compile error the previous
+// entry stays.
+static int watch_compile(struct watch_state *w, int i) {
+    unsigned char *pyc = NULL;
+    uint64_t size = 0, src_size = 0;
+    build_log(w->opts, "[*] Compiling %s\n", w->paths[i]);
+    unsigned char *src = read_file(w->paths[i], &src_size);
+    struct stat st;
+    if (!src || stat(w->paths[i], &st) != 0) {
+        fprintf(stderr, "Cannot read %s: %s\n", w->paths[i], strerror(errno));
+        free(src);
+        return 1;
+    }
+    src[src_size] = '\0';
+    int r = 0;
+    if (w->pb.entries[i].kind == ENTRY_RESOURCE) {
+        pyc = src;
+        size = src_size;
+    } else {
+        r = compile_to_pyc(w->paths[i], src, src_size,
+                           w->opts->fixed_mtime >= 0 ? (uint32_t)w->opts->fixed_mtime : (uint32_t)st.st_mtime, &pyc, &size);
+        free(src);
+    }
+    if (r != 0) return 1;
+    struct build_entry *e = &w->pb.entries[i];
+    free(e->data);
+    e->data = pyc;
+    e->size = e->raw_size = size;
+    e->codec = CODEC_RAW;
+    return 0;
+}
+
+static int watch_load_stub(struct watch_state *w) {
+    free(w->stub);
+    w->stub = NULL;
+    if (w->opts->thin_runtime) {
+        char line[512];
+        int n = snprintf(line, sizeof(line), "#!%s " THIN_FLAG "\n", w->opts->thin_runtime);
+        if (n > 255) { fprintf(stderr, "Runtime path too long: %s\n", w->opts->thin_runtime); return 1; }
+        w->stub = (unsigned char *)strdup(line);
+        w->stub_size = (uint64_t)n;
+    } else {
+        w->stub = read_file(w->stub_path, &w->stub_size);
+    }
+    if (!w->stub) { fprintf(stderr, "Failed to read stub: %s\n", w->stub_path); return 1; }
+    return 0;
+}
+
+// Write stub + payload to a temporary file next to the output and rename
+// it over the output, so a binary that is running keeps its own image.
+static int watch_write(struct watch_state *w) {
+    if (w->opts->compress && (w->opts->compress == 2 ? pb_compress_dict(&w->pb) : pb_compress(&w->pb)) != 0) return 1;
+    if (w->opts->resource_frame && pb_compress_resources(&w->pb, w->opts->resource_frame) != 0) return 1;
+    size_t len = 0;
+    unsigned char *payload_buf = serialize_payload(&w->pb, w->stub_size, w->opts->footer_flags, &len);
+    if (!payload_buf) return 1;
+    char tmp[PATH_MAX];
+    snprintf(tmp, sizeof(tmp), "%s.tmp%ld", w->out_exe, (long)getpid());
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0755);
+    int r = fd < 0 || pwrite_all(fd, w->stub, (size_t)w->stub_size, 0) != 0 ||
+            pwrite_all(fd, payload_buf, len, w->stub_size) != 0;
+    free(payload_buf);
+    if (fd >= 0 && close(fd) != 0) r = 1;
+    if (r == 0 && rename(tmp, w->out_exe) != 0) r = 1;
+    if (r != 0) {
+        fprintf(stderr, "[!] Failed to write %s: %s\n", w->out_exe, strerror(errno));
+        remove(tmp);
+    }
+    return r;
+}
+
+// inotify watch on the directory holding path. Editors commonly save by
+// renaming a new file over the old one, which a watch on the file itself
+// would not survive.
+static int watch_dir_of(int ifd, const char *path) {
+    char dir[PATH_MAX];
+    const char *slash = strrchr(path, '/');
+    if (!slash) snprintf(dir, sizeof(dir), ".");
+    else snprintf(dir, sizeof(dir), "%.*s", slash == path ? 1 : (int)(slash - path), path);
+    int wd = inotify_add_watch(ifd, dir, IN_CLOSE_WRITE | IN_MOVED_TO);
+    if (wd < 0) fprintf(stderr, "Cannot watch %s: %s\n", dir, strerror(errno));
+    return wd;
+}
+
+static int watch_matches(const struct inotify_event *ev, int wd, const char *path) {
+    const char *base = strrchr(path, '/');
+    return ev->wd == wd && ev->len > 0 && strcmp(ev->name, base ? base + 1 : path) == 0;
+}
+
+// --watch: build once, then rebuild the output every time the script, a
+// --module/--entry source or the stub changes. The interpreter stays up and
+// only changed sources are recompiled; the rest of the payload comes from
+// the cached entries.
+static int watch_mode(const char *script_path, const char *out_exe_path, struct build_options *opts) {
+    char selfpath[4096];
+    if (opts->stub) snprintf(selfpath, sizeof(selfpath), "%s", opts->stub);
+    else if (!get_self_path(selfpath, sizeof(selfpath))) { fprintf(stderr, "Cannot get self path for stub copy\n"); return 1; }
+    struct watch_state w = { .opts = opts, .out_exe = out_exe_path, .stub_path = selfpath, .stub_wd = -1 };
+    w.nsources = 1 + opts->nsources;
+    w.paths = calloc((size_t)w.nsources, sizeof(*w.paths));
+    w.wds = calloc((size_t)w.nsources, sizeof(*w.wds));
+    char *dirty = calloc((size_t)w.nsources, 1);
+    int ifd = inotify_init1(IN_CLOEXEC);
+    int r = 1;
+    if (!w.paths || !w.wds || !dirty || ifd < 0) { fprintf(stderr, "Cannot start watching: %s\n", strerror(errno)); goto end; }
+    if (watch_load_stub(&w) != 0) goto end;
+
+    Py_Initialize();
+    for (int i = 0; i < w.nsources; ++i) {
+        char name[256] = "__main__";
+        uint32_t flags = 0;
+        w.paths[i] = script_path;
+        if (i > 0 && build_source_info(opts, i - 1, name, sizeof(name), &w.paths[i], &flags) != 0) goto end;
+        if (pb_add(&w.pb, i > 0 ? opts->sources[i - 1].kind : ENTRY_MAIN, name, NULL, 0) != 0) goto end;
+        w.pb.entries[i].flags = flags;
+        if (watch_compile(&w, i) != 0) goto end;
+        if ((w.wds[i] = watch_dir_of(ifd, w.paths[i])) < 0) goto end;
+    }
+    if (opts->seal_path && capture_sys_path(opts) != 0) goto end;
+    unsigned char *meta = malloc(opts->meta_len);
+    if (meta) memcpy(meta, opts->meta, opts->meta_len);
+    if (!meta || pb_add(&w.pb, ENTRY_META, "meta", meta, opts->meta_len) != 0) goto end;
+    if (!opts->thin_runtime && (w.stub_wd = watch_dir_of(ifd, selfpath)) < 0) goto end;
+    if (watch_write(&w) != 0) goto end;
+    if (opts->depfile && write_depfile(opts, out_exe_path, script_path, opts->thin_runtime ? NULL : selfpath) != 0) goto end;
+    printf("[+] Built %s, watching %d source%s (Ctrl-C to stop)\n", out_exe_path, w.nsources, w.nsources == 1 ? "" : "s");
+    fflush(stdout);
+
+    for (;;) {
+        // one save is often several events: collect them until the sources
+        // have been quiet for 10ms, then rebuild once
+        char buf[8192] __attribute__((aligned(__alignof__(struct inotify_event))));
+        int changed = 0, stub_changed = 0;
+        struct pollfd pfd = { ifd, POLLIN, 0 };
+        while (poll(&pfd, 1, changed || stub_changed ? 10 : -1) > 0) {
+            ssize_t n = read(ifd, buf, sizeof(buf));
+            if (n <= 0) break;
+            for (char *p = buf; p < buf + n;) {
+                const struct inotify_event *ev = (const struct inotify_event *)p;
+                for (int i = 0; i < w.nsources; ++i) {
+                    if (!dirty[i] && watch_matches(ev, w.wds[i], w.paths[i])) { dirty[i] = 1; changed++; }
+                }
+                if (watch_matches(ev, w.stub_wd, selfpath)) stub_changed = 1;
+                p += sizeof(*ev) + ev->len;
+            }
+        }
+        // Python's SIGINT handler only sets a flag; poll() ending in EINTR
+        // is where Ctrl-C shows up
+        if (PyErr_CheckSignals() != 0) {
+            PyErr_Clear();
+            printf("\n[*] Stopped watching %s\n", out_exe_path);
+            r = 0;
+            goto end;
+        }
+        if (!changed && !stub_changed) continue;
+        uint64_t t0 = now_ns();
+        int failed = stub_changed && watch_load_stub(&w) != 0;
+        for (int i = 0; i < w.nsources; ++i) {
+            if (dirty[i] && watch_compile(&w, i) != 0) failed = 1;
+            dirty[i] = 0;
+        }
+        if (failed) {
+            fprintf(stderr, "[!] %s not rebuilt; waiting for the next change\n", out_exe_path);
+            continue;
+        }
+        if (watch_write(&w) == 0) {
+            printf("[+] Rebuilt %s in %.1fms (%d source%s%s changed)\n", out_exe_path, (double)(now_ns() - t0) / 1e6,
+                   changed, changed == 1 ? "" : "s", stub_changed ? " and the stub" : "");
+            fflush(stdout);
+        }
+    }
+
+end:
+    if (Py_IsInitialized()) Py_FinalizeEx();
+    if (ifd >= 0) close(ifd);
+    pb_free(&w.pb);
+    free(w.stub);
+    free(w.paths);
+    free(w.wds);
+    free(dirty);
+    return r;
+}
+
+// Install this stub as the shared runtime for thin binaries:
+// DIR/runtime-X.Y, replaced atomically so running tools keep the old image.
+static int install_runtime(const char *dir) {
+    char selfpath[4096], dest[PATH_MAX], tmp[PATH_MAX];
+    if (!get_self_path(selfpath, sizeof(selfpath))) { fprintf(stderr, "Cannot get self path\n"); return 1; }
+    int n1 = snprintf(dest, sizeof(dest), "%s/runtime-%d.%d", dir, PY_MAJOR_VERSION, PY_MINOR_VERSION);
+    int n2 = snprintf(tmp, sizeof(tmp), "%s.tmp%ld", dest, (long)getpid());
+    if (n1 < 0 || (size_t)n1 >= sizeof(dest) || n2 < 0 || (size_t)n2 >= sizeof(tmp)) {
+        fprintf(stderr, "Runtime dir path too long: %s\n", dir);
+        return 1;
+    }
+
+    FILE *in = fopen(selfpath, "rb");
+    FILE *out = in ? fopen(tmp, "wb") : NULL;
+    int rc = 1;
+    if (!out) { fprintf(stderr, "Cannot write %s: %s\n", tmp, strerror(errno)); goto end; }
+    char buf[65536];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), in)) > 0) {
+        if (fwrite(buf, 1, n, out) != n) { fprintf(stderr, "Write error\n"); goto end; }
+    }
+    if (fclose(out) != 0) { out = NULL; fprintf(stderr, "Write error\n"); goto end; }
+    out = NULL;
+    if (chmod(tmp, 0755) != 0 || rename(tmp, dest) != 0) { fprintf(stderr, "Cannot install %s: %s\n", dest, strerror(errno)); goto end; }
+    printf("[+] Installed runtime %s\n", dest);
+    rc = 0;
+
+end:
+    if (out) fclose(out);
+    if (in) fclose(in);
+    if (rc != 0) remove(tmp);
+    return rc;
+}
+
+#ifdef PYCC_LIBRARY
+// Builds from threads of a process without an interpreter share one, started
+// on the first build and kept for the life of the process: initializing and
+// finalizing per build is not thread-safe. The GIL is released right away,
+// so builder_mode() takes it with PyGILState_Ensure() like any other caller.
+static pthread_once_t pycc_python_once = PTHREAD_ONCE_INIT;
+
+static void pycc_python_start(void) {
+    if (Py_IsInitialized()) return;
+    Py_InitializeEx(0);
+    PyEval_SaveThread();
+}
+
+// libpycc: pycc_build() takes the options struct of pycc.h, turns it into
+// the equivalent `--build` options and runs the builder in this process.
+int pycc_build(const struct pycc_build_options *o) {
+    if (!o || !o->script || !o->output) { fprintf(stderr, "pycc_build: script and output are required\n"); return 1; }
+    pthread_once(&pycc_python_once, pycc_python_start);
+    size_t n = 16;
+    for (const char *const *m = o->modules; m && *m; ++m) n += 2;
+    for (const char *const *e = o->entries; e && *e; ++e) n += 2;
+    for (const char *const *e = o->resources; e && *e; ++e) n += 2;
+    for (const char *const *x = o->extra_args; x && *x; ++x) n += 1;
+    char **args = calloc(n, sizeof(char *));
+    char thin[PATH_MAX + 8];
+    if (!args) return 1;
+    int argc = 0;
+    for (const char *const *m = o->modules; m && *m; ++m) { args[argc++] = "--module"; args[argc++] = (char *)*m; }
+    for (const char *const *e = o->entries; e && *e; ++e) { args[argc++] = "--entry"; args[argc++] = (char *)*e; }
+    for (const char *const *e = o->resources; e && *e; ++e) { args[argc++] = "--resource"; args[argc++] = (char *)*e; }
+    if (o->flags & PYCC_BUILD_REQUIRE_GIL) args[argc++] = "--require-gil";
+    if (o->flags & PYCC_BUILD_COMPRESS) args[argc++] = "--compress";
+    if (o->flags & PYCC_BUILD_SEAL_PATH) args[argc++] = "--seal-path";
+    if (o->flags & PYCC_BUILD_IMMORTALIZE) args[argc++] = "--immortalize";
+    if (o->flags & PYCC_BUILD_NO_IMPORT_FINDER) args[argc++] = "--no-import-finder";
+    if (o->thin_runtime) {
+        snprintf(thin, sizeof(thin), "--thin=%s", o->thin_runtime);
+        args[argc++] = thin;
+    }
+    for (const char *const *x = o->extra_args; x && *x; ++x) args[argc++] = (char *)*x;
+
+    struct build_options *opts = malloc(sizeof(*opts));
+    int r = opts ? parse_build_options(argc, args, 0, opts) : 1;
+    if (r == 0) {
+        if (o->stub) opts->stub = o->stub;
+        opts->quiet = (o->flags & PYCC_BUILD_QUIET) != 0;
+        opts->progress = o->progress;
+        opts->progress_ctx = o->progress_ctx;
+        if (opts->watch) { fprintf(stderr, "pycc_build: --watch is only available from the command line\n"); r = 1; }
+        else r = builder_mode(o->script, o->output, opts);
+    }
+    if (opts) free(opts->sources);
+    free(opts);
+    free(args);
+    return r;
+}
+
+// pyccbuild: the same library as a Python extension module, for build
+// orchestrators that run many builds from threads of one process.
+struct pyccbuild_ctx {
+    PyObject *callback;
+    int failed;
+};
+
+static const char *const PYCCBUILD_STAGES[] = { "", "compile", "compress", "write", "stub", "done" };
+
+static void pyccbuild_progress(void *ctx, const struct pycc_progress *p) {
+    struct pyccbuild_ctx *c = ctx;
+    if (c->failed) return;
+    PyGILState_STATE g = PyGILState_Ensure();
+    PyObject *r = PyObject_CallFunction(c->callback, "sziiKd", PYCCBUILD_STAGES[p->stage], p->name, p->done, p->total,
+                                        p->bytes, p->elapsed_ms);
+    if (!r) {
+        PyErr_WriteUnraisable(c->callback);
+        c->failed = 1;
+    }
+    Py_XDECREF(r);
+    PyGILState_Release(g);
+}
+
+// Sequence of str -> NULL-terminated array borrowing the UTF-8 buffers of
+// `keep` (a list that must outlive the array). Returns NULL with an exception.
+static const char **pyccbuild_strings(PyObject *seq, PyObject *keep) {
+    Py_ssize_t n = 0;
+    PyObject *fast = NULL;
+    if (seq && seq != Py_None) {
+        fast = PySequence_Fast(seq, "expected a sequence of str");
+        if (!fast) return NULL;
+        n = PySequence_Fast_GET_SIZE(fast);
+    }
+    const char **out = PyMem_Calloc((size_t)n + 1, sizeof(char *));
+    if (!out) { Py_XDECREF(fast); PyErr_NoMemory(); return NULL; }
+    for (Py_ssize_t i = 0; i < n; ++i) {
+        PyObject *item = PySequence_Fast_GET_ITEM(fast, i);
+        if (!PyUnicode_Check(item) || PyList_Append(keep, item) != 0 || !(out[i] = PyUnicode_AsUTF8(item))) {
+            if (!PyErr_Occurred()) PyErr_SetString(PyExc_TypeError, "expected a sequence of str");
+            PyMem_Free(out);
+            Py_XDECREF(fast);
+            return NULL;
+        }
+    }
+    Py_XDECREF(fast);
+    return out;
+}
+
+static PyObject *pyccbuild_build(PyObject *self, PyObject *args, PyObject *kw) {
+    (void)self;
+    static char *kwlist[] = { "script", "output", "stub", "modules", "entries", "resources", "extra_args", "thin_runtime",
+                              "compress", "require_gil", "seal_path", "immortalize", "import_finder", "quiet",
+                              "progress", NULL };
+    const char *script, *output, *stub = NULL, *thin = NULL;
+    PyObject *modules = NULL, *entries = NULL, *resources = NULL, *extra = NULL, *progress = Py_None;
+    int compress = 0, require_gil = 0, seal_path = 0, immortalize = 0, finder = 1, quiet = 1;
+    if (!PyArg_ParseTupleAndKeywords(args, kw, "ss|$zOOOOzppppppO", kwlist, &script, &output, &stub, &modules,
+                                     &entries, &resources, &extra, &thin, &compress, &require_gil, &seal_path, &immortalize,
+                                     &finder, &quiet, &progress)) {
+        return NULL;
+    }
+    if (progress != Py_None && !PyCallable_Check(progress)) {
+        PyErr_SetString(PyExc_TypeError, "progress must be callable");
+        return NULL;
+    }
+    PyObject *keep = PyList_New(0);
+    if (!keep) return NULL;
+    const char **mods = pyccbuild_strings(modules, keep);
+    const char **ents = mods ? pyccbuild_strings(entries, keep) : NULL;
+    const char **rsrc = ents ? pyccbuild_strings(resources, keep) : NULL;
+    const char **xtra = rsrc ? pyccbuild_strings(extra, keep) : NULL;
+    PyObject *result = NULL;
+    if (xtra) {
+        struct pyccbuild_ctx ctx = { progress, 0 };
+        struct pycc_build_options o = {
+            .script = script, .output = output, .stub = stub, .modules = mods, .entries = ents,
+            .resources = rsrc, .extra_args = xtra, .thin_runtime = thin,
+            .flags = (compress ? PYCC_BUILD_COMPRESS : 0) | (require_gil ? PYCC_BUILD_REQUIRE_GIL : 0) |
+                     (seal_path ? PYCC_BUILD_SEAL_PATH : 0) | (immortalize ? PYCC_BUILD_IMMORTALIZE : 0) |
+                     (finder ? 0 : PYCC_BUILD_NO_IMPORT_FINDER) | (quiet ? PYCC_BUILD_QUIET : 0),
+            .progress = progress != Py_None ? pyccbuild_progress : NULL, .progress_ctx = &ctx,
+        };
+        int r;
+        uint64_t t0 = now_ns();
+        // the builder takes the GIL back only to compile
+        Py_BEGIN_ALLOW_THREADS
+        r = pycc_build(&o);
+        Py_END_ALLOW_THREADS
+        if (r != 0) {
+            PyErr_Format(PyExc_RuntimeError, "pycc build of %s failed (code %d)", output, r);
+        } else {
+            result = PyFloat_FromDouble((double)(now_ns() - t0) / 1e6);
+        }
+    }
+    PyMem_Free(mods);
+    PyMem_Free(ents);
+    PyMem_Free(rsrc);
+    PyMem_Free(xtra);
+    Py_DECREF(keep);
+    return result;
+}
+
+static PyMethodDef pyccbuild_methods[] = {
+    {"build", (PyCFunction)(void (*)(void))pyccbuild_build, METH_VARARGS | METH_KEYWORDS,
+     "build(script, output, *, stub, modules=(), entries=(), resources=(), extra_args=(), thin_runtime=None,\n"
+     "      compress=False, require_gil=False, seal_path=False, immortalize=False, import_finder=True, quiet=True,\n"
+     "      progress=None)\n"
+     "Build a pycc binary in this process and return the build time in ms. The GIL is released except while\n"
+     "compiling; progress(stage, name, done, total, bytes, elapsed_ms) is called as the build advances."},
+    {NULL, NULL, 0, NULL}
+};
+
+static struct PyModuleDef pyccbuild_module = {
+    PyModuleDef_HEAD_INIT, "pyccbuild", "In-process pycc builder (libpycc).", -1, pyccbuild_methods,
+    NULL, NULL, NULL, NULL
+};
+
+PyMODINIT_FUNC PyInit_pyccbuild(void) {
+    return PyModule_Create(&pyccbuild_module);
+}
+
+// The command line is pycc_main() in the library.
+#define main pycc_main
+#endif // PYCC_LIBRARY
+
+int main(int argc, char **argv) {
+    if (argc >= 2 && strcmp(argv[1], "--build") == 0) {
+        if (argc < 4) {
+            fprintf(stderr, "Usage: %s --build <script.py> <out_binary> [--require-gil] [--gc-freeze[=fork]]\n"
+                            "       [--gc-threshold a[,b[,c]]] [--immortalize]\n"
+                            "       [--serve stdin|unix:PATH] [--serve-format ndjson|frame] [--serve-entry name] [--serve-pipeline n]\n"
+                            "       [--module NAME=PATH]... [--entry NAME=PATH]... [--resource NAME=PATH]... [--seal-path] [--no-import-finder]\n"
+                            "       [--thin[=RUNTIME]] [--compress] [--compress-dict] [--compress-resources[=KB]] [--stub pycc]\n"
+                            "       [--depfile out.d] [--reproducible] [--watch]\n", argv[0]);
+            return 1;
+        }
+        const char *script = argv[2];
+        const char *outexe = argv[3];
+        struct build_options opts;
+        int r = parse_build_options(argc, argv, 4, &opts);
+        if (r == 0) r = opts.watch ? watch_mode(script, outexe, &opts) : builder_mode(script, outexe, &opts);
+        free(opts.sources);
+        return r;
+    } else if (argc >= 2 && strcmp(argv[1], "top") == 0 && !self_has_payload()) {
+        return top_mode(argc, argv);
+    } else if (argc >= 2 && strcmp(argv[1], "bench-startup") == 0 && !self_has_payload()) {
+        return bench_startup_mode(argc, argv);
+    } else if (argc >= 2 && strcmp(argv[1], "bench-build") == 0 && !self_has_payload()) {
+        return bench_build_mode(argc, argv);
+    } else if (argc >= 2 && strcmp(argv[1], "bench-memory") == 0 && !self_has_payload()) {
+        return bench_memory_mode(argc, argv);
+    } else if (argc >= 2 && strcmp(argv[1], "bench-launch") == 0 && !self_has_payload()) {
+        return bench_launch_mode(argc, argv);
+    } else if (argc >= 2 && strcmp(argv[1], "bench") == 0 && !self_has_payload()) {
+        return bench_binary_mode(argc, argv);
+    } else if (argc >= 2 && strcmp(argv[1], "inspect") == 0 && !self_has_payload()) {
+        return inspect_mode(argc, argv);
+    } else if (argc >= 2 && strcmp(argv[1], "--install-runtime") == 0 && !self_has_payload()) {
+        return install_runtime(argc >= 3 ? argv[2] : PYCC_RUNTIME_DIR);
+    } else if (argc >= 3 && strcmp(argv[1], THIN_FLAG) == 0 && !self_has_payload()) {
+        // run as the shared runtime of a thin binary; the program sees the
+        // thin file as argv[0]
+        thin_file = argv[2];
+        detect_mp_child(argc - 2, argv + 2);
+        runtime_begin();
+        int r = run_appended_payload();
+        runtime_end();
+        if (r != 0) fprintf(stderr, "pycc runtime: cannot run thin binary %s (code %d)\n", thin_file, r);
+        return r;
     } else {
         // normal run: try to find appended payload and run it
+        detect_mp_child(argc, argv);
+        runtime_begin();
         int r = run_appended_payload();
+        runtime_end();
         if (r != 0) {
             fprintf(stderr, "Bootloader: no embedded payload or run failed (code %d)\n", r);
-            fprintf(stderr, "Usage to build: %s --build <script.py> <out_binary>\n", argv[0]);
+            if (r == 7) {
+                fprintf(stderr, "Usage: %s --build <script.py> <out_binary> [options]\n"
+                                "       %s top [-d seconds] [-n iterations]\n"
+                                "       %s bench-startup [options]\n"
+                                "       %s bench-build [options]\n"
+                                "       %s bench-memory [options]\n"
+                                "       %s bench-launch [options]\n"
+                                "       %s bench [options] <binary> [args...]\n"
+                                "       %s inspect [options] <binary>\n"
+                                "       %s inspect --diff [options] <old_binary> <new_binary>\n"
+                                "       %s --install-runtime [dir]\n",
+                        argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0]);
+            }
         }
         return r;
     }